@@ -27,18 +27,42 @@
 #include <getopt.h>
 #include <string.h>
 #include <glob.h>
+#include <regex.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
 
 #include <alpm_list.h>
 #include <alpm.h>
 
+#ifdef HAVE_LIBARCHIVE
+#include <archive.h>
+#include <archive_entry.h>
+#endif
+
+#ifdef ALLOC_STATS
+#include <malloc.h>
+#endif
+
+/* the benchmarks time both classification engines */
+#if defined(PACDEP_BENCH) && !defined(PACDEP_ENGINES)
+#define PACDEP_ENGINES
+#endif
+
 #define BUF_LEN                 255
 
 /* pacman default values */
 #define PACMAN_CONFFILE         "/etc/pacman.conf"
 #define PACMAN_ROOTDIR          "/"
 #define PACMAN_DBPATH           "/var/lib/pacman/"
+#define PACMAN_CACHEDIR         "/var/cache/pacman/pkg/"
 
 #if defined(GIT_VERSION)
 #undef PACKAGE_VERSION
@@ -46,6 +70,35 @@
 #endif
 #define PACKAGE_TAG             "Package Dependencies listing"
 
+/* first line of a snapshot, see export_snapshot() */
+#define SNAPSHOT_HEADER         "#pacdep-snapshot 1"
+#define SNAPSHOT_NB_FIELDS      7
+
+/* long options without short equivalent */
+enum {
+    OPT_SHOW_PROVIDER = 256,
+    OPT_MAX_NODES,
+    OPT_DEADLINE,
+    OPT_ROOT,
+    OPT_SNAPSHOT,
+    OPT_EXPORT_SNAPSHOT,
+    OPT_ACTUAL_SIZE,
+    OPT_DOWNLOAD_SIZE,
+    OPT_COMPARE_ENGINES,
+    OPT_FUZZ_ENGINES,
+    OPT_TRACE,
+    OPT_FREE,
+    OPT_GRAPH_STATS,
+    OPT_CHECK,
+    OPT_ATTRIBUTE,
+    OPT_OUTPUT,
+    OPT_HOOK,
+    OPT_REGEX,
+    OPT_OVERLAP,
+    OPT_EXPLAIN,
+    OPT_UPGRADES,
+};
+
 enum {
     E_OK = 0,
     E_NOMEM,
@@ -53,6 +106,9 @@ enum {
     E_PARSING,
     E_ALPM,
     E_NOTHING,
+    E_FILEWRITE,
+    E_MISMATCH,
+    E_BROKEN,
 };
 
 /* config data loaded from parsing pacman.conf */
@@ -60,6 +116,7 @@ typedef struct _pacman_config_t {
     /* from pacman.conf */
     char            *rootdir;
     char            *dbpath;
+    alpm_list_t     *cachedirs;
     /* dbs/repos */
     alpm_list_t     *databases;
 } pacman_config_t;
@@ -75,22 +132,103 @@ typedef enum {
     NB_DEPS
 } dep_t;
 
+/* handle of a string in the pool; 0 is never a valid handle */
+typedef unsigned int str_t;
+
+/* string pool: every name (package, repo, provision) is interned once, so
+ * comparing names is done comparing handles. Strings are stored back to back
+ * in blocks that are never moved, so pointers to them remain valid */
+typedef struct _strpool_t {
+    alpm_list_t     *blocks;
+    char            *block;         /* current block */
+    size_t           block_used;
+    const char     **str;           /* handle -> string */
+    unsigned long   *hash;          /* handle -> hash */
+    unsigned int    *rank;          /* handle -> rank (in sorted order) */
+    str_t            count;         /* number of handles used (incl. 0) */
+    str_t            alloc;
+    str_t            ranked;        /* handles < ranked have a valid rank */
+    str_t           *table;         /* hash table (open addressing) */
+    size_t           table_size;
+    pthread_rwlock_t lock;
+} strpool_t;
+
+/* index by name: handle -> list */
+typedef struct _nameidx_t {
+    alpm_list_t    **lists;
+    str_t            len;
+    void            *items;         /* storage for what's in lists, if any */
+    unsigned int     is_built : 1;
+} nameidx_t;
+
+struct _pkgdb_t;
+
+/* a package as known to pacdep, whether it comes from libalpm or a snapshot.
+ * All strings & lists belong to the package/db it comes from */
+typedef struct _pkginfo_t {
+    str_t            name_id;
+    const char      *name;
+    const char      *version;
+    off_t            isize;
+    off_t            size;          /* download size (sync only) */
+    const char      *filename;      /* package file (sync only) */
+    alpm_pkgreason_t reason;
+    alpm_list_t     *depends;       /* alpm_depend_t */
+    alpm_list_t     *optdepends;    /* alpm_depend_t */
+    alpm_list_t     *provides;      /* alpm_depend_t */
+    struct _pkgdb_t *db;
+    alpm_pkg_t      *pkg;           /* NULL for a snapshot/desc file */
+    char            *desc;          /* desc file content, version points to it */
+    unsigned int     own_lists : 1; /* lists are ours (snapshot, desc file) */
+} pkginfo_t;
+
+/* a db (local, or a repo) as known to pacdep. Packages are only loaded from
+ * libalpm on first use, whereas a snapshot is loaded all at once */
+typedef struct _pkgdb_t {
+    const char      *name;          /* repo name, NULL for the local db */
+    alpm_db_t       *db;            /* NULL for a snapshot */
+    pkginfo_t       *pkgs;
+    size_t           nb_pkgs;
+    nameidx_t        by_name;       /* pkginfo_t by name */
+    char            *buf;           /* snapshot content, pkgs point to it */
+    char            *path;          /* local db dir, or sync db file */
+    nameidx_t       *only;          /* if set, names of the packages to load */
+    unsigned int     is_loaded : 1;
+} pkgdb_t;
+
 typedef struct _pkg_t {
     const char      *name_asked;    /* from cmdline */
     const char      *name;          /* can be a provider */
     const char      *repo;
+    str_t            name_id;
+    const char      *provision;     /* name it was pulled in as, if provider */
     unsigned int     is_provided : 1;
-    unsigned int     need_free : 1;
-    alpm_pkg_t      *pkg;
+    unsigned int     has_actual : 1;
+    unsigned int     has_download : 1;
+    off_t            size_actual;   /* --actual-size */
+    off_t            size_download; /* --download-size, 0 if in cache */
+    pkginfo_t       *pkg;
     alpm_list_t     *deps;
     dep_t            dep;
     struct _pkg_t   *req_by;
+    unsigned int     is_main : 1;   /* in data->pkgs */
+    /* indexed engine, see get_pkg_dep_state_indexed() */
+    unsigned int     has_reqs : 1;
+    struct _pkg_t  **reqs;          /* requirers in our tree; NULL: outsider */
+    size_t           nb_reqs;
+    unsigned int     nb_refs;       /* times it is in the chain of "refs" */
+    /* --attribute */
+    size_t           pos;           /* in data->deps */
+    off_t            size_own;      /* itself & deps only it needs */
+    off_t            size_attributed;
 } pkg_t;
 
 typedef struct _group_t {
     const char  *title;
     off_t        size;
     off_t        size_local;
+    off_t        size_actual;
+    off_t        size_download;
     alpm_list_t *pkgs;
     int          len_max;
 } group_t;
@@ -102,22 +240,120 @@ typedef enum {
     SCE_MIXED
 } source_t;
 
+/* a package and one of its dependencies/provisions */
+typedef struct _pkgdep_t {
+    pkginfo_t       *pkg;
+    alpm_depend_t   *dep;
+} pkgdep_t;
+
+/* what satisfies a dependency, see expand_parallel() */
+typedef struct _satisfier_t {
+    pkginfo_t       *pkg;           /* NULL if none was found */
+    const char      *provision;
+    unsigned int     is_resolved : 1; /* else left to add_to_deps() */
+} satisfier_t;
+
+/* satisfiers of the dependencies of every package in a db */
+typedef struct _dbsats_t {
+    satisfier_t    **by_pkg;        /* NULL: not resolved (yet) */
+    size_t           nb_pkgs;
+} dbsats_t;
+
 typedef struct _data_t {
+    const char  *root;          /* NULL unless --root/--snapshot was used */
+    alpm_list_t *localdb;       /* pkgdb_t (only one) */
+    nameidx_t    optreqs_local;
+    nameidx_t    provides_local;
+    nameidx_t    requiredby_local;
     alpm_list_t *pkgs;
     source_t     source;
     group_t      group[NB_DEPS];
     alpm_list_t *deps;
+    /* reverse mode */
+    unsigned int rev_nodes;     /* requirers found */
+    int          rev_depth;     /* levels fully expanded */
+    const char  *rev_stopped;   /* why expansion was stopped, if it was */
+    long long    rev_start;     /* when the analysis started, for --deadline */
+    /* pkg_t (deps) by name, see find_pkg() */
+    nameidx_t    deps_by_name;
+    /* parallel expansion: localdb, then config.syncdbs */
+    dbsats_t    *sats;
+    size_t       nb_sats;
+    /* --actual-size */
+    unsigned int has_actual : 1;
+    /* --download-size */
+    unsigned int has_download : 1;
+    /* --compare-engines */
+    unsigned int engines_diff;
+    long long    engines_us[2];     /* reference, indexed */
+    /* --attribute: shares of installed packages outside the tree */
+    off_t        size_outside;
+    size_t       nb_outside;
 } data_t;
 
+typedef enum {
+    ATTRIBUTE_NONE = 0,
+    ATTRIBUTE_EVEN,
+    ATTRIBUTE_WEIGHTED
+} attribute_t;
+
+/* --hook: the transaction pacman is about to perform */
+typedef enum {
+    HOOK_NONE = 0,
+    HOOK_REMOVE,
+    HOOK_INSTALL
+} hook_t;
+
+/* --output: another rendering of the results, to a file */
+typedef enum {
+    OUTPUT_HUMAN = 0,
+    OUTPUT_QUIET,
+    OUTPUT_RAW,
+    OUTPUT_JSON
+} output_format_t;
+
+typedef struct _output_t {
+    output_format_t  format;
+    const char      *file;
+} output_t;
+
 typedef struct _config_t {
     alpm_handle_t   *alpm;
-    alpm_list_t     *localdb;
-    alpm_list_t     *syncdbs;
+    alpm_list_t     *syncdbs;       /* pkgdb_t */
+    /* packages with optional dependencies, by optdep name */
+    nameidx_t        optreqs_sync;
+    /* pkgdep_t (provisions) by provided name */
+    nameidx_t        provides_sync;
+    /* pkgdep_t (dependencies) by name depended upon */
+    nameidx_t        requiredby_sync;
+    /* --root (paths) */
+    alpm_list_t     *roots;
+    /* --snapshot (files) */
+    alpm_list_t     *snapshots;
+    /* --trace (file) */
+    const char      *trace;
+    /* where results are printed; stdout, else an --output file */
+    FILE            *out;
+    /* --output (output_t) */
+    alpm_list_t     *outputs;
+    unsigned int     jobs;
+    /* names of all files in the package cache, sorted */
+    char           **cache_files;
+    size_t           nb_cache_files;
 
     unsigned int     is_debug : 1;
     unsigned int     from_sync : 1;
+    unsigned int     regex : 1;
     unsigned int     quiet : 1;
     unsigned int     show_path : 1;
+    unsigned int     show_provider : 1;
+    unsigned int     actual_size : 1;
+    unsigned int     download_size : 1;
+    unsigned int     compare_engines : 1;
+    unsigned int     graph_stats : 1;
+    unsigned int     check : 1;
+    unsigned int     overlap : 1;
+    unsigned int     upgrades : 1;
     unsigned int     raw_sizes : 1;
     unsigned int     sort_size : 1;
     unsigned int     show_optional : 2;
@@ -130,22 +366,45 @@ typedef struct _config_t {
     unsigned int     list_shared_explicit : 1;
     unsigned int     list_optional : 1;
     unsigned int     list_optional_explicit : 1;
+
+    /* --fuzz-engines */
+    unsigned int     fuzz_rounds;
+    /* --free (bytes) */
+    off_t            free_target;
+    /* --attribute */
+    attribute_t      attribute;
+    /* --explain (package name) */
+    const char      *explain;
+    /* --hook */
+    hook_t           hook;
+
+    /* budget for reverse mode */
+    unsigned int     max_nodes;
+    unsigned long    deadline;      /* ms */
+    long long        start;         /* us */
 } config_t;
 
 static config_t config;
+static strpool_t pool = { .lock = PTHREAD_RWLOCK_INITIALIZER };
 
 static void
 set_pkg_dep (data_t *data, alpm_list_t *refs, pkg_t *pkg, dep_t dep);
-
-#define print_size(size)    do {         \
-    if (config.raw_sizes)                \
-    {                                    \
-        fprintf (stdout, "%ld", size);   \
-    }                                    \
-    else                                 \
-    {                                    \
-        _print_size (size);              \
-    }                                    \
+#ifdef PACDEP_ENGINES
+static void
+set_pkg_dep_indexed (data_t *data, pkg_t *pkg, dep_t dep);
+#endif
+static void
+attribute_sizes (data_t *data);
+
+#define print_size(size)    do {             \
+    if (config.raw_sizes)                    \
+    {                                        \
+        fprintf (config.out, "%ld", size);   \
+    }                                        \
+    else                                     \
+    {                                        \
+        _print_size (size);                  \
+    }                                        \
 } while (0)
 
 #define FOR_LIST(i, val)    for (i = val; i; i = i->next)
@@ -166,30 +425,444 @@ debug (const char *fmt, ...)
     va_end (args);
 }
 
-static char *
-strdup (const char *str)
+#ifdef ALLOC_STATS
+/* --enable-alloc-stats: allocations made by pacdep itself (not by libalpm)
+ * are counted, by wrapping malloc & co at link time (see Makefile.am). Live
+ * bytes are only approximate, as pacdep also frees memory libalpm allocated */
+typedef struct _alloc_stats_t {
+    size_t           calls;
+    size_t           bytes;         /* requested */
+    long long        live;          /* usable size */
+    long long        peak;
+    size_t           nb_pkgs;       /* processed, i.e. added to a tree */
+} alloc_stats_t;
+
+static alloc_stats_t alloc_stats;
+
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t nmemb, size_t size);
+void *__real_realloc (void *ptr, size_t size);
+char *__real_strdup (const char *s);
+void  __real_free (void *ptr);
+void *__wrap_malloc (size_t size);
+void *__wrap_calloc (size_t nmemb, size_t size);
+void *__wrap_realloc (void *ptr, size_t size);
+char *__wrap_strdup (const char *s);
+void  __wrap_free (void *ptr);
+
+static inline void
+alloc_count (size_t size, long long live)
 {
-    char    *s;
-    size_t   len;
+    long long peak;
+
+    __atomic_fetch_add (&alloc_stats.calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add (&alloc_stats.bytes, size, __ATOMIC_RELAXED);
+    live = __atomic_add_fetch (&alloc_stats.live, live, __ATOMIC_RELAXED);
+    peak = __atomic_load_n (&alloc_stats.peak, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n (&alloc_stats.peak,
+                &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void *
+__wrap_malloc (size_t size)
+{
+    void *ptr = __real_malloc (size);
 
-    if (!str)
+    alloc_count (size, (ptr) ? (long long) malloc_usable_size (ptr) : 0);
+    return ptr;
+}
+
+void *
+__wrap_calloc (size_t nmemb, size_t size)
+{
+    void *ptr = __real_calloc (nmemb, size);
+
+    alloc_count (nmemb * size, (ptr) ? (long long) malloc_usable_size (ptr) : 0);
+    return ptr;
+}
+
+void *
+__wrap_realloc (void *ptr, size_t size)
+{
+    long long old = (ptr) ? (long long) malloc_usable_size (ptr) : 0;
+
+    ptr = __real_realloc (ptr, size);
+    alloc_count (size, (ptr) ? (long long) malloc_usable_size (ptr) - old : 0);
+    return ptr;
+}
+
+char *
+__wrap_strdup (const char *s)
+{
+    char *ptr = __real_strdup (s);
+
+    alloc_count (strlen (s) + 1,
+            (ptr) ? (long long) malloc_usable_size (ptr) : 0);
+    return ptr;
+}
+
+void
+__wrap_free (void *ptr)
+{
+    if (ptr)
     {
-        return NULL;
+        __atomic_fetch_sub (&alloc_stats.live,
+                (long long) malloc_usable_size (ptr), __ATOMIC_RELAXED);
     }
+    __real_free (ptr);
+}
+#endif
+
+/* monotonic time, in microseconds */
+static long long
+now_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+typedef void (*job_fn) (void *ctx, size_t n);
+
+typedef struct _jobs_t {
+    job_fn           fn;
+    void            *ctx;
+    size_t           nb;
+    size_t           next;
+    pthread_mutex_t  mutex;
+} jobs_t;
 
-    len = strlen (str);
-    s = malloc (sizeof (*s) * (len + 1));
-    if (!s)
+/* whether the current thread is running jobs; run_jobs() is then serial */
+static __thread bool in_jobs;
+
+static void *
+jobs_worker (void *arg)
+{
+    jobs_t *jobs = arg;
+    bool    was_in_jobs = in_jobs;
+
+    in_jobs = true;
+    for (;;)
     {
-        return NULL;
+        size_t n;
+
+        pthread_mutex_lock (&jobs->mutex);
+        n = jobs->next++;
+        pthread_mutex_unlock (&jobs->mutex);
+        if (n >= jobs->nb)
+        {
+            break;
+        }
+        jobs->fn (jobs->ctx, n);
+    }
+    in_jobs = was_in_jobs;
+    return NULL;
+}
+
+/* worker threads, only created once (as needed) and then waiting for jobs
+ * from run_jobs(), until free_workers() */
+typedef struct _workers_t {
+    pthread_t       *threads;
+    size_t           nb_threads;
+    jobs_t          *jobs;          /* being run */
+    unsigned long    round;         /* bumped for every run_jobs() */
+    size_t           slots;         /* threads still wanted for jobs */
+    size_t           busy;          /* threads working on jobs */
+    unsigned int     quit : 1;
+    pthread_mutex_t  mutex;
+    pthread_cond_t   cond;          /* new round, or quit */
+    pthread_cond_t   done;          /* busy reached 0 */
+} workers_t;
+
+static workers_t workers = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER
+};
+static void *
+workers_thread (void *arg)
+{
+    unsigned long round = 0;
+
+    (void) arg;
+    pthread_mutex_lock (&workers.mutex);
+    for (;;)
+    {
+        jobs_t *jobs;
+
+        while (!workers.quit && workers.round == round)
+        {
+            pthread_cond_wait (&workers.cond, &workers.mutex);
+        }
+        if (workers.quit)
+        {
+            break;
+        }
+        round = workers.round;
+        if (workers.slots == 0)
+        {
+            continue;
+        }
+        --workers.slots;
+        ++workers.busy;
+        jobs = workers.jobs;
+        pthread_mutex_unlock (&workers.mutex);
+
+        jobs_worker (jobs);
+
+        pthread_mutex_lock (&workers.mutex);
+        if (--workers.busy == 0)
+        {
+            pthread_cond_signal (&workers.done);
+        }
     }
-    while (*str != '\0')
+    pthread_mutex_unlock (&workers.mutex);
+    return NULL;
+}
+
+/* calls fn (ctx, n) for every n in [0, nb[ using up to config.jobs threads
+ * (incl. the calling one), and returns once all are done. When called from a
+ * job, everything is done by the calling thread: jobs are never nested */
+static void
+run_jobs (job_fn fn, void *ctx, size_t nb)
+{
+    jobs_t       jobs = { fn, ctx, nb, 0, PTHREAD_MUTEX_INITIALIZER };
+    size_t       nb_threads;
+
+    nb_threads = (config.jobs < nb) ? config.jobs : nb;
+    if (in_jobs || nb_threads <= 1)
     {
-        *s++ = *str++;
+        size_t n;
+
+        for (n = 0; n < nb; ++n)
+        {
+            fn (ctx, n);
+        }
+        pthread_mutex_destroy (&jobs.mutex);
+        return;
     }
-    *s = '\0';
-    s -= len;
-    return s;
+
+    pthread_mutex_lock (&workers.mutex);
+    if (workers.nb_threads < nb_threads - 1)
+    {
+        pthread_t *threads;
+
+        threads = realloc (workers.threads, sizeof (*threads) * (nb_threads - 1));
+        if (threads)
+        {
+            workers.threads = threads;
+            while (workers.nb_threads < nb_threads - 1
+                    && pthread_create (&threads[workers.nb_threads], NULL,
+                        workers_thread, NULL) == 0)
+            {
+                ++workers.nb_threads;
+            }
+        }
+    }
+    workers.jobs = &jobs;
+    workers.slots = (workers.nb_threads < nb_threads - 1)
+        ? workers.nb_threads : nb_threads - 1;
+    ++workers.round;
+    pthread_cond_broadcast (&workers.cond);
+    pthread_mutex_unlock (&workers.mutex);
+
+    jobs_worker (&jobs);
+
+    /* threads that didn't get to it yet aren't needed anymore */
+    pthread_mutex_lock (&workers.mutex);
+    workers.slots = 0;
+    while (workers.busy > 0)
+    {
+        pthread_cond_wait (&workers.done, &workers.mutex);
+    }
+    workers.jobs = NULL;
+    pthread_mutex_unlock (&workers.mutex);
+    pthread_mutex_destroy (&jobs.mutex);
+}
+
+static void
+free_workers (void)
+{
+    size_t n;
+
+    pthread_mutex_lock (&workers.mutex);
+    workers.quit = true;
+    pthread_cond_broadcast (&workers.cond);
+    pthread_mutex_unlock (&workers.mutex);
+    for (n = 0; n < workers.nb_threads; ++n)
+    {
+        pthread_join (workers.threads[n], NULL);
+    }
+    free (workers.threads);
+    workers.threads = NULL;
+    workers.nb_threads = 0;
+    workers.quit = false;
+}
+
+/* --trace: spans are kept in memory, and only written (in Chrome's trace
+ * event format, for chrome://tracing or ui.perfetto.dev) once done */
+typedef struct _trace_event_t {
+    const char      *name;
+    char            *arg;
+    long long        ts;            /* us, since start */
+    long long        dur;
+    unsigned int     tid;
+#ifdef ALLOC_STATS
+    size_t           allocs;        /* so far, at the end of the span */
+    long long        live;
+#endif
+} trace_event_t;
+
+typedef struct _trace_t {
+    trace_event_t   *events;
+    size_t           nb;
+    size_t           alloc;
+    unsigned int     nb_threads;
+    pthread_mutex_t  mutex;
+} trace_t;
+
+static trace_t trace = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+static __thread unsigned int trace_tid;
+
+/* start of a span, to give to trace_end() */
+static inline long long
+trace_begin (void)
+{
+    return (config.trace) ? now_us () : 0;
+}
+
+/* records span name (a literal) started at start, with arg (copied) as detail
+ * if not NULL */
+static void
+trace_end (const char *name, const char *arg, long long start)
+{
+    trace_event_t   *event;
+    long long        end;
+
+    if (!config.trace)
+    {
+        return;
+    }
+    end = now_us ();
+
+    pthread_mutex_lock (&trace.mutex);
+    if (trace_tid == 0)
+    {
+        trace_tid = ++trace.nb_threads;
+    }
+    if (trace.nb == trace.alloc)
+    {
+        size_t alloc = (trace.alloc) ? trace.alloc * 2 : 1024;
+
+        event = realloc (trace.events, sizeof (*event) * alloc);
+        if (!event)
+        {
+            /* event is lost, no big deal */
+            pthread_mutex_unlock (&trace.mutex);
+            return;
+        }
+        trace.events = event;
+        trace.alloc = alloc;
+    }
+    event = &trace.events[trace.nb++];
+    event->name = name;
+    event->arg  = (arg) ? strdup (arg) : NULL;
+    event->ts   = start - config.start;
+    event->dur  = end - start;
+    event->tid  = trace_tid;
+#ifdef ALLOC_STATS
+    event->allocs = alloc_stats.calls;
+    event->live   = alloc_stats.live;
+#endif
+    pthread_mutex_unlock (&trace.mutex);
+}
+
+/* writes str as a JSON string */
+static void
+write_json_str (FILE *fp, const char *str)
+{
+    fputc ('"', fp);
+    for ( ; *str; ++str)
+    {
+        if (*str == '"' || *str == '\\')
+        {
+            fprintf (fp, "\\%c", *str);
+        }
+        else if ((unsigned char) *str < 0x20)
+        {
+            fprintf (fp, "\\u%04x", (unsigned int) *str);
+        }
+        else
+        {
+            fputc (*str, fp);
+        }
+    }
+    fputc ('"', fp);
+}
+
+/* writes (and frees) all spans recorded to the --trace file */
+static int
+write_trace (void)
+{
+    FILE    *fp;
+    size_t   n;
+    int      rc = E_OK;
+
+    debug ("writing trace (%zu events) to %s\n", trace.nb, config.trace);
+    fp = fopen (config.trace, "w");
+    if (!fp)
+    {
+        fprintf (stderr, "Error: Trace %s could not be written\n", config.trace);
+        rc = E_FILEWRITE;
+    }
+    if (fp)
+    {
+        fputs ("{\"traceEvents\":[\n", fp);
+        fputs ("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,"
+                "\"args\":{\"name\":\"pacdep\"}}", fp);
+    }
+    for (n = 0; n < trace.nb; ++n)
+    {
+        trace_event_t *event = &trace.events[n];
+
+        if (fp)
+        {
+            fputs (",\n{\"name\":", fp);
+            write_json_str (fp, event->name);
+            fprintf (fp, ",\"cat\":\"pacdep\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+                    "\"pid\":1,\"tid\":%u",
+                    event->ts, event->dur, event->tid);
+            if (event->arg)
+            {
+                fputs (",\"args\":{\"detail\":", fp);
+                write_json_str (fp, event->arg);
+                fputc ('}', fp);
+            }
+            fputc ('}', fp);
+#ifdef ALLOC_STATS
+            fprintf (fp, ",\n{\"name\":\"heap\",\"ph\":\"C\",\"ts\":%lld,\"pid\":1,"
+                    "\"args\":{\"allocs\":%zu,\"live\":%lld}}",
+                    event->ts + event->dur, event->allocs, event->live);
+#endif
+        }
+        free (event->arg);
+    }
+    free (trace.events);
+    trace.events = NULL;
+    trace.nb = trace.alloc = 0;
+
+    if (fp)
+    {
+        fputs ("\n],\"displayTimeUnit\":\"ms\"}\n", fp);
+        if (fclose (fp) != 0)
+        {
+            fprintf (stderr, "Error: Trace %s could not be written\n", config.trace);
+            rc = E_FILEWRITE;
+        }
+    }
+    return rc;
 }
 
 static int
@@ -220,89 +893,453 @@ set_error (char **msg, const char *fmt, ...)
     return E_OK;
 }
 
+#define STRPOOL_BLOCK       (64 * 1024)
 
-static void
-show_version (void)
+static unsigned long
+str_hash (const char *str, size_t len)
 {
-    puts (PACKAGE_NAME " - " PACKAGE_TAG " v" PACKAGE_VERSION);
-    puts ("Copyright (C) 2012-2013 Olivier Brunel");
-    puts ("License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>");
-    puts ("This is free software: you are free to change and redistribute it.");
-    puts ("There is NO WARRANTY, to the extent permitted by law.");
-    exit (0);
+    unsigned long hash = 0;
+
+    /* sdbm */
+    while (len-- > 0)
+    {
+        hash = (unsigned long) (unsigned char) *str++ + (hash << 6)
+            + (hash << 16) - hash;
+    }
+    return hash;
 }
 
-static void
-show_help (const char *prgname)
+static bool
+strpool_grow_table (void)
 {
-    puts ("Usage:");
-    printf (" %s [OPTION..] PACKAGE..\n", prgname);
-    putchar ('\n');
-    puts (" -h, --help                      Show this help screen and exit");
-    puts (" -V, --version                   Show version information and exit");
-    putchar ('\n');
-    puts (" -d, --debug                     Flood debug info to stdout");
-    puts (" -c, --config=FILE               pacman.conf file to use (else /etc/pacman.conf)");
-    puts (" -d, --dbpath=PATH               Specify an alternate database location");
-    puts ("     --from-sync                 Only look for specified package(s) in sync dbs");
-    puts (" -q, --quiet                     Only output packages name & size");
-    puts (" -P, --show-path                 Show dependency path");
-    puts (" -w, --raw-sizes                 Show sizes in bytes (no formatting)");
-    puts (" -z, --sort-size                 Sort packages by size (else by name)");
-    puts (" -p, --show-optional             Show optional dependencies (see man page)");
-    puts (" -x, --explicit                  Don't ignore explicitly installed dependencies");
-    putchar ('\n');
-    puts (" -r, --reverse                   Enable reverse mode (see man page)");
-    puts (" -R, --list-requiredby           List packages requiring the specified package(s)");
-    putchar ('\n');
-    puts (" -e, --list-exclusive            List exclusive dependencies");
-    puts (" -E, --list-exclusive-explicit   List exclusive explicit dependencies");
-    puts (" -s, --list-shared               List shared dependencies");
-    puts (" -S, --list-shared-explicit      List shared explicit dependencies");
-    puts (" -o, --list-optional             List optional dependencies");
-    puts (" -O, --list-optional-explicit    List optional explicit dependencies");
-    exit (0);
+    str_t  *table;
+    size_t  size;
+    str_t   id;
+
+    size = (pool.table_size) ? pool.table_size * 2 : 1024;
+    table = calloc (size, sizeof (*table));
+    if (!table)
+    {
+        return false;
+    }
+    for (id = 1; id < pool.count; ++id)
+    {
+        size_t slot = pool.hash[id] & (size - 1);
+
+        while (table[slot])
+        {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = id;
+    }
+    free (pool.table);
+    pool.table = table;
+    pool.table_size = size;
+    return true;
 }
 
-static void
-free_pacman_config (pacman_config_t *pac_conf)
+static str_t
+_str_find (const char *str, size_t len, unsigned long hash, size_t *slot)
 {
-    if (pac_conf == NULL)
+    size_t s;
+
+    if (!pool.table_size)
     {
-        return;
+        *slot = 0;
+        return 0;
     }
+    for (s = hash & (pool.table_size - 1);
+            pool.table[s];
+            s = (s + 1) & (pool.table_size - 1))
+    {
+        str_t id = pool.table[s];
 
-    /* alpm */
-    free (pac_conf->rootdir);
-    free (pac_conf->dbpath);
-    /* dbs/repos */
-    FREELIST (pac_conf->databases);
+        if (pool.hash[id] == hash && strncmp (pool.str[id], str, len) == 0
+                && pool.str[id][len] == '\0')
+        {
+            *slot = s;
+            return id;
+        }
+    }
+    *slot = s;
+    return 0;
+}
 
-    free (pac_conf);
+/* returns the handle of str (of len chars), or 0 if it was never interned */
+static str_t
+str_lookup_len (const char *str, size_t len)
+{
+    unsigned long    hash = str_hash (str, len);
+    size_t           slot;
+    str_t            id;
+
+    pthread_rwlock_rdlock (&pool.lock);
+    id = _str_find (str, len, hash, &slot);
+    pthread_rwlock_unlock (&pool.lock);
+    return id;
 }
 
-static size_t
-strtrim (char *str)
+static inline str_t
+str_lookup (const char *str)
 {
-    char *s, *ss, *e;
-    size_t len;
+    return str_lookup_len (str, strlen (str));
+}
 
-    /* nothing to do */
-    if (!str || *str == '\0')
+/* returns the handle of str (of len chars), adding it to the pool if needed.
+ * Returns 0 on memory error */
+static str_t
+str_intern_len (const char *str, size_t len)
+{
+    unsigned long    hash;
+    size_t           slot;
+    str_t            id;
+    char            *s;
+
+    hash = str_hash (str, len);
+    pthread_rwlock_rdlock (&pool.lock);
+    id = _str_find (str, len, hash, &slot);
+    pthread_rwlock_unlock (&pool.lock);
+    if (id)
     {
-        return 0;
+        return id;
     }
 
-    for (s = str; isspace (*s); ++s)
-        ;
-    for (ss = s, e = s; *ss != '\0'; ++ss)
+    pthread_rwlock_wrlock (&pool.lock);
+    /* in case another thread added it meanwhile */
+    id = _str_find (str, len, hash, &slot);
+    if (id)
     {
-        if (!isspace (*ss))
+        goto done;
+    }
+
+    /* keep the table at most half full */
+    if ((size_t) pool.count * 2 >= pool.table_size)
+    {
+        if (!strpool_grow_table ())
         {
-            e = ss;
+            goto done;
         }
+        _str_find (str, len, hash, &slot);
     }
-    len = (size_t) (e - s + 1);
+    if (pool.count == 0)
+    {
+        /* handle 0 is reserved */
+        pool.count = 1;
+    }
+    if (pool.count >= pool.alloc)
+    {
+        str_t            alloc = (pool.alloc) ? pool.alloc * 2 : 1024;
+        const char     **strs;
+        unsigned long   *hashes;
+
+        strs = realloc (pool.str, sizeof (*pool.str) * alloc);
+        if (!strs)
+        {
+            goto done;
+        }
+        pool.str = strs;
+        hashes = realloc (pool.hash, sizeof (*pool.hash) * alloc);
+        if (!hashes)
+        {
+            goto done;
+        }
+        pool.hash = hashes;
+        pool.alloc = alloc;
+    }
+    if (!pool.block || pool.block_used + len + 1 > STRPOOL_BLOCK)
+    {
+        size_t size = (len + 1 > STRPOOL_BLOCK) ? len + 1 : STRPOOL_BLOCK;
+
+        pool.block = malloc (sizeof (*pool.block) * size);
+        if (!pool.block)
+        {
+            goto done;
+        }
+        pool.blocks = alpm_list_add (pool.blocks, pool.block);
+        pool.block_used = 0;
+    }
+    s = pool.block + pool.block_used;
+    memcpy (s, str, len);
+    s[len] = '\0';
+    pool.block_used += len + 1;
+
+    id = pool.count++;
+    pool.str[id] = s;
+    pool.hash[id] = hash;
+    pool.table[slot] = id;
+
+done:
+    pthread_rwlock_unlock (&pool.lock);
+    return id;
+}
+
+static inline str_t
+str_intern (const char *str)
+{
+    return str_intern_len (str, strlen (str));
+}
+
+static inline const char *
+str_get (str_t id)
+{
+    const char *s;
+
+    pthread_rwlock_rdlock (&pool.lock);
+    s = pool.str[id];
+    pthread_rwlock_unlock (&pool.lock);
+    return s;
+}
+
+/* number of handles the pool has room for */
+static inline str_t
+strpool_size (void)
+{
+    str_t size;
+
+    pthread_rwlock_rdlock (&pool.lock);
+    size = pool.alloc;
+    pthread_rwlock_unlock (&pool.lock);
+    return size;
+}
+
+static int
+str_id_cmp (const str_t *id1, const str_t *id2)
+{
+    return strcmp (pool.str[*id1], pool.str[*id2]);
+}
+
+/* computes the rank of all strings in the pool, i.e. their position once
+ * sorted, so sorting by names is only a matter of comparing integers. Done
+ * only once, after loading: strings interned afterwards are compared with
+ * strcmp() by str_cmp(), giving the same order */
+static bool
+strpool_rank (void)
+{
+    str_t           *ids;
+    unsigned int    *rank;
+    str_t            id;
+
+    pthread_rwlock_wrlock (&pool.lock);
+    if (pool.ranked > 0 || pool.count <= 1)
+    {
+        pthread_rwlock_unlock (&pool.lock);
+        return true;
+    }
+    ids = malloc (sizeof (*ids) * pool.count);
+    rank = realloc (pool.rank, sizeof (*pool.rank) * pool.alloc);
+    if (!ids || !rank)
+    {
+        free (ids);
+        if (rank)
+        {
+            pool.rank = rank;
+        }
+        pthread_rwlock_unlock (&pool.lock);
+        return false;
+    }
+    pool.rank = rank;
+    for (id = 1; id < pool.count; ++id)
+    {
+        ids[id - 1] = id;
+    }
+    qsort (ids, pool.count - 1, sizeof (*ids),
+            (int (*) (const void *, const void *)) str_id_cmp);
+    for (id = 1; id < pool.count; ++id)
+    {
+        pool.rank[ids[id - 1]] = id;
+    }
+    free (ids);
+    pool.ranked = pool.count;
+    pthread_rwlock_unlock (&pool.lock);
+    return true;
+}
+
+static inline int
+str_cmp (str_t id1, str_t id2)
+{
+    int cmp;
+
+    pthread_rwlock_rdlock (&pool.lock);
+    if (id1 >= pool.ranked || id2 >= pool.ranked)
+    {
+        cmp = strcmp (pool.str[id1], pool.str[id2]);
+    }
+    else
+    {
+        cmp = (pool.rank[id1] > pool.rank[id2]) - (pool.rank[id1] < pool.rank[id2]);
+    }
+    pthread_rwlock_unlock (&pool.lock);
+    return cmp;
+}
+
+static void
+free_strpool (void)
+{
+    FREELIST (pool.blocks);
+    free (pool.str);
+    free (pool.hash);
+    free (pool.rank);
+    free (pool.table);
+    pool.block = NULL;
+    pool.str = NULL;
+    pool.hash = NULL;
+    pool.rank = NULL;
+    pool.table = NULL;
+    pool.block_used = pool.table_size = 0;
+    pool.count = pool.alloc = pool.ranked = 0;
+}
+
+static bool
+nameidx_add (nameidx_t *idx, str_t id, void *data)
+{
+    if (id >= idx->len)
+    {
+        alpm_list_t **lists;
+        str_t         size = strpool_size ();
+
+        lists = realloc (idx->lists, sizeof (*lists) * size);
+        if (!lists)
+        {
+            return false;
+        }
+        memset (lists + idx->len, 0, sizeof (*lists) * (size - idx->len));
+        idx->lists = lists;
+        idx->len = size;
+    }
+    idx->lists[id] = alpm_list_add (idx->lists[id], data);
+    return true;
+}
+
+static inline alpm_list_t *
+nameidx_get (nameidx_t *idx, str_t id)
+{
+    return (id && id < idx->len) ? idx->lists[id] : NULL;
+}
+
+static void
+free_nameidx (nameidx_t *idx)
+{
+    str_t id;
+
+    for (id = 0; id < idx->len; ++id)
+    {
+        alpm_list_free (idx->lists[id]);
+    }
+    free (idx->lists);
+    free (idx->items);
+    memset (idx, 0, sizeof (*idx));
+}
+
+
+static void
+show_version (void)
+{
+    puts (PACKAGE_NAME " - " PACKAGE_TAG " v" PACKAGE_VERSION);
+    puts ("Copyright (C) 2012-2013 Olivier Brunel");
+    puts ("License GPLv3+: GNU GPL version 3 or later <http://gnu.org/licenses/gpl.html>");
+    puts ("This is free software: you are free to change and redistribute it.");
+    puts ("There is NO WARRANTY, to the extent permitted by law.");
+    exit (0);
+}
+
+static void
+show_help (const char *prgname)
+{
+    puts ("Usage:");
+    printf (" %s [OPTION..] PACKAGE..\n", prgname);
+    putchar ('\n');
+    puts (" -h, --help                      Show this help screen and exit");
+    puts (" -V, --version                   Show version information and exit");
+    putchar ('\n');
+    puts (" -d, --debug                     Flood debug info to stdout");
+    puts (" -c, --config=FILE               pacman.conf file to use (else /etc/pacman.conf)");
+    puts (" -d, --dbpath=PATH               Specify an alternate database location");
+    puts ("     --from-sync                 Only look for specified package(s) in sync dbs");
+    puts ("     --regex                     Package names are (extended) regular expressions");
+    puts ("     --root=PATH                 Analyse the system in PATH (can be repeated)");
+    puts ("     --snapshot=FILE             Use snapshot FILE as local database (can be repeated)");
+    puts ("     --export-snapshot=FILE      Write a snapshot of the local database to FILE");
+    puts ("     --trace=FILE                Write a trace of where time was spent to FILE");
+    puts ("     --output=FORMAT:FILE        Also write results as FORMAT to FILE (can be repeated)");
+    puts (" -j, --jobs=N                    Use up to N threads (else one per CPU)");
+    puts (" -q, --quiet                     Only output packages name & size");
+    puts (" -P, --show-path                 Show dependency path");
+    puts ("     --explain=PKG               Show paths making dependency PKG shared");
+    puts ("     --show-provider             Show which dependency a provider was used for");
+    puts ("     --actual-size               Show size actually used on disk by installed packages");
+    puts ("     --download-size             Show download size of packages not in the cache");
+    puts ("     --attribute=POLICY          Split sizes of shared dependencies (even, weighted)");
+    puts (" -w, --raw-sizes                 Show sizes in bytes (no formatting)");
+    puts (" -z, --sort-size                 Sort packages by size (else by name)");
+    puts (" -p, --show-optional             Show optional dependencies (see man page)");
+    puts (" -x, --explicit                  Don't ignore explicitly installed dependencies");
+    putchar ('\n');
+    puts (" -r, --reverse                   Enable reverse mode (see man page)");
+    puts (" -R, --list-requiredby           List packages requiring the specified package(s)");
+    puts ("     --max-nodes=N               Stop reverse mode after finding N packages");
+    puts ("     --deadline=MS               Stop reverse mode after MS milliseconds");
+    putchar ('\n');
+    puts ("     --free=SIZE                 Suggest packages to remove to free SIZE (see man page)");
+    puts ("     --graph-stats               Show statistics about the graph of installed packages");
+    puts ("     --check                     Check dependencies of all installed packages");
+    puts ("     --overlap                   Show how much closures of installed packages overlap");
+    puts ("     --upgrades                  Show the change in size of upgrading outdated packages");
+    puts ("     --hook=OPERATION            Run as a pacman hook (remove, install; see man page)");
+#ifdef PACDEP_ENGINES
+    putchar ('\n');
+    puts ("     --compare-engines           Classify dependencies with both engines, and compare");
+    puts ("     --fuzz-engines=N[:SEED]     Compare both engines on N random graphs, and exit");
+#endif
+    putchar ('\n');
+    puts (" -e, --list-exclusive            List exclusive dependencies");
+    puts (" -E, --list-exclusive-explicit   List exclusive explicit dependencies");
+    puts (" -s, --list-shared               List shared dependencies");
+    puts (" -S, --list-shared-explicit      List shared explicit dependencies");
+    puts (" -o, --list-optional             List optional dependencies");
+    puts (" -O, --list-optional-explicit    List optional explicit dependencies");
+    exit (0);
+}
+
+static void
+free_pacman_config (pacman_config_t *pac_conf)
+{
+    if (pac_conf == NULL)
+    {
+        return;
+    }
+
+    /* alpm */
+    free (pac_conf->rootdir);
+    free (pac_conf->dbpath);
+    FREELIST (pac_conf->cachedirs);
+    /* dbs/repos */
+    FREELIST (pac_conf->databases);
+
+    free (pac_conf);
+}
+
+static size_t
+strtrim (char *str)
+{
+    char *s, *ss, *e;
+    size_t len;
+
+    /* nothing to do */
+    if (!str || *str == '\0')
+    {
+        return 0;
+    }
+
+    for (s = str; isspace (*s); ++s)
+        ;
+    for (ss = s, e = s; *ss != '\0'; ++ss)
+    {
+        if (!isspace (*ss))
+        {
+            e = ss;
+        }
+    }
+    len = (size_t) (e - s + 1);
     /* nothing to trim */
     if (s == str && e == ss - 1)
     {
@@ -445,6 +1482,12 @@ parse_pacman_conf (const char        *file,
             int globret;
             size_t gindex;
 
+            /* only the local db will be used, no need to read mirrorlists */
+            if (!is_options && config.hook == HOOK_REMOVE)
+            {
+                continue;
+            }
+
             if (depth + 1 >= max_depth)
             {
                 set_error (error,
@@ -482,8 +1525,11 @@ parse_pacman_conf (const char        *file,
                     {
                         debug ("config file %s, line %d: including %s\n",
                                file, linenum, globbuf.gl_pathv[gindex]);
+                        long long t = trace_begin ();
+
                         parse_pacman_conf (globbuf.gl_pathv[gindex], name,
                             is_options, depth + 1, &pac_conf, error);
+                        trace_end ("parse_pacman_conf", globbuf.gl_pathv[gindex], t);
                     }
                 break;
             }
@@ -506,6 +1552,19 @@ parse_pacman_conf (const char        *file,
                     pac_conf->rootdir = strdup (value);
                     debug ("config: rootdir: %s\n", value);
                 }
+                else if (strcmp (key, "CacheDir") == 0)
+                {
+                    char *dir, *save;
+
+                    /* can be repeated, and/or hold multiple values */
+                    for (dir = strtok_r (value, " \t", &save); dir;
+                            dir = strtok_r (NULL, " \t", &save))
+                    {
+                        pac_conf->cachedirs = alpm_list_add (pac_conf->cachedirs,
+                                strdup (dir));
+                        debug ("config: cachedir: %s\n", dir);
+                    }
+                }
             }
         }
     }
@@ -527,6 +1586,10 @@ parse_pacman_conf (const char        *file,
         {
             pac_conf->dbpath = strdup (PACMAN_DBPATH);
         }
+        if (NULL == pac_conf->cachedirs)
+        {
+            pac_conf->cachedirs = alpm_list_add (NULL, strdup (PACMAN_CACHEDIR));
+        }
     }
 
 cleanup:
@@ -558,10 +1621,13 @@ alpm_load (alpm_handle_t **handle,
     enum _alpm_errno_t   err;
     pacman_config_t     *pac_conf = NULL;
     alpm_list_t         *i;
+    long long            t;
 
     /* parse pacman.conf */
     debug ("parsing pacman.conf (%s) for options\n", conffile);
+    t = trace_begin ();
     rc = parse_pacman_conf (conffile, NULL, 0, 0, &pac_conf, error);
+    trace_end ("parse_pacman_conf", conffile, t);
     if (rc != E_OK)
     {
         free_pacman_config (pac_conf);
@@ -588,8 +1654,13 @@ alpm_load (alpm_handle_t **handle,
         return E_ALPM;
     }
 
+    FOR_LIST (i, pac_conf->cachedirs)
+    {
+        alpm_option_add_cachedir (*handle, i->data);
+    }
+
     /* now we need to add dbs */
-    FOR_LIST (i, pac_conf->databases)
+    FOR_LIST (i, (config.hook == HOOK_REMOVE) ? NULL : pac_conf->databases)
     {
         char *db_name = i->data;
         alpm_db_t *db;
@@ -614,8 +1685,9 @@ alpm_load (alpm_handle_t **handle,
     return E_OK;
 }
 
+/* size as print_size() would show it, into buf */
 static void
-_print_size (off_t size)
+format_size (char *buf, size_t len, off_t size)
 {
     const char *units[]  = { "B", "KiB", "MiB", "GiB" };
     int         nb_units = (int) (sizeof (units) / sizeof (units[0]));
@@ -624,6 +1696,11 @@ _print_size (off_t size)
     int    unit;
     const char *fmt;
 
+    if (config.raw_sizes)
+    {
+        snprintf (buf, len, "%lld", (long long) size);
+        return;
+    }
     hsize = (double) size;
     unit = 1;
     while (hsize > 1024.0 && unit < nb_units)
@@ -639,800 +1716,7984 @@ _print_size (off_t size)
     {
         fmt = (config.quiet) ? "%.2f %s" : "%6.2f %s";
     }
-    fprintf (stdout, fmt, hsize, units[unit - 1]);
+    snprintf (buf, len, fmt, hsize, units[unit - 1]);
 }
 
-static int
-pkg_find_name_fn (pkg_t *pkg, const char *name)
+static void
+_print_size (off_t size)
 {
-    return strcmp (pkg->name, name);
+    char buf[32];
+
+    format_size (buf, sizeof (buf), size);
+    fputs (buf, config.out);
 }
 
-static int
-pkg_find_pkg_fn (pkg_t *pkg, pkg_t *p)
+static pkgdb_t *
+new_pkgdb (alpm_db_t *db, bool is_local)
 {
-    return strcmp (pkg->name, p->name);
+    pkgdb_t *pkgdb;
+
+    pkgdb = calloc (1, sizeof (*pkgdb));
+    if (!pkgdb)
+    {
+        return NULL;
+    }
+    pkgdb->db = db;
+    if (!is_local)
+    {
+        str_t id = str_intern (alpm_db_get_name (db));
+
+        pkgdb->name = (id) ? str_get (id) : alpm_db_get_name (db);
+    }
+    return pkgdb;
 }
 
-static int
-pkg_find_fn (pkg_t *pkg, alpm_pkg_t *p)
+/* path of the local db dir (name == NULL) or the sync db file of handle */
+static char *
+pkgdb_path (alpm_handle_t *handle, const char *name)
 {
-    return strcmp (pkg->name, alpm_pkg_get_name (p));
+    const char  *dbpath = alpm_option_get_dbpath (handle);
+    const char  *sep;
+    char        *path;
+    size_t       len;
+
+    sep = (dbpath[0] && dbpath[strlen (dbpath) - 1] == '/') ? "" : "/";
+    len = strlen (dbpath) + strlen ("/sync/.db") + ((name) ? strlen (name) : 0) + 1;
+    path = malloc (sizeof (*path) * len);
+    if (!path)
+    {
+        return NULL;
+    }
+    if (name)
+    {
+        snprintf (path, len, "%s%ssync/%s.db", dbpath, sep, name);
+    }
+    else
+    {
+        snprintf (path, len, "%s%slocal", dbpath, sep);
+    }
+    return path;
 }
 
-static inline pkg_t *
-new_package (data_t *data, alpm_pkg_t *pkg)
+/* a db of handle (the local one if db is NULL). Its path is remembered so it
+ * can be read directly, see load_local_descs() & load_sync_archive(). If that
+ * fails, packages will simply be loaded from libalpm */
+static pkgdb_t *
+new_handle_pkgdb (alpm_handle_t *handle, alpm_db_t *db)
 {
-    pkg_t *p;
+    pkgdb_t *pkgdb;
 
-    p = calloc (1, sizeof (*p));
-    p->name = alpm_pkg_get_name (pkg);
-    p->pkg  = pkg;
-    p->dep  = DEP_UNKNOWN;
-    if (alpm_pkg_get_origin (pkg) == ALPM_PKG_FROM_SYNCDB)
+    pkgdb = new_pkgdb ((db) ? db : alpm_get_localdb (handle), !db);
+    if (!pkgdb)
     {
-        p->repo = alpm_db_get_name (alpm_pkg_get_db (pkg));
+        return NULL;
     }
-
-    /* add it right now, so it's found when adding its own dep */
-    debug ("adding %s to deps\n", p->name);
-    data->deps = alpm_list_add (data->deps, p);
-
-    return p;
+    pkgdb->path = pkgdb_path (handle, (db) ? alpm_db_get_name (db) : NULL);
+    return pkgdb;
 }
 
-static inline int
-get_req_depth (pkg_t *p)
+/* lists only belong to us if they come from a snapshot or desc file */
+static void
+free_pkginfo (pkginfo_t *info)
 {
-    int depth = 0;
-    for ( ; p->req_by; p = p->req_by)
+    if (info->own_lists)
     {
-        ++depth;
+        alpm_list_free_inner (info->depends, (alpm_list_fn_free) alpm_dep_free);
+        alpm_list_free (info->depends);
+        alpm_list_free_inner (info->optdepends, (alpm_list_fn_free) alpm_dep_free);
+        alpm_list_free (info->optdepends);
+        alpm_list_free_inner (info->provides, (alpm_list_fn_free) alpm_dep_free);
+        alpm_list_free (info->provides);
     }
-    return depth;
+    free (info->desc);
 }
 
-static pkg_t *
-add_to_deps (data_t *data, alpm_pkg_t *pkg, pkg_t *from_p)
+static void
+free_pkgdb (pkgdb_t *pkgdb)
 {
-    pkg_t       *p;
-    alpm_list_t *i;
+    size_t n;
 
-    /* if package is already in there, no need to do anything */
-    p = alpm_list_find (data->deps, pkg, (alpm_list_fn_cmp) pkg_find_fn);
-    if (p)
+    if (!pkgdb)
     {
-        debug ("%s already in deps\n", alpm_pkg_get_name (pkg));
-        if (from_p && p->req_by && get_req_depth (p) > get_req_depth (from_p))
-        {
-            p->req_by = from_p;
-        }
-        return p;
+        return;
+    }
+    for (n = 0; n < pkgdb->nb_pkgs; ++n)
+    {
+        free_pkginfo (&pkgdb->pkgs[n]);
     }
+    free (pkgdb->pkgs);
+    free (pkgdb->buf);
+    free (pkgdb->path);
+    free_nameidx (&pkgdb->by_name);
+    free (pkgdb);
+}
 
-    p = new_package (data, pkg);
-    p->req_by = from_p;
+static void
+pkgdb_index (pkgdb_t *pkgdb)
+{
+    size_t n;
 
-    /* go through dep tree to list all dependencies involved */
-    FOR_LIST (i, alpm_pkg_get_depends (pkg))
+    for (n = 0; n < pkgdb->nb_pkgs; ++n)
     {
-        char        *n = alpm_dep_compute_string (i->data);
-        alpm_pkg_t  *dep;
-        pkg_t       *d;
+        pkginfo_t *info = &pkgdb->pkgs[n];
 
-        debug ("[%s] look for satisfier of %s\n", p->name, n);
-        dep = alpm_find_dbs_satisfier (config.alpm, config.localdb, n);
-        if (!dep)
+        /* should a name be there twice, the first one is used */
+        if (!nameidx_get (&pkgdb->by_name, info->name_id))
         {
-            dep = alpm_find_dbs_satisfier (config.alpm, config.syncdbs, n);
-        }
-        if (!dep)
-        {
-            fprintf (stderr, "Error: no package found for dependency %s\n",
-                    n);
-            free (n);
-            continue;
+            nameidx_add (&pkgdb->by_name, info->name_id, info);
         }
-        free (n);
+    }
+    pkgdb->by_name.is_built = true;
+}
 
-        if (!config.explicit
-                && alpm_pkg_get_origin (dep) == ALPM_PKG_FROM_LOCALDB
-                && alpm_pkg_get_reason (dep) == ALPM_PKG_REASON_EXPLICIT)
-        {
-            debug ("ignoring dependency %s, explicitly installed\n",
-                    alpm_pkg_get_name (dep));
-            continue;
-        }
-
-        debug ("add to deps: %s\n", alpm_pkg_get_name (dep));
-        d = add_to_deps (data, dep, p);
-        if (d)
-        {
-            debug ("%s new in deps, adding to %s's dependencies\n",
-                    d->name, p->name);
-            p->deps = alpm_list_add (p->deps, d);
-        }
-    }
-
-    return p;
-}
-
-static dep_t
-get_dep_explicit (pkg_t *pkg, dep_t dep)
+static bool
+pkginfo_from_alpm (pkginfo_t *info, alpm_pkg_t *pkg, pkgdb_t *pkgdb)
 {
-    if (!config.explicit || dep == DEP_UNKNOWN)
+    info->name_id = str_intern (alpm_pkg_get_name (pkg));
+    if (!info->name_id)
     {
-        return dep;
+        return false;
     }
-
-    if (!pkg->repo
-            && alpm_pkg_get_reason (pkg->pkg) == ALPM_PKG_REASON_EXPLICIT)
+    info->name          = str_get (info->name_id);
+    info->version       = alpm_pkg_get_version (pkg);
+    info->isize         = alpm_pkg_get_isize (pkg);
+    info->reason        = alpm_pkg_get_reason (pkg);
+    info->depends       = alpm_pkg_get_depends (pkg);
+    info->optdepends    = alpm_pkg_get_optdepends (pkg);
+    info->provides      = alpm_pkg_get_provides (pkg);
+    info->db            = pkgdb;
+    info->pkg           = pkg;
+    if (pkgdb->name)
     {
-        return dep + 1;
+        info->size      = alpm_pkg_get_size (pkg);
+        info->filename  = alpm_pkg_get_filename (pkg);
     }
-    return dep;
+    return true;
 }
 
-static dep_t
-get_pkg_dep_state (data_t *data, alpm_list_t *refs, pkg_t *pkg)
+static inline void
+desc_add_dep (alpm_list_t **deps, const char *line)
 {
-    alpm_list_t *reqs, *i;
-    pkg_t *p;
-    dep_t d;
+    alpm_depend_t *dep = alpm_dep_from_string (line);
 
-    /* is pkg state already known? */
-    if (pkg->dep != DEP_UNKNOWN)
+    if (dep)
     {
-        return pkg->dep;
+        *deps = alpm_list_add (*deps, dep);
     }
+}
 
-    debug ("compute dep state for %s\n", pkg->name);
-    reqs = alpm_pkg_compute_requiredby (pkg->pkg);
-    FOR_LIST (i, reqs)
+/* the package from libalpm, looked up if info came from a desc file. NULL
+ * for a snapshot */
+static alpm_pkg_t *
+pkginfo_get_alpm (pkginfo_t *info)
+{
+    if (!info->pkg && info->db->db)
     {
-        const char *name = i->data;
+        info->pkg = alpm_db_get_pkg (info->db->db, info->name);
+    }
+    return info->pkg;
+}
 
-        p = alpm_list_find (data->deps,
-                name,
-                (alpm_list_fn_cmp) pkg_find_name_fn);
-        if (!p)
+/* parses buf, the content of a desc file (or a depends file from a sync db,
+ * then with deps_only) filling info. buf is modified, strings point to it, and
+ * name is set to the package name if found. Returns false on invalid data */
+static bool
+desc_parse (pkginfo_t *info, char *buf, const char **name, bool deps_only)
+{
+    const char  *section = NULL;
+    char        *line;
+    char        *next;
+    char        *s;
+
+    for (line = buf; line; line = next)
+    {
+        next = strchr (line, '\n');
+        if (next)
         {
-            /* required by a pkg outside our tree -- if it's one not installed
-             * locally, we ignore it, else it's a shared dependency */
+            *next++ = '\0';
+        }
 
-            if (!alpm_db_get_pkg (config.localdb->data, name))
+        /* an empty line ends a section */
+        if (*line == '\0')
+        {
+            section = NULL;
+            continue;
+        }
+        if (!section)
+        {
+            if (*line == '%')
             {
-                continue;
+                section = line;
             }
+            continue;
+        }
 
-            d = get_dep_explicit (pkg, DEP_SHARED);
-            debug ("%s=%d: required by outsider: %s\n",
-                    pkg->name,
-                    d,
-                    name);
-            FREELIST (reqs);
-            return d;
+        if (strcmp (section, "%DEPENDS%") == 0)
+        {
+            desc_add_dep (&info->depends, line);
         }
-        else if (p->dep == DEP_SHARED || p->dep == DEP_SHARED_EXPLICIT)
+        else if (strcmp (section, "%OPTDEPENDS%") == 0)
         {
-            /* required by a shared dep */
-            d = get_dep_explicit (pkg, DEP_SHARED);
-            debug ("%s=%d: required by shared dep (%s=%d)\n",
-                    pkg->name,
-                    d,
-                    name,
-                    (p) ? p->dep : DEP_UNKNOWN);
-            FREELIST (reqs);
-            return d;
+            desc_add_dep (&info->optdepends, line);
         }
-        else if (p->dep == DEP_UNKNOWN)
+        else if (strcmp (section, "%PROVIDES%") == 0)
         {
-            if (!alpm_list_find_ptr (refs, p))
+            desc_add_dep (&info->provides, line);
+        }
+        else if (deps_only)
+        {
+            continue;
+        }
+        else if (strcmp (section, "%NAME%") == 0)
+        {
+            *name = line;
+        }
+        else if (strcmp (section, "%VERSION%") == 0)
+        {
+            info->version = line;
+        }
+        else if (strcmp (section, "%FILENAME%") == 0)
+        {
+            info->filename = line;
+        }
+        /* SIZE in the local db, ISIZE & CSIZE in sync dbs */
+        else if (strcmp (section, "%SIZE%") == 0
+                || strcmp (section, "%ISIZE%") == 0
+                || strcmp (section, "%CSIZE%") == 0)
+        {
+            long long size;
+
+            errno = 0;
+            size = strtoll (line, &s, 10);
+            if (errno != 0 || *s != '\0' || s == line || size < 0)
             {
-                debug ("%s required by %s, determining state\n",
-                        pkg->name,
-                        name);
-                refs = alpm_list_add (refs, p);
-                d = get_pkg_dep_state (data, refs, p);
-                set_pkg_dep (data, refs, p, d);
-                if (d == DEP_SHARED || d == DEP_SHARED_EXPLICIT
-                        || (config.explicit && d == DEP_EXCLUSIVE_EXPLICIT))
-                {
-                    debug ("%s=SHARED: %s not exclusive (%d)\n",
-                            pkg->name,
-                            name,
-                            d);
-                    refs = alpm_list_remove (refs,
-                            p,
-                            (alpm_list_fn_cmp) pkg_find_pkg_fn,
-                            NULL);
-                    d = get_dep_explicit (pkg, DEP_SHARED);
-                    debug ("%s=%d\n", pkg->name, d);
-                    FREELIST (reqs);
-                    return d;
-                }
-                debug ("moving on\n");
-                refs = alpm_list_remove (refs,
-                        p,
-                        (alpm_list_fn_cmp) pkg_find_pkg_fn,
-                        NULL);
+                return false;
+            }
+            if (section[1] == 'C')
+            {
+                info->size = (off_t) size;
             }
             else
             {
-                debug ("%s required by %s, already found in refs\n",
-                        pkg->name,
-                        name);
+                info->isize = (off_t) size;
             }
         }
+        else if (strcmp (section, "%REASON%") == 0)
+        {
+            info->reason = (strcmp (line, "1") == 0)
+                ? ALPM_PKG_REASON_DEPEND : ALPM_PKG_REASON_EXPLICIT;
+        }
     }
-    FREELIST (reqs);
-
-    d = get_dep_explicit (pkg, DEP_EXCLUSIVE);
-    debug ("%s=%d\n", pkg->name, d);
-    return d;
+    return true;
 }
 
-static int
-pkg_origin_size_cmp (pkg_t *pkg1, pkg_t *pkg2)
+/* once all files of a package were parsed: if it is valid, info takes
+ * ownership of desc (the desc file its strings point to), else it is reset */
+static bool
+desc_done (pkginfo_t *info, const char *name, char *desc)
 {
-    off_t size1, size2;
-
-    if (pkg1->repo && !pkg2->repo)
+    info->own_lists = true;
+    if (!name || !info->version
+            || !(info->name_id = str_intern (name)))
     {
-        return 1;
+        free_pkginfo (info);
+        free (desc);
+        memset (info, 0, sizeof (*info));
+        return false;
     }
-    else if (!pkg1->repo && pkg2->repo)
+    info->name = str_get (info->name_id);
+    info->desc = desc;
+    return true;
+}
+
+/* parses the desc file (from the local db) in path. On success, info holds
+ * the content of the file (and owns its lists), else it is left untouched */
+static bool
+parse_desc (pkginfo_t *info, const char *path)
+{
+    struct stat  st;
+    const char  *name = NULL;
+    char        *buf;
+    size_t       len = 0;
+    int          fd;
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0)
     {
-        return 0;
+        return false;
     }
-
-    size1 = alpm_pkg_get_isize (pkg1->pkg);
-    size2 = alpm_pkg_get_isize (pkg2->pkg);
-
-    if (size1 > size2)
+    if (fstat (fd, &st) < 0 || st.st_size < 0
+            || !(buf = malloc (sizeof (*buf) * ((size_t) st.st_size + 1))))
     {
-        return -1;
+        close (fd);
+        return false;
     }
-    else if (size1 == size2)
+    while (len < (size_t) st.st_size)
     {
-        return 0;
+        ssize_t r = read (fd, buf + len, (size_t) st.st_size - len);
+
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (r <= 0)
+        {
+            break;
+        }
+        len += (size_t) r;
     }
-    else
+    close (fd);
+    buf[len] = '\0';
+
+    info->reason = ALPM_PKG_REASON_EXPLICIT;
+    if (!desc_parse (info, buf, &name, false))
     {
-        return 1;
+        name = NULL;
     }
+    return desc_done (info, name, buf);
 }
 
-static int
-pkg_origin_name_cmp (pkg_t *pkg1, pkg_t *pkg2)
+typedef struct _descs_t {
+    pkgdb_t         *pkgdb;
+    char           **dirs;          /* dirname of each package */
+} descs_t;
+
+/* desc files parsed by each job */
+#define DESC_CHUNK              64
+
+static void
+parse_descs (descs_t *ctx, size_t n)
 {
-    if (pkg1->repo && !pkg2->repo)
+    char    path[PATH_MAX];
+    size_t  i;
+    size_t  last;
+
+    last = (n + 1) * DESC_CHUNK;
+    if (last > ctx->pkgdb->nb_pkgs)
     {
-        return 1;
+        last = ctx->pkgdb->nb_pkgs;
     }
-    else if (!pkg1->repo && pkg2->repo)
+    for (i = n * DESC_CHUNK; i < last; ++i)
     {
-        return 0;
+        if (snprintf (path, sizeof (path), "%s/%s/desc",
+                    ctx->pkgdb->path, ctx->dirs[i]) < (int) sizeof (path))
+        {
+            parse_desc (&ctx->pkgdb->pkgs[i], path);
+        }
     }
-    return strcmp (pkg1->name, pkg2->name);
 }
 
-static void
-set_pkg_dep (data_t *data, alpm_list_t *refs, pkg_t *pkg, dep_t dep)
+static int
+pkginfo_cmp (const pkginfo_t *info1, const pkginfo_t *info2)
 {
-    alpm_list_t *i;
+    return strcmp (info1->name, info2->name);
+}
 
-    debug ("set %s to dep %d\n", pkg->name, dep);
-    if (pkg->dep == dep)
+/* loads the local db by reading all desc files directly, in parallel, instead
+ * of having libalpm open & parse them one by one as they're needed. Packages
+ * whose desc couldn't be parsed are loaded from libalpm.
+ * Returns false if the db dir couldn't be read (nothing was loaded then) */
+static bool
+load_local_descs (pkgdb_t *pkgdb)
+{
+    descs_t          ctx = { pkgdb, NULL };
+    DIR             *dir;
+    struct dirent   *entry;
+    size_t           alloc = 0;
+    size_t           nb = 0;
+    size_t           n;
+    size_t           fallback = 0;
+    pkginfo_t       *info;
+
+    dir = opendir (pkgdb->path);
+    if (!dir)
     {
-        return;
+        debug ("cannot open %s\n", pkgdb->path);
+        return false;
     }
-    /* size & list are only done for dependencies, not the main package */
-    if (!alpm_list_find_ptr (data->pkgs, pkg))
+    while ((entry = readdir (dir)))
     {
-        if (pkg->dep != DEP_UNKNOWN)
+        if (entry->d_name[0] == '.'
+#ifdef _DIRENT_HAVE_D_TYPE
+                || (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN)
+#endif
+           )
         {
-            data->group[pkg->dep].size -= alpm_pkg_get_isize (pkg->pkg);
-            if (!pkg->repo)
-            {
-                data->group[pkg->dep].size_local -= alpm_pkg_get_isize (pkg->pkg);
-            }
-            FOR_LIST (i, data->group[pkg->dep].pkgs)
-            {
-                if (i->data == pkg)
-                {
-                    data->group[pkg->dep].pkgs = alpm_list_remove_item (
-                            data->group[pkg->dep].pkgs, i);
-                    break;
-                }
-            }
+            continue;
         }
-        if ((config.list_exclusive && dep == DEP_EXCLUSIVE)
-                || (config.list_exclusive_explicit && dep == DEP_EXCLUSIVE_EXPLICIT)
-                || (config.list_shared && dep == DEP_SHARED)
-                || (config.list_shared_explicit && dep == DEP_SHARED_EXPLICIT)
-                || (config.list_optional && dep == DEP_OPTIONAL)
-                || (config.list_optional_explicit && dep == DEP_OPTIONAL_EXPLICIT))
+        if (nb == alloc)
         {
-            int len = (int) strlen (pkg->name) + 1; /* +1 for space after */
-            if (pkg->repo)
-            {
-                len += (int) strlen (pkg->repo) + 1; /* +1 for slash */
-            }
+            char **dirs;
 
-            data->group[dep].pkgs = alpm_list_add_sorted (data->group[dep].pkgs,
-                    pkg,
-                    (alpm_list_fn_cmp) ((config.sort_size)
-                        ? pkg_origin_size_cmp
-                        : pkg_origin_name_cmp));
-            if (len > data->group[dep].len_max)
+            alloc += BUF_LEN;
+            dirs = realloc (ctx.dirs, sizeof (*dirs) * alloc);
+            if (!dirs)
             {
-                data->group[dep].len_max = len;
+                break;
             }
+            ctx.dirs = dirs;
         }
-        data->group[dep].size += alpm_pkg_get_isize (pkg->pkg);
-        if (!pkg->repo)
+        ctx.dirs[nb] = strdup (entry->d_name);
+        if (!ctx.dirs[nb])
         {
-            data->group[dep].size_local += alpm_pkg_get_isize (pkg->pkg);
+            break;
         }
+        ++nb;
     }
-    pkg->dep = dep;
-
-    FOR_LIST (i, pkg->deps)
+    closedir (dir);
+    if (entry || !(pkgdb->pkgs = calloc (nb + 1, sizeof (*pkgdb->pkgs))))
     {
-        pkg_t *p = i->data;
-        debug ("%s depends on %s\n", pkg->name, p->name);
-        if (pkg->dep == DEP_SHARED)
-        {
-            dep_t d;
-
-            d = get_dep_explicit (p, DEP_SHARED);
-            set_pkg_dep (data, refs, p, d);
-        }
-        else
+        for (n = 0; n < nb; ++n)
         {
-            dep_t d;
-
-            refs = alpm_list_add (refs, pkg);
-            d = get_pkg_dep_state (data, refs, p);
-            set_pkg_dep (data, refs, p, d);
-            refs = alpm_list_remove (refs,
-                    pkg,
-                    (alpm_list_fn_cmp) pkg_find_pkg_fn,
-                    NULL);
+            free (ctx.dirs[n]);
         }
+        free (ctx.dirs);
+        return false;
     }
-}
+    pkgdb->nb_pkgs = nb;
 
-static inline void
-get_pkg_optrequiredby (data_t *data, pkg_t *pkg)
-{
-    alpm_list_t *dbs;
-    alpm_list_t *i;
-    size_t       len = strlen (pkg->name);
+    debug ("reading %u desc files from %s\n", (unsigned int) nb, pkgdb->path);
+    run_jobs ((job_fn) parse_descs, &ctx, (nb + DESC_CHUNK - 1) / DESC_CHUNK);
 
-    debug ("create list of opt-requirers for %s\n", pkg->name);
-    dbs = (pkg->repo) ? config.syncdbs : config.localdb;
-    FOR_LIST (i, dbs)
+    /* libalpm isn't thread-safe, so fallbacks are done after */
+    for (n = 0, info = pkgdb->pkgs; n < nb; ++n)
     {
-        alpm_db_t   *db = i->data;
-        alpm_list_t *j;
-
-        FOR_LIST (j, alpm_db_get_pkgcache (db))
+        if (pkgdb->pkgs[n].name_id)
         {
-            alpm_pkg_t  *p = j->data;
-            alpm_list_t *k;
+            pkgdb->pkgs[n].db = pkgdb;
+            *info++ = pkgdb->pkgs[n];
+        }
+        else
+        {
+            char        *s;
+            alpm_pkg_t  *pkg;
 
-            FOR_LIST (k, alpm_pkg_get_optdepends (p))
+            /* dirname is name-pkgver-pkgrel */
+            if ((s = strrchr (ctx.dirs[n], '-')))
             {
-                const char *name  = ((alpm_depend_t *) k->data)->name;
-
-                if (strncmp (pkg->name, name, len) == 0 &&
-                        (name[len] == ':' || name[len] == '\0'))
+                *s = '\0';
+                if ((s = strrchr (ctx.dirs[n], '-')))
                 {
-                    pkg_t *r;
-
-                    debug ("[%s] found optreq: %s\n",
-                            pkg->name,
-                            alpm_pkg_get_name (p));
-                    r = alpm_list_find (data->deps,
-                            alpm_pkg_get_name (p),
-                            (alpm_list_fn_cmp) pkg_find_name_fn);
-                    if (!r)
+                    *s = '\0';
+                    pkg = alpm_db_get_pkg (pkgdb->db, ctx.dirs[n]);
+                    if (pkg && pkginfo_from_alpm (info, pkg, pkgdb))
                     {
-                        r = new_package (data, p);
-                        set_pkg_dep (data, NULL, r, DEP_OPTIONAL);
+                        ++info;
+                        ++fallback;
                     }
-                    break;
                 }
             }
         }
+        free (ctx.dirs[n]);
     }
+    free (ctx.dirs);
+    pkgdb->nb_pkgs = (size_t) (info - pkgdb->pkgs);
+    debug ("%u packages loaded, %u from libalpm\n",
+            (unsigned int) pkgdb->nb_pkgs, (unsigned int) fallback);
+
+    /* same order as libalpm */
+    qsort (pkgdb->pkgs, pkgdb->nb_pkgs, sizeof (*pkgdb->pkgs),
+            (int (*) (const void *, const void *)) pkginfo_cmp);
+    pkgdb_index (pkgdb);
+    return true;
 }
 
-static int
-get_pkg_requiredby (data_t *data, pkg_t *pkg)
+#ifdef HAVE_LIBARCHIVE
+/* the whole content of the current entry, NUL-terminated */
+static char *
+archive_read_entry (struct archive *a, struct archive_entry *entry)
 {
-    int          nb = 0;
-    alpm_list_t *reqs;
-    alpm_list_t *j;
+    char    *buf = NULL;
+    size_t   alloc;
+    size_t   len = 0;
 
-    debug ("create list of requirers for %s\n", pkg->name);
-    reqs = alpm_pkg_compute_requiredby (pkg->pkg);
-    FOR_LIST (j, reqs)
+    alloc = (archive_entry_size_is_set (entry) && archive_entry_size (entry) >= 0)
+        ? (size_t) archive_entry_size (entry) + 1 : BUF_LEN;
+    for (;;)
     {
-        const char *name = j->data;
-        pkg_t *r;
+        ssize_t r;
 
-        r = alpm_list_find (data->deps,
-                name,
-                (alpm_list_fn_cmp) pkg_find_name_fn);
-        if (!r)
+        if (len + 1 >= alloc || !buf)
         {
-            /* not in our tree, is it installed? */
-            alpm_pkg_t *p = NULL;
+            char *b;
 
-            debug ("[%s] found req: %s\n", pkg->name, name);
-
-            if (data->source == SCE_LOCAL || data->source == SCE_MIXED)
+            if (buf)
             {
-                p = alpm_find_dbs_satisfier (config.alpm,
-                        config.localdb,
-                        name);
+                alloc *= 2;
             }
-            /* SCE_SYNC and SCE_MIXED look in sync dbs (too) */
-            if (!p && data->source != SCE_LOCAL)
+            b = realloc (buf, sizeof (*buf) * alloc);
+            if (!b)
             {
-                p = alpm_find_dbs_satisfier (config.alpm,
-                        config.syncdbs,
-                        name);
+                free (buf);
+                return NULL;
             }
+            buf = b;
+        }
+        r = archive_read_data (a, buf + len, alloc - len - 1);
+        if (r < 0)
+        {
+            free (buf);
+            return NULL;
+        }
+        else if (r == 0)
+        {
+            break;
+        }
+        len += (size_t) r;
+    }
+    buf[len] = '\0';
+    return buf;
+}
 
-            if (p)
-            {
-                int nb_r = 0;
+/* whether the package whose files are in dir (of len, i.e.
+ * "name-version-release/") is one of pkgdb->only */
+static bool
+sync_dir_is_wanted (pkgdb_t *pkgdb, const char *dir, size_t len)
+{
+    size_t  n = len - 1;
+    int     dashes = 0;
 
-                ++nb;
-                r = new_package (data, p);
-                if (config.reverse >= 2)
-                {
-                    nb_r = get_pkg_requiredby (data, r);
-                }
-                if (config.reverse <= 2 || nb_r == 0)
-                {
-                    set_pkg_dep (data, NULL, r, DEP_EXCLUSIVE);
-                }
-            }
-            else
-            {
-                fprintf (stderr, "Error: no package found for %s\n",
-                        name);
-            }
+    while (n > 0)
+    {
+        if (dir[--n] == '-' && ++dashes == 2)
+        {
+            break;
         }
     }
-    FREELIST (reqs);
-    return nb;
-}
-
-static void
-free_pkg (pkg_t *pkg)
-{
-    if (pkg->need_free)
+    if (dashes < 2)
     {
-        free ((char *) pkg->name_asked);
+        /* not as expected, let desc_parse() deal with it */
+        return true;
     }
-    alpm_list_free (pkg->deps);
-    free (pkg);
+    return nameidx_get (pkgdb->only, str_lookup_len (dir, n)) != NULL;
 }
 
-static void
-list_dependencies (data_t *data, dep_t dep)
+/* loads a sync db by reading its archive directly, decompressing it only once
+ * and only parsing what we need (not the full packages as libalpm does; nor
+ * packages other than pkgdb->only, if set). Files of a package (desc,
+ * depends) are expected to follow each other, as written by repo-add.
+ * Returns false (nothing loaded) on error */
+static bool
+load_sync_archive (pkgdb_t *pkgdb)
 {
-    alpm_list_t *i;
-    int flag = 0;
-
-    /* is this group mixed (pkgs from local & sync) ? */
-    if (!config.quiet && data->group[dep].size_local > 0
-            && data->group[dep].size > data->group[dep].size_local)
+    struct archive       *a;
+    struct archive_entry *entry;
+    pkginfo_t            *info  = NULL;
+    const char           *name  = NULL;
+    char                 *desc  = NULL;
+    char                 *dir   = NULL;     /* of the current package */
+    size_t                alloc = 0;
+    size_t                nb    = 0;
+    bool                  ok    = true;
+    int                   r;
+
+    a = archive_read_new ();
+    if (!a)
     {
-        flag = 1;
+        return false;
+    }
+    archive_read_support_filter_all (a);
+    archive_read_support_format_all (a);
+    if (archive_read_open_filename (a, pkgdb->path, 128 * 1024) != ARCHIVE_OK)
+    {
+        debug ("cannot open %s: %s\n", pkgdb->path, archive_error_string (a));
+        archive_read_free (a);
+        return false;
     }
 
-    FOR_LIST (i, data->group[dep].pkgs)
+    debug ("reading %s\n", pkgdb->path);
+    while ((r = archive_read_next_header (a, &entry)) == ARCHIVE_OK)
     {
-        pkg_t *p = i->data;
+        const char  *pathname = archive_entry_pathname (entry);
+        const char  *file;
+        char        *buf;
+        size_t       len;
 
-        if (flag == 1)
+        if (archive_entry_filetype (entry) != AE_IFREG
+                || !(file = strrchr (pathname, '/')))
         {
-            fprintf (stdout, " %*s", -8, "local:");
-            print_size (data->group[dep].size_local);
-            fputc ('\n', stdout);
-            flag = 2;
+            continue;
+        }
+        ++file;
+        if (strcmp (file, "desc") != 0 && strcmp (file, "depends") != 0)
+        {
+            continue;
         }
 
-        if (p->repo)
+        /* first file of a new package */
+        len = (size_t) (file - pathname);
+        if (!dir || strlen (dir) != len || strncmp (dir, pathname, len) != 0)
         {
-            if (flag == 2)
+            if (info)
             {
-                fprintf (stdout, " %*s", -8, "sync:");
-                print_size (data->group[dep].size - data->group[dep].size_local);
-                fputc ('\n', stdout);
-                flag = 3;
+                ok = desc_done (info, name, desc);
+                desc = NULL;
+                info = NULL;
+                if (!ok)
+                {
+                    break;
+                }
             }
-            if (config.quiet)
+            free (dir);
+            dir = strndup (pathname, len);
+            if (!dir)
             {
-                fprintf (stdout, "%s/%s ", p->repo, p->name);
+                ok = false;
+                break;
             }
-            else
+            if (pkgdb->only && !sync_dir_is_wanted (pkgdb, dir, len))
             {
-                fprintf (stdout, (flag) ? "  %s/%*s" : " %s/%*s",
-                        p->repo,
-                        /* +1 for the slash */
-                        -data->group[dep].len_max + (int) strlen (p->repo) + 1,
-                        p->name);
+                continue;
+            }
+            if (nb == alloc)
+            {
+                pkginfo_t *pkgs;
+
+                alloc = (alloc) ? alloc * 2 : 1024;
+                pkgs = realloc (pkgdb->pkgs, sizeof (*pkgs) * alloc);
+                if (!pkgs)
+                {
+                    info = NULL;
+                    ok = false;
+                    break;
+                }
+                pkgdb->pkgs = pkgs;
             }
+            info = &pkgdb->pkgs[nb++];
+            memset (info, 0, sizeof (*info));
+            info->reason = ALPM_PKG_REASON_EXPLICIT;
+            info->db = pkgdb;
+            name = NULL;
+        }
+        else if (!info)
+        {
+            /* another file of a package skipped */
+            continue;
+        }
+
+        buf = archive_read_entry (a, entry);
+        if (!buf)
+        {
+            ok = false;
+            break;
+        }
+        if (strcmp (file, "desc") == 0)
+        {
+            free (desc);
+            desc = buf;
+            ok = desc_parse (info, buf, &name, false);
         }
         else
         {
-            if (config.quiet)
-            {
-                fprintf (stdout, "%s ", p->name);
-            }
-            else
-            {
-                fprintf (stdout, (flag) ? "  %*s" : " %*s",
-                        -data->group[dep].len_max,
-                        p->name);
-            }
+            ok = desc_parse (info, buf, &name, true);
+            free (buf);
         }
-        print_size (alpm_pkg_get_isize (p->pkg));
-        if (config.show_path && p->req_by)
+        if (!ok)
         {
-            pkg_t *d;
+            break;
+        }
+    }
+    if (ok && r != ARCHIVE_EOF)
+    {
+        debug ("error reading %s: %s\n", pkgdb->path, archive_error_string (a));
+        ok = false;
+    }
+    if (info && !desc_done (info, (ok) ? name : NULL, desc))
+    {
+        ok = false;
+    }
+    free (dir);
+    archive_read_free (a);
 
-            for (d = p->req_by; d; d = d->req_by)
-            {
-                if (d->repo)
-                {
-                    fprintf (stdout, " <- %s/%s", d->repo, d->name);
-                }
-                else
-                {
-                    fprintf (stdout, " <- %s", d->name);
-                }
-            }
+    if (!ok)
+    {
+        size_t n;
+
+        for (n = 0; n < nb; ++n)
+        {
+            free_pkginfo (&pkgdb->pkgs[n]);
         }
-        fputc ('\n', stdout);
+        free (pkgdb->pkgs);
+        pkgdb->pkgs = NULL;
+        return false;
     }
+    pkgdb->nb_pkgs = nb;
+    debug ("%s: %u packages\n", pkgdb->name, (unsigned int) nb);
+
+    /* same order as libalpm */
+    if (nb > 1)
+    {
+        qsort (pkgdb->pkgs, pkgdb->nb_pkgs, sizeof (*pkgdb->pkgs),
+                (int (*) (const void *, const void *)) pkginfo_cmp);
+    }
+    pkgdb_index (pkgdb);
+    return true;
+}
+#else
+static inline bool
+load_sync_archive (pkgdb_t *pkgdb)
+{
+    (void) pkgdb;
+    return false;
 }
+#endif
 
+/* loads the packages of pkgdb->only from libalpm, looked up one by one */
 static void
-print_group (data_t *data,
-        dep_t        dep,
-        int          len_max,
-        off_t        size,
-        bool         list_deps,
-        bool         list_deps_explicit)
+_pkgdb_load_only (pkgdb_t *pkgdb)
 {
-    if (!config.quiet)
+    pkginfo_t   *info;
+    size_t       nb = 0;
+    str_t        id;
+
+    for (id = 0; id < pkgdb->only->len; ++id)
     {
-        fprintf (stdout, "%*s", -len_max, data->group[dep].title);
-        print_size (data->group[dep].size);
-        fputc ('\n', stdout);
+        nb += (pkgdb->only->lists[id] != NULL);
     }
-    if (list_deps)
+    info = pkgdb->pkgs = calloc (nb + 1, sizeof (*info));
+    if (!info)
     {
-        list_dependencies (data, dep);
+        return;
     }
-    /* is this group mixed (pkgs from local & sync) ? */
-    else if (!config.quiet && data->group[dep].size_local > 0
-            && data->group[dep].size > data->group[dep].size_local)
+    for (id = 0; id < pkgdb->only->len; ++id)
     {
-        fprintf (stdout, " %*s", -8, "local:");
-        print_size (data->group[dep].size_local);
-        fputc ('\n', stdout);
-        fprintf (stdout, " %*s", -8, "sync:");
-        print_size (data->group[dep].size - data->group[dep].size_local);
-        fputc ('\n', stdout);
-    }
+        alpm_pkg_t *pkg;
 
-    if (config.explicit)
-    {
-        if (!config.quiet)
-        {
-            fprintf (stdout, "%*s", -len_max, data->group[dep + 1].title);
-            print_size (data->group[dep + 1].size);
-            if (data->group[dep].size > 0 && data->group[dep + 1].size > 0)
-            {
-                fputs (" (", stdout);
-                print_size (size);
-                fputs (")\n", stdout);
-            }
-            else
-            {
-                fputc ('\n', stdout);
-            }
-        }
-        if (list_deps_explicit)
-        {
-            list_dependencies (data, dep + 1);
-        }
-        /* is this group mixed (pkgs from local & sync) ? */
-        else if (!config.quiet && data->group[dep].size_local > 0
-                && data->group[dep].size > data->group[dep].size_local)
+        if (pkgdb->only->lists[id]
+                && (pkg = alpm_db_get_pkg (pkgdb->db, pkgdb->only->lists[id]->data))
+                && pkginfo_from_alpm (info, pkg, pkgdb))
         {
-            fprintf (stdout, " %*s", -8, "local:");
-            print_size (data->group[dep + 1].size_local);
-            fputc ('\n', stdout);
-            fprintf (stdout, " %*s", -8, "sync:");
-            print_size (data->group[dep + 1].size
-                    - data->group[dep + 1].size_local);
-            fputc ('\n', stdout);
+            ++info;
         }
     }
+    pkgdb->nb_pkgs = (size_t) (info - pkgdb->pkgs);
+    debug ("%s: %u packages\n", pkgdb->name, (unsigned int) pkgdb->nb_pkgs);
+    /* same order as libalpm */
+    qsort (pkgdb->pkgs, pkgdb->nb_pkgs, sizeof (*pkgdb->pkgs),
+            (int (*) (const void *, const void *)) pkginfo_cmp);
+    pkgdb_index (pkgdb);
 }
 
+/* loads all packages of the db, if not done already. They're read directly
+ * from the desc files (local db) or the db archive (sync dbs) when possible,
+ * else from libalpm */
 static void
-preprocess_package (data_t *data, const char *pkgname, bool dup_name)
+_pkgdb_load (pkgdb_t *pkgdb)
 {
-    alpm_pkg_t  *pkg = NULL;
-    pkg_t       *p;
+    alpm_list_t *cache;
+    alpm_list_t *i;
+    pkginfo_t   *info;
 
-    if (!config.from_sync)
+    if (pkgdb->path && ((pkgdb->name)
+                ? load_sync_archive (pkgdb) : load_local_descs (pkgdb)))
     {
-        /* seach all dbs (local, then sync) and find match even the name
-         * was a provider */
-        pkg = alpm_find_dbs_satisfier (config.alpm, config.localdb, pkgname);
+        return;
     }
-    if (!pkg)
+
+    debug ("loading packages from %s\n", (pkgdb->name) ? pkgdb->name : "local");
+    if (pkgdb->only)
     {
-        pkg = alpm_find_dbs_satisfier (config.alpm, config.syncdbs, pkgname);
+        _pkgdb_load_only (pkgdb);
+        return;
     }
-    if (!pkg)
+    cache = alpm_db_get_pkgcache (pkgdb->db);
+    if (!cache)
+    {
+        return;
+    }
+    info = pkgdb->pkgs = calloc (alpm_list_count (cache), sizeof (*info));
+    if (!info)
     {
-        fprintf (stderr, "Package not found: %s\n", pkgname);
         return;
     }
+    FOR_LIST (i, cache)
+    {
+        if (pkginfo_from_alpm (info, i->data, pkgdb))
+        {
+            ++info;
+        }
+    }
+    pkgdb->nb_pkgs = (size_t) (info - pkgdb->pkgs);
+    pkgdb_index (pkgdb);
+}
 
-    if (!config.reverse)
+static pkgdb_t *
+pkgdb_load (pkgdb_t *pkgdb)
+{
+    long long t;
+
+    if (pkgdb->is_loaded)
     {
-        debug ("create list of all dependencies for %s\n", pkgname);
-        p = add_to_deps (data, pkg, NULL);
+        return pkgdb;
+    }
+    pkgdb->is_loaded = true;
+
+    t = trace_begin ();
+    _pkgdb_load (pkgdb);
+    trace_end ("load_db", (pkgdb->name) ? pkgdb->name : "local", t);
+    return pkgdb;
+}
+
+static inline pkginfo_t *
+pkgdb_get_pkg (pkgdb_t *pkgdb, str_t id)
+{
+    alpm_list_t *l;
+
+    l = nameidx_get (&pkgdb_load (pkgdb)->by_name, id);
+    return (l) ? l->data : NULL;
+}
+
+static void
+read_sync_archive (pkgdb_t **pkgdbs, size_t n)
+{
+    pkgdb_t *pkgdb = pkgdbs[n];
+    long long t = trace_begin ();
+
+    if (load_sync_archive (pkgdb))
+    {
+        pkgdb->is_loaded = true;
+        trace_end ("load_db", pkgdb->name, t);
     }
     else
     {
-        /* we simply create the pkg_t, nothing else to do at this point. This
-         * will also add it to data->deps */
-        p = new_package (data, pkg);
+        /* so pkgdb_load() goes straight to libalpm */
+        free (pkgdb->path);
+        pkgdb->path = NULL;
     }
-    p->need_free = dup_name;
-    p->name_asked = (dup_name) ? strdup (pkgname) : pkgname;
-    /* mark exclusive right now, so when dependencies are sorted out all
-     * "main" packages are seen as exclusive */
-    p->dep = DEP_EXCLUSIVE;
-    if (p->repo)
+}
+
+/* loads all dbs in pkgdbs (pkgdb_t). Sync dbs that can be read directly are
+ * all read at once, in parallel, the others then loaded one by one (libalpm
+ * isn't thread-safe) */
+static void
+load_pkgdbs (alpm_list_t *pkgdbs)
+{
+    pkgdb_t    **todo;
+    alpm_list_t *i;
+    size_t       nb = 0;
+
+    FOR_LIST (i, pkgdbs)
     {
-        if (data->source == SCE_UNKNOWN)
-        {
-            data->source = SCE_SYNC;
-        }
-        else if (data->source == SCE_LOCAL)
+        pkgdb_t *pkgdb = i->data;
+
+        if (!pkgdb->is_loaded && pkgdb->name && pkgdb->path)
         {
-            data->source = SCE_MIXED;
+            ++nb;
         }
     }
-    else
+    if (nb > 1 && (todo = calloc (nb, sizeof (*todo))))
     {
-        if (data->source == SCE_UNKNOWN)
+        nb = 0;
+        FOR_LIST (i, pkgdbs)
         {
-            data->source = SCE_LOCAL;
+            pkgdb_t *pkgdb = i->data;
+
+            if (!pkgdb->is_loaded && pkgdb->name && pkgdb->path)
+            {
+                todo[nb++] = pkgdb;
+            }
         }
-        else if (data->source == SCE_SYNC)
+        run_jobs ((job_fn) read_sync_archive, todo, nb);
+        free (todo);
+    }
+    FOR_LIST (i, pkgdbs)
+    {
+        pkgdb_load (i->data);
+    }
+}
+
+static alpm_list_t *
+snapshot_parse_deps (char *field)
+{
+    alpm_list_t *deps = NULL;
+    char        *s;
+    char        *save;
+
+    for (s = strtok_r (field, " ", &save); s; s = strtok_r (NULL, " ", &save))
+    {
+        alpm_depend_t *dep = alpm_dep_from_string (s);
+
+        if (dep)
         {
-            data->source = SCE_MIXED;
+            deps = alpm_list_add (deps, dep);
         }
     }
-    /* in case the same package is listed twice on cmdline */
-    if (alpm_list_find_ptr (data->pkgs, p))
+    return deps;
+}
+
+/* loads a snapshot (see export_snapshot) as a local db, from fp (file being
+ * its name). The whole file is read at once, and parsed in place:
+ * names/versions of packages point to it */
+static int
+load_snapshot_fp (FILE *fp, const char *file, pkgdb_t **pkgdb, char **error)
+{
+    pkgdb_t     *db;
+    char        *line;
+    char        *next;
+    char        *s;
+    size_t       len        = 0;
+    size_t       alloc      = 0;
+    size_t       nb_lines   = 1;
+    unsigned int linenum    = 0;
+    int          rc         = E_OK;
+
+    *error = NULL;
+    *pkgdb = NULL;
+
+    db = calloc (1, sizeof (*db));
+    if (!db)
     {
-        return;
+        rc = E_NOMEM;
+        goto cleanup;
     }
-    data->pkgs = alpm_list_add (data->pkgs, p);
+    db->is_loaded = true;
 
-    if (!config.reverse && config.show_optional)
+    for (;;)
     {
-        alpm_list_t *i;
+        size_t r;
 
-        debug ("add %s's optional dependencies\n", pkgname);
-        FOR_LIST (i, alpm_pkg_get_optdepends (pkg))
+        if (len + BUF_LEN >= alloc)
         {
-            alpm_depend_t *optdep = i->data;
-
-            /* is this dependency installed ? */
-            pkg = alpm_find_dbs_satisfier (config.alpm,
-                    config.localdb,
-                    optdep->name);
-            if (!pkg)
+            alloc = (alloc) ? alloc * 2 : 64 * 1024;
+            s = realloc (db->buf, sizeof (*s) * alloc);
+            if (!s)
             {
-                /* should we list non-installed deps ? */
-                if (config.show_optional < 3)
-                {
-                    debug ("ignoring non-installed %s\n", optdep->name);
-                    continue;
-                }
-                pkg = alpm_find_dbs_satisfier (config.alpm,
-                        config.syncdbs,
-                        optdep->name);
-            }
-            if (!pkg)
-            {
-                debug ("ignoring non-found %s\n", optdep->name);
-                continue;
+                rc = E_NOMEM;
+                goto cleanup;
             }
-
-            /* explicitly installed optdep are ignored by default */
-            if (config.show_optional < 3
+            db->buf = s;
+        }
+        /* -1 to always have room for the NUL */
+        r = fread (db->buf + len, sizeof (*s), alloc - len - 1, fp);
+        if (r == 0)
+        {
+            break;
+        }
+        len += r;
+    }
+    if (ferror (fp))
+    {
+        set_error (error, "Snapshot %s could not be read\n", file);
+        rc = E_FILEREAD;
+        goto cleanup;
+    }
+    db->buf[len] = '\0';
+
+    for (s = db->buf; (s = strchr (s, '\n')); ++s)
+    {
+        ++nb_lines;
+    }
+    db->pkgs = calloc (nb_lines, sizeof (*db->pkgs));
+    if (!db->pkgs)
+    {
+        rc = E_NOMEM;
+        goto cleanup;
+    }
+
+    for (line = db->buf; line && *line; line = next)
+    {
+        pkginfo_t   *info = &db->pkgs[db->nb_pkgs];
+        char        *fields[SNAPSHOT_NB_FIELDS];
+        int          nb = 1;
+        long long    isize;
+
+        ++linenum;
+        next = strchr (line, '\n');
+        if (next)
+        {
+            *next++ = '\0';
+        }
+
+        if (linenum == 1)
+        {
+            if (strcmp (line, SNAPSHOT_HEADER) != 0)
+            {
+                set_error (error, "%s is not a pacdep snapshot\n", file);
+                rc = E_PARSING;
+                goto cleanup;
+            }
+            continue;
+        }
+        if (*line == '\0' || *line == '#')
+        {
+            continue;
+        }
+
+        fields[0] = line;
+        for (s = line; *s; ++s)
+        {
+            if (*s == '\t')
+            {
+                if (nb == SNAPSHOT_NB_FIELDS)
+                {
+                    ++nb;
+                    break;
+                }
+                *s = '\0';
+                fields[nb++] = s + 1;
+            }
+        }
+        if (nb != SNAPSHOT_NB_FIELDS || *fields[0] == '\0' || *fields[1] == '\0')
+        {
+            set_error (error, "%s: line %u: invalid number of fields\n",
+                    file, linenum);
+            rc = E_PARSING;
+            goto cleanup;
+        }
+
+        errno = 0;
+        isize = strtoll (fields[2], &s, 10);
+        if (errno != 0 || *s != '\0' || s == fields[2] || isize < 0)
+        {
+            set_error (error, "%s: line %u: invalid size: %s\n",
+                    file, linenum, fields[2]);
+            rc = E_PARSING;
+            goto cleanup;
+        }
+        if (strcmp (fields[3], "e") == 0)
+        {
+            info->reason = ALPM_PKG_REASON_EXPLICIT;
+        }
+        else if (strcmp (fields[3], "d") == 0)
+        {
+            info->reason = ALPM_PKG_REASON_DEPEND;
+        }
+        else
+        {
+            set_error (error, "%s: line %u: invalid reason: %s\n",
+                    file, linenum, fields[3]);
+            rc = E_PARSING;
+            goto cleanup;
+        }
+
+        info->name_id = str_intern (fields[0]);
+        if (!info->name_id)
+        {
+            rc = E_NOMEM;
+            goto cleanup;
+        }
+        info->name          = str_get (info->name_id);
+        info->version       = fields[1];
+        info->isize         = (off_t) isize;
+        info->own_lists     = true;
+        info->depends       = snapshot_parse_deps (fields[4]);
+        info->optdepends    = snapshot_parse_deps (fields[5]);
+        info->provides      = snapshot_parse_deps (fields[6]);
+        info->db            = db;
+        ++db->nb_pkgs;
+    }
+    if (linenum == 0)
+    {
+        set_error (error, "%s is not a pacdep snapshot\n", file);
+        rc = E_PARSING;
+        goto cleanup;
+    }
+    debug ("snapshot %s: %u packages\n", file, (unsigned int) db->nb_pkgs);
+
+    pkgdb_index (db);
+    *pkgdb = db;
+    db = NULL;
+
+cleanup:
+    if (rc == E_NOMEM && !*error)
+    {
+        set_error (error, "out of memory\n");
+    }
+    free_pkgdb (db);
+    return rc;
+}
+
+static int
+load_snapshot (const char *file, pkgdb_t **pkgdb, char **error)
+{
+    FILE    *fp;
+    int      rc;
+
+    debug ("loading snapshot %s\n", file);
+    fp = (strcmp (file, "-") == 0) ? stdin : fopen (file, "r");
+    if (!fp)
+    {
+        *pkgdb = NULL;
+        set_error (error, "Snapshot %s could not be read\n", file);
+        return E_FILEREAD;
+    }
+    rc = load_snapshot_fp (fp, file, pkgdb, error);
+    if (fp != stdin)
+    {
+        fclose (fp);
+    }
+    return rc;
+}
+
+static void
+snapshot_write_deps (FILE *fp, alpm_list_t *deps)
+{
+    alpm_list_t *i;
+
+    FOR_LIST (i, deps)
+    {
+        alpm_depend_t   *dep = i->data;
+        const char      *mod;
+
+        switch (dep->mod)
+        {
+            case ALPM_DEP_MOD_EQ:
+                mod = "=";
+                break;
+            case ALPM_DEP_MOD_GE:
+                mod = ">=";
+                break;
+            case ALPM_DEP_MOD_LE:
+                mod = "<=";
+                break;
+            case ALPM_DEP_MOD_GT:
+                mod = ">";
+                break;
+            case ALPM_DEP_MOD_LT:
+                mod = "<";
+                break;
+            default:
+                mod = NULL;
+                break;
+        }
+        /* optdepends used to be info strings: "package: some desc" */
+        fprintf (fp, (i == deps) ? "%.*s" : " %.*s",
+                (int) strcspn (dep->name, ": \t"), dep->name);
+        if (mod && dep->version)
+        {
+            fprintf (fp, "%s%s", mod, dep->version);
+        }
+    }
+}
+
+/* writes all packages of pkgdb as a snapshot: a header line, then one line per
+ * package with tab-separated fields: name, version, installed size, reason ('e'
+ * for explicitly installed, 'd' for dependency), depends, optdepends and
+ * provides. The last three are space-separated dependency strings, e.g.
+ * "glibc bash>=4.2" */
+static int
+export_snapshot (pkgdb_t *pkgdb, const char *file)
+{
+    FILE   *fp;
+    size_t  n;
+    int     r;
+
+    fp = (strcmp (file, "-") == 0) ? stdout : fopen (file, "w");
+    if (!fp)
+    {
+        fprintf (stderr, "Error: unable to open %s: %s\n", file, strerror (errno));
+        return E_FILEWRITE;
+    }
+
+    pkgdb_load (pkgdb);
+    fputs (SNAPSHOT_HEADER "\n", fp);
+    for (n = 0; n < pkgdb->nb_pkgs; ++n)
+    {
+        pkginfo_t *info = &pkgdb->pkgs[n];
+
+        fprintf (fp, "%s\t%s\t%lld\t%c\t",
+                info->name,
+                info->version,
+                (long long) info->isize,
+                (info->reason == ALPM_PKG_REASON_EXPLICIT) ? 'e' : 'd');
+        snapshot_write_deps (fp, info->depends);
+        fputc ('\t', fp);
+        snapshot_write_deps (fp, info->optdepends);
+        fputc ('\t', fp);
+        snapshot_write_deps (fp, info->provides);
+        fputc ('\n', fp);
+    }
+    debug ("exported %u packages to %s\n", (unsigned int) pkgdb->nb_pkgs, file);
+
+    r = ferror (fp);
+    r |= (fp == stdout) ? fflush (fp) : fclose (fp);
+    if (r != 0)
+    {
+        fprintf (stderr, "Error: unable to write snapshot to %s\n", file);
+        return E_FILEWRITE;
+    }
+    return E_OK;
+}
+
+static int
+pkg_find_pkg_fn (pkg_t *pkg, pkg_t *p)
+{
+    return pkg->name_id != p->name_id;
+}
+
+/* builds data->deps_by_name, if not done yet; new_package() then keeps it up
+ * to date */
+static void
+index_deps (data_t *data)
+{
+    alpm_list_t *i;
+
+    if (data->deps_by_name.is_built)
+    {
+        return;
+    }
+    FOR_LIST (i, data->deps)
+    {
+        pkg_t *p = i->data;
+
+        nameidx_add (&data->deps_by_name, p->name_id, p);
+    }
+    data->deps_by_name.is_built = true;
+}
+
+static inline pkg_t *
+find_pkg (data_t *data, str_t id)
+{
+    alpm_list_t *l;
+
+    /* a name never interned cannot be in our tree */
+    if (!id)
+    {
+        return NULL;
+    }
+    if (!data->deps_by_name.is_built)
+    {
+        index_deps (data);
+    }
+    l = nameidx_get (&data->deps_by_name, id);
+    return (l) ? l->data : NULL;
+}
+
+static inline pkg_t *
+new_package (data_t *data, pkginfo_t *pkg)
+{
+    pkg_t *p;
+
+    p = calloc (1, sizeof (*p));
+    p->name_id  = pkg->name_id;
+    p->name     = pkg->name;
+    p->repo     = pkg->db->name;
+    p->pkg      = pkg;
+    p->dep      = DEP_UNKNOWN;
+
+    /* add it right now, so it's found when adding its own dep */
+    debug ("adding %s to deps\n", p->name);
+    data->deps = alpm_list_add (data->deps, p);
+    /* else it'll be indexed (from data->deps) when first needed */
+    if (data->deps_by_name.is_built)
+    {
+        nameidx_add (&data->deps_by_name, p->name_id, p);
+    }
+#ifdef ALLOC_STATS
+    __atomic_fetch_add (&alloc_stats.nb_pkgs, 1, __ATOMIC_RELAXED);
+#endif
+
+    return p;
+}
+
+static inline int
+get_req_depth (pkg_t *p)
+{
+    int depth = 0;
+    for ( ; p->req_by; p = p->req_by)
+    {
+        ++depth;
+    }
+    return depth;
+}
+
+/* index, by provided name, all provisions of all packages in dbs. Done only
+ * once, on first use; providers are listed in the order libalpm would find
+ * them, i.e. following dbs then their pkgcache */
+static nameidx_t *
+get_provides (alpm_list_t *dbs, nameidx_t *provides)
+{
+    pkgdep_t    *provider;
+    size_t       nb = 0;
+    size_t       n;
+    alpm_list_t *i, *k;
+
+    if (provides->is_built)
+    {
+        return provides;
+    }
+    provides->is_built = true;
+
+    debug ("indexing provisions\n");
+    FOR_LIST (i, dbs)
+    {
+        pkgdb_t *pkgdb = pkgdb_load (i->data);
+
+        for (n = 0; n < pkgdb->nb_pkgs; ++n)
+        {
+            nb += alpm_list_count (pkgdb->pkgs[n].provides);
+        }
+    }
+    if (nb == 0)
+    {
+        return provides;
+    }
+    provider = provides->items = malloc (sizeof (*provider) * nb);
+    if (!provider)
+    {
+        return provides;
+    }
+
+    FOR_LIST (i, dbs)
+    {
+        pkgdb_t *pkgdb = i->data;
+
+        for (n = 0; n < pkgdb->nb_pkgs; ++n)
+        {
+            FOR_LIST (k, pkgdb->pkgs[n].provides)
+            {
+                alpm_depend_t *prov = k->data;
+                str_t          id;
+
+                id = str_intern (prov->name);
+                if (!id)
+                {
+                    continue;
+                }
+                provider->pkg = &pkgdb->pkgs[n];
+                provider->dep = prov;
+                if (nameidx_add (provides, id, provider))
+                {
+                    ++provider;
+                }
+            }
+        }
+    }
+    return provides;
+}
+
+static bool
+dep_vercmp (const char *version, alpm_depend_t *dep)
+{
+    int cmp;
+
+    if (dep->mod == ALPM_DEP_MOD_ANY)
+    {
+        return true;
+    }
+
+    cmp = alpm_pkg_vercmp (version, dep->version);
+    switch (dep->mod)
+    {
+        case ALPM_DEP_MOD_EQ:
+            return cmp == 0;
+        case ALPM_DEP_MOD_GE:
+            return cmp >= 0;
+        case ALPM_DEP_MOD_LE:
+            return cmp <= 0;
+        case ALPM_DEP_MOD_GT:
+            return cmp > 0;
+        case ALPM_DEP_MOD_LT:
+            return cmp < 0;
+        default:
+            return false;
+    }
+}
+
+/* whether provision prov (of the same name) satisfies dep. Unversioned
+ * provisions only satisfy unversioned deps */
+static inline bool
+provision_satisfies (alpm_depend_t *prov, alpm_depend_t *dep)
+{
+    return dep->mod == ALPM_DEP_MOD_ANY
+        || (prov->mod == ALPM_DEP_MOD_EQ && dep_vercmp (prov->version, dep));
+}
+
+/* same as alpm_find_dbs_satisfier() -- literals are looked for first (in all
+ * dbs) then providers, the first one found is used -- only using our index
+ * of provisions instead of going through all packages of all dbs each time.
+ * If the package found is a provider, provision is set to the name provided */
+static pkginfo_t *
+_find_dep_satisfier (data_t           *data,
+                     bool              local,
+                     alpm_depend_t    *dep,
+                     const char      **provision)
+{
+    alpm_list_t *dbs;
+    alpm_list_t *i;
+    nameidx_t   *provides;
+    str_t        id;
+
+    if (provision)
+    {
+        *provision = NULL;
+    }
+
+    dbs = (local) ? data->localdb : config.syncdbs;
+    /* all names are interned when loading dbs */
+    load_pkgdbs (dbs);
+    id = str_lookup (dep->name);
+    FOR_LIST (i, (id) ? dbs : NULL)
+    {
+        pkginfo_t *pkg = pkgdb_get_pkg (i->data, id);
+
+        if (pkg && dep_vercmp (pkg->version, dep))
+        {
+            return pkg;
+        }
+    }
+
+    provides = (local)
+        ? get_provides (dbs, &data->provides_local)
+        : get_provides (dbs, &config.provides_sync);
+    /* provided names are interned when indexing provisions */
+    if (!id)
+    {
+        id = str_lookup (dep->name);
+    }
+    FOR_LIST (i, nameidx_get (provides, id))
+    {
+        pkgdep_t *provider = i->data;
+
+        /* literals were handled above */
+        if (provider->pkg->name_id == id)
+        {
+            continue;
+        }
+        if (provision_satisfies (provider->dep, dep))
+        {
+            debug ("%s satisfied by %s\n", dep->name, provider->pkg->name);
+            if (provision)
+            {
+                *provision = provider->dep->name;
+            }
+            return provider->pkg;
+        }
+    }
+    return NULL;
+}
+
+static pkginfo_t *
+find_dep_satisfier (data_t           *data,
+                    bool              local,
+                    alpm_depend_t    *dep,
+                    const char      **provision)
+{
+    pkginfo_t   *pkg;
+    long long    t = trace_begin ();
+
+    pkg = _find_dep_satisfier (data, local, dep, provision);
+    trace_end ("find_dep_satisfier", dep->name, t);
+    return pkg;
+}
+
+static pkginfo_t *
+find_satisfier (data_t        *data,
+                bool           local,
+                const char    *depstring,
+                const char   **provision)
+{
+    alpm_depend_t   *dep;
+    pkginfo_t       *pkg;
+
+    dep = alpm_dep_from_string (depstring);
+    if (!dep)
+    {
+        return NULL;
+    }
+    pkg = find_dep_satisfier (data, local, dep, provision);
+    alpm_dep_free (dep);
+    return pkg;
+}
+
+/* index, by name depended upon, all dependencies of all packages in dbs. Done
+ * only once, on first use; like with provisions, they're stored following dbs
+ * then their packages, so all dependencies of a package are next to each
+ * other */
+static nameidx_t *
+get_revdeps (alpm_list_t *dbs, nameidx_t *revdeps)
+{
+    pkgdep_t    *pd;
+    size_t       nb = 0;
+    size_t       n;
+    alpm_list_t *i, *k;
+
+    if (revdeps->is_built)
+    {
+        return revdeps;
+    }
+    revdeps->is_built = true;
+
+    debug ("indexing dependencies\n");
+    FOR_LIST (i, dbs)
+    {
+        pkgdb_t *pkgdb = pkgdb_load (i->data);
+
+        for (n = 0; n < pkgdb->nb_pkgs; ++n)
+        {
+            nb += alpm_list_count (pkgdb->pkgs[n].depends);
+        }
+    }
+    if (nb == 0)
+    {
+        return revdeps;
+    }
+    pd = revdeps->items = malloc (sizeof (*pd) * nb);
+    if (!pd)
+    {
+        return revdeps;
+    }
+
+    FOR_LIST (i, dbs)
+    {
+        pkgdb_t *pkgdb = i->data;
+
+        for (n = 0; n < pkgdb->nb_pkgs; ++n)
+        {
+            FOR_LIST (k, pkgdb->pkgs[n].depends)
+            {
+                alpm_depend_t *dep = k->data;
+                str_t          id;
+
+                id = str_intern (dep->name);
+                if (!id)
+                {
+                    continue;
+                }
+                pd->pkg = &pkgdb->pkgs[n];
+                pd->dep = dep;
+                if (nameidx_add (revdeps, id, pd))
+                {
+                    ++pd;
+                }
+            }
+        }
+    }
+    return revdeps;
+}
+
+static int
+pkgdep_order_cmp (const void *pd1, const void *pd2)
+{
+    return (pd1 > pd2) - (pd1 < pd2);
+}
+
+static int
+pkginfo_name_cmp (const void *p1, const void *p2)
+{
+    return strcmp (((const pkginfo_t *) p1)->name, ((const pkginfo_t *) p2)->name);
+}
+
+/* same as alpm_pkg_compute_requiredby() -- packages from the same dbs as pkg
+ * (local, or sync) with a dependency satisfied by pkg, in the order libalpm
+ * would list them: db order for the local db, sorted by name for sync ones,
+ * each name only once (from the first repo) -- only returning pkginfo_t and
+ * using our index */
+static alpm_list_t *
+compute_requiredby (data_t *data, pkginfo_t *pkg)
+{
+    nameidx_t   *revdeps;
+    alpm_list_t *found = NULL;
+    alpm_list_t *reqs = NULL;
+    alpm_list_t *i, *j;
+    pkginfo_t   *last = NULL;
+    long long    t = trace_begin ();
+
+    revdeps = (pkg->db->name)
+        ? get_revdeps (config.syncdbs, &config.requiredby_sync)
+        : get_revdeps (data->localdb, &data->requiredby_local);
+
+    FOR_LIST (i, nameidx_get (revdeps, pkg->name_id))
+    {
+        pkgdep_t *pd = i->data;
+
+        if (dep_vercmp (pkg->version, pd->dep))
+        {
+            found = alpm_list_add (found, pd);
+        }
+    }
+    FOR_LIST (j, pkg->provides)
+    {
+        alpm_depend_t *prov = j->data;
+
+        FOR_LIST (i, nameidx_get (revdeps, str_lookup (prov->name)))
+        {
+            pkgdep_t *pd = i->data;
+
+            if (provision_satisfies (prov, pd->dep))
+            {
+                found = alpm_list_add (found, pd);
+            }
+        }
+    }
+
+    /* back in db order; a package requiring pkg more than once (e.g. by name
+     * and through a provision) is then only listed once */
+    found = alpm_list_msort (found, alpm_list_count (found), pkgdep_order_cmp);
+    FOR_LIST (i, found)
+    {
+        pkgdep_t *pd = i->data;
+
+        if (pd->pkg != last)
+        {
+            reqs = alpm_list_add (reqs, pd->pkg);
+            last = pd->pkg;
+        }
+    }
+    alpm_list_free (found);
+
+    /* the sort is stable, so the first repo's package comes first */
+    if (pkg->db->name)
+    {
+        reqs = alpm_list_msort (reqs, alpm_list_count (reqs), pkginfo_name_cmp);
+        for (i = reqs; i && i->next; )
+        {
+            if (strcmp (((pkginfo_t *) i->data)->name,
+                        ((pkginfo_t *) i->next->data)->name) == 0)
+            {
+                alpm_list_t *dup = i->next;
+
+                reqs = alpm_list_remove_item (reqs, dup);
+                free (dup);
+                continue;
+            }
+            i = i->next;
+        }
+    }
+    trace_end ("compute_requiredby", pkg->name, t);
+    return reqs;
+}
+
+/* Parallel expansion: before add_to_deps() goes through the closure of a main
+ * package, the satisfiers of all dependencies of all packages in it are
+ * resolved, in parallel. Each worker claims the packages it finds through the
+ * visited set (data->sats) and pushes them onto its own deque, from which idle
+ * workers steal. add_to_deps() then simply uses them, so the tree (and req_by)
+ * is exactly the same as when done serially */
+
+/* satisfiers of a package without any dependencies */
+static satisfier_t no_satisfiers;
+/* satisfiers of a package claimed by a worker, being resolved */
+static satisfier_t claimed_satisfiers;
+
+typedef struct _deque_t {
+    pkginfo_t      **items;
+    size_t           head;          /* where thieves steal from */
+    size_t           tail;          /* where its worker pushes/pops */
+    size_t           alloc;
+    pthread_mutex_t  mutex;
+} deque_t;
+
+typedef struct _expand_t {
+    data_t          *data;
+    deque_t         *deques;        /* one per worker */
+    size_t           nb_deques;
+    bool             sync_ready;    /* sync dbs can be used by workers */
+    size_t           queued;        /* items in deques */
+    size_t           pending;       /* items queued or being resolved */
+    pthread_mutex_t  mutex;         /* for the above & data->sats */
+    pthread_cond_t   cond;
+} expand_t;
+
+static satisfier_t **
+get_satisfiers_slot (data_t *data, pkginfo_t *pkg)
+{
+    alpm_list_t *i;
+    size_t       n = 0;
+
+    if (!data->sats)
+    {
+        return NULL;
+    }
+    if (pkg->db != data->localdb->data)
+    {
+        FOR_LIST (i, config.syncdbs)
+        {
+            ++n;
+            if (i->data == pkg->db)
+            {
+                break;
+            }
+        }
+        if (!i)
+        {
+            return NULL;
+        }
+    }
+    return (data->sats[n].by_pkg)
+        ? &data->sats[n].by_pkg[pkg - pkg->db->pkgs]
+        : NULL;
+}
+
+/* satisfiers of pkg's dependencies if they were resolved, else NULL */
+static satisfier_t *
+get_satisfiers (data_t *data, pkginfo_t *pkg)
+{
+    satisfier_t **slot = get_satisfiers_slot (data, pkg);
+
+    return (slot && *slot != &claimed_satisfiers) ? *slot : NULL;
+}
+
+static bool
+deque_push (deque_t *dq, pkginfo_t *pkg)
+{
+    pthread_mutex_lock (&dq->mutex);
+    if (dq->tail == dq->alloc)
+    {
+        if (dq->head > 0)
+        {
+            memmove (dq->items, dq->items + dq->head,
+                    sizeof (*dq->items) * (dq->tail - dq->head));
+            dq->tail -= dq->head;
+            dq->head = 0;
+        }
+        else
+        {
+            size_t       alloc = (dq->alloc) ? dq->alloc * 2 : 64;
+            pkginfo_t  **items = realloc (dq->items, sizeof (*items) * alloc);
+
+            if (!items)
+            {
+                pthread_mutex_unlock (&dq->mutex);
+                return false;
+            }
+            dq->items = items;
+            dq->alloc = alloc;
+        }
+    }
+    dq->items[dq->tail++] = pkg;
+    pthread_mutex_unlock (&dq->mutex);
+    return true;
+}
+
+/* newest item for its worker (depth-first), oldest one for a thief */
+static pkginfo_t *
+deque_pop (deque_t *dq, bool steal)
+{
+    pkginfo_t *pkg = NULL;
+
+    pthread_mutex_lock (&dq->mutex);
+    if (dq->head < dq->tail)
+    {
+        pkg = (steal) ? dq->items[dq->head++] : dq->items[--dq->tail];
+        if (dq->head == dq->tail)
+        {
+            dq->head = dq->tail = 0;
+        }
+    }
+    pthread_mutex_unlock (&dq->mutex);
+    return pkg;
+}
+
+/* claims pkg for worker w, which will resolve its satisfiers. Returns false if
+ * it was already claimed (or cannot be) */
+static bool
+expand_claim (expand_t *ctx, size_t w, pkginfo_t *pkg)
+{
+    satisfier_t **slot;
+    bool          claimed = false;
+
+    pthread_mutex_lock (&ctx->mutex);
+    slot = get_satisfiers_slot (ctx->data, pkg);
+    if (slot && !*slot)
+    {
+        *slot = &claimed_satisfiers;
+        claimed = true;
+        /* counted first, so pending can't reach 0 before it's resolved */
+        ++ctx->queued;
+        ++ctx->pending;
+    }
+    pthread_mutex_unlock (&ctx->mutex);
+    if (!claimed)
+    {
+        return false;
+    }
+
+    if (!deque_push (&ctx->deques[w], pkg))
+    {
+        /* add_to_deps() will look them up itself */
+        pthread_mutex_lock (&ctx->mutex);
+        *slot = NULL;
+        --ctx->queued;
+        if (--ctx->pending == 0)
+        {
+            pthread_cond_broadcast (&ctx->cond);
+        }
+        pthread_mutex_unlock (&ctx->mutex);
+        return false;
+    }
+    pthread_cond_signal (&ctx->cond);
+    return true;
+}
+
+/* same lookups as add_to_deps(), claiming every satisfier it would recurse
+ * into */
+static void
+expand_resolve (expand_t *ctx, size_t w, pkginfo_t *pkg)
+{
+    data_t       *data = ctx->data;
+    satisfier_t  *sats;
+    satisfier_t **slot;
+    alpm_list_t  *i;
+    size_t        nb = alpm_list_count (pkg->depends);
+    size_t        n = 0;
+
+    sats = (nb > 0) ? calloc (nb, sizeof (*sats)) : &no_satisfiers;
+    FOR_LIST (i, (sats) ? pkg->depends : NULL)
+    {
+        satisfier_t *sat = &sats[n++];
+
+        sat->pkg = find_dep_satisfier (data, true, i->data, &sat->provision);
+        if (!sat->pkg)
+        {
+            if (!ctx->sync_ready)
+            {
+                continue;
+            }
+            sat->pkg = find_dep_satisfier (data, false, i->data, &sat->provision);
+        }
+        sat->is_resolved = true;
+
+        if (sat->pkg && (config.explicit
+                    || sat->pkg->db->name
+                    || sat->pkg->reason != ALPM_PKG_REASON_EXPLICIT))
+        {
+            expand_claim (ctx, w, sat->pkg);
+        }
+    }
+
+    pthread_mutex_lock (&ctx->mutex);
+    slot = get_satisfiers_slot (data, pkg);
+    *slot = sats;
+    pthread_mutex_unlock (&ctx->mutex);
+}
+
+static void
+expand_worker (expand_t *ctx, size_t w)
+{
+    for (;;)
+    {
+        pkginfo_t *pkg;
+        bool       done;
+        size_t     n;
+
+        pkg = deque_pop (&ctx->deques[w], false);
+        for (n = 1; !pkg && n < ctx->nb_deques; ++n)
+        {
+            pkg = deque_pop (&ctx->deques[(w + n) % ctx->nb_deques], true);
+        }
+        if (pkg)
+        {
+            pthread_mutex_lock (&ctx->mutex);
+            --ctx->queued;
+            pthread_mutex_unlock (&ctx->mutex);
+
+            expand_resolve (ctx, w, pkg);
+
+            pthread_mutex_lock (&ctx->mutex);
+            if (--ctx->pending == 0)
+            {
+                pthread_cond_broadcast (&ctx->cond);
+            }
+            pthread_mutex_unlock (&ctx->mutex);
+            continue;
+        }
+
+        pthread_mutex_lock (&ctx->mutex);
+        while (ctx->pending > 0 && ctx->queued == 0)
+        {
+            pthread_cond_wait (&ctx->cond, &ctx->mutex);
+        }
+        done = (ctx->pending == 0);
+        pthread_mutex_unlock (&ctx->mutex);
+        if (done)
+        {
+            break;
+        }
+    }
+}
+
+/* resolves (in parallel) satisfiers of all dependencies in pkg's closure */
+static void
+expand_parallel (data_t *data, pkginfo_t *pkg)
+{
+    expand_t     ctx;
+    alpm_list_t *i;
+    size_t       n;
+
+    /* workers must not load anything: local db is always needed, sync ones
+     * only if pkg comes from there (or they're ready already, e.g. roots).
+     * Else satisfiers not found locally are left to add_to_deps() */
+    load_pkgdbs (data->localdb);
+    get_provides (data->localdb, &data->provides_local);
+    if (pkg->db->name)
+    {
+        load_pkgdbs (config.syncdbs);
+        get_provides (config.syncdbs, &config.provides_sync);
+    }
+
+    if (!data->sats)
+    {
+        data->nb_sats = 1 + alpm_list_count (config.syncdbs);
+        data->sats = calloc (data->nb_sats, sizeof (*data->sats));
+        if (!data->sats)
+        {
+            return;
+        }
+    }
+    for (n = 0, i = data->localdb; n < data->nb_sats; ++n)
+    {
+        pkgdb_t *pkgdb = i->data;
+
+        if (!data->sats[n].by_pkg && pkgdb->is_loaded && pkgdb->nb_pkgs > 0)
+        {
+            data->sats[n].by_pkg = calloc (pkgdb->nb_pkgs, sizeof (satisfier_t *));
+            data->sats[n].nb_pkgs = (data->sats[n].by_pkg) ? pkgdb->nb_pkgs : 0;
+        }
+        i = (n == 0) ? config.syncdbs : i->next;
+    }
+
+    memset (&ctx, 0, sizeof (ctx));
+    ctx.data = data;
+    ctx.nb_deques = config.jobs;
+    ctx.deques = calloc (ctx.nb_deques, sizeof (*ctx.deques));
+    if (!ctx.deques)
+    {
+        return;
+    }
+    ctx.sync_ready = config.provides_sync.is_built;
+    pthread_mutex_init (&ctx.mutex, NULL);
+    pthread_cond_init (&ctx.cond, NULL);
+    for (n = 0; n < ctx.nb_deques; ++n)
+    {
+        pthread_mutex_init (&ctx.deques[n].mutex, NULL);
+    }
+
+    if (expand_claim (&ctx, 0, pkg))
+    {
+        debug ("resolving closure of %s using %zu workers\n", pkg->name, ctx.nb_deques);
+        run_jobs ((job_fn) expand_worker, &ctx, ctx.nb_deques);
+    }
+
+    for (n = 0; n < ctx.nb_deques; ++n)
+    {
+        free (ctx.deques[n].items);
+        pthread_mutex_destroy (&ctx.deques[n].mutex);
+    }
+    free (ctx.deques);
+    pthread_cond_destroy (&ctx.cond);
+    pthread_mutex_destroy (&ctx.mutex);
+}
+
+static void
+free_satisfiers (data_t *data)
+{
+    size_t n, p;
+
+    for (n = 0; n < data->nb_sats; ++n)
+    {
+        for (p = 0; p < data->sats[n].nb_pkgs; ++p)
+        {
+            satisfier_t *sats = data->sats[n].by_pkg[p];
+
+            if (sats != &no_satisfiers && sats != &claimed_satisfiers)
+            {
+                free (sats);
+            }
+        }
+        free (data->sats[n].by_pkg);
+    }
+    free (data->sats);
+    data->sats = NULL;
+    data->nb_sats = 0;
+}
+
+static pkg_t *
+add_to_deps (data_t *data, pkginfo_t *pkg, pkg_t *from_p)
+{
+    pkg_t       *p;
+    alpm_list_t *i;
+    satisfier_t *sats;
+
+    /* if package is already in there, no need to do anything */
+    p = find_pkg (data, pkg->name_id);
+    if (p)
+    {
+        debug ("%s already in deps\n", pkg->name);
+        if (from_p && p->req_by && get_req_depth (p) > get_req_depth (from_p))
+        {
+            p->req_by = from_p;
+        }
+        return p;
+    }
+
+    p = new_package (data, pkg);
+    p->req_by = from_p;
+
+    /* go through dep tree to list all dependencies involved */
+    sats = get_satisfiers (data, pkg);
+    FOR_LIST (i, pkg->depends)
+    {
+        satisfier_t *sat = (sats) ? sats++ : NULL;
+        pkginfo_t   *dep;
+        pkg_t       *d;
+        const char  *provision;
+
+        if (sat && sat->is_resolved)
+        {
+            dep = sat->pkg;
+            provision = sat->provision;
+        }
+        else
+        {
+            debug ("[%s] look for satisfier of %s\n", p->name,
+                    ((alpm_depend_t *) i->data)->name);
+            dep = find_dep_satisfier (data, true, i->data, &provision);
+            if (!dep)
+            {
+                dep = find_dep_satisfier (data, false, i->data, &provision);
+            }
+        }
+        if (!dep && config.hook == HOOK_INSTALL)
+        {
+            /* not installed nor a target, so not part of the transaction */
+            continue;
+        }
+        else if (!dep)
+        {
+            char *n = alpm_dep_compute_string (i->data);
+
+            fprintf (stderr, "Error: no package found for dependency %s\n",
+                    n);
+            free (n);
+            continue;
+        }
+
+        if (!config.explicit
+                && !dep->db->name
+                && dep->reason == ALPM_PKG_REASON_EXPLICIT)
+        {
+            debug ("ignoring dependency %s, explicitly installed\n",
+                    dep->name);
+            continue;
+        }
+
+        debug ("add to deps: %s\n", dep->name);
+        d = add_to_deps (data, dep, p);
+        if (d && provision && !d->provision)
+        {
+            d->provision = provision;
+        }
+        if (d)
+        {
+            debug ("%s new in deps, adding to %s's dependencies\n",
+                    d->name, p->name);
+            p->deps = alpm_list_add (p->deps, d);
+        }
+    }
+
+    return p;
+}
+
+static dep_t
+get_dep_explicit (pkg_t *pkg, dep_t dep)
+{
+    if (!config.explicit || dep == DEP_UNKNOWN)
+    {
+        return dep;
+    }
+
+    if (!pkg->repo && pkg->pkg->reason == ALPM_PKG_REASON_EXPLICIT)
+    {
+        return dep + 1;
+    }
+    return dep;
+}
+
+static dep_t
+get_pkg_dep_state (data_t *data, alpm_list_t *refs, pkg_t *pkg)
+{
+    alpm_list_t *reqs, *i;
+    pkg_t *p;
+    dep_t d;
+
+    /* is pkg state already known? */
+    if (pkg->dep != DEP_UNKNOWN)
+    {
+        return pkg->dep;
+    }
+
+    debug ("compute dep state for %s\n", pkg->name);
+    reqs = compute_requiredby (data, pkg->pkg);
+    FOR_LIST (i, reqs)
+    {
+        const char *name = ((pkginfo_t *) i->data)->name;
+        str_t       id   = ((pkginfo_t *) i->data)->name_id;
+
+        p = find_pkg (data, id);
+        if (!p)
+        {
+            /* required by a pkg outside our tree -- if it's one not installed
+             * locally, we ignore it, else it's a shared dependency */
+
+            if (!pkgdb_get_pkg (data->localdb->data, id))
+            {
+                continue;
+            }
+
+            d = get_dep_explicit (pkg, DEP_SHARED);
+            debug ("%s=%d: required by outsider: %s\n",
+                    pkg->name,
+                    d,
+                    name);
+            alpm_list_free (reqs);
+            return d;
+        }
+        else if (p->dep == DEP_SHARED || p->dep == DEP_SHARED_EXPLICIT)
+        {
+            /* required by a shared dep */
+            d = get_dep_explicit (pkg, DEP_SHARED);
+            debug ("%s=%d: required by shared dep (%s=%d)\n",
+                    pkg->name,
+                    d,
+                    name,
+                    (p) ? p->dep : DEP_UNKNOWN);
+            alpm_list_free (reqs);
+            return d;
+        }
+        else if (p->dep == DEP_UNKNOWN)
+        {
+            if (!alpm_list_find_ptr (refs, p))
+            {
+                debug ("%s required by %s, determining state\n",
+                        pkg->name,
+                        name);
+                refs = alpm_list_add (refs, p);
+                d = get_pkg_dep_state (data, refs, p);
+                set_pkg_dep (data, refs, p, d);
+                if (d == DEP_SHARED || d == DEP_SHARED_EXPLICIT
+                        || (config.explicit && d == DEP_EXCLUSIVE_EXPLICIT))
+                {
+                    debug ("%s=SHARED: %s not exclusive (%d)\n",
+                            pkg->name,
+                            name,
+                            d);
+                    refs = alpm_list_remove (refs,
+                            p,
+                            (alpm_list_fn_cmp) pkg_find_pkg_fn,
+                            NULL);
+                    d = get_dep_explicit (pkg, DEP_SHARED);
+                    debug ("%s=%d\n", pkg->name, d);
+                    alpm_list_free (reqs);
+                    return d;
+                }
+                debug ("moving on\n");
+                refs = alpm_list_remove (refs,
+                        p,
+                        (alpm_list_fn_cmp) pkg_find_pkg_fn,
+                        NULL);
+            }
+            else
+            {
+                debug ("%s required by %s, already found in refs\n",
+                        pkg->name,
+                        name);
+            }
+        }
+    }
+    alpm_list_free (reqs);
+
+    d = get_dep_explicit (pkg, DEP_EXCLUSIVE);
+    debug ("%s=%d\n", pkg->name, d);
+    return d;
+}
+
+/* packages of equal size are sorted by name, so the order doesn't depend on
+ * the one they were added to their group in */
+static int
+pkg_origin_size_cmp (pkg_t *pkg1, pkg_t *pkg2)
+{
+    off_t size1, size2;
+
+    if (pkg1->repo && !pkg2->repo)
+    {
+        return 1;
+    }
+    else if (!pkg1->repo && pkg2->repo)
+    {
+        return -1;
+    }
+
+    size1 = pkg1->pkg->isize;
+    size2 = pkg2->pkg->isize;
+
+    if (size1 > size2)
+    {
+        return -1;
+    }
+    else if (size1 == size2)
+    {
+        return str_cmp (pkg1->name_id, pkg2->name_id);
+    }
+    else
+    {
+        return 1;
+    }
+}
+
+static int
+pkg_origin_name_cmp (pkg_t *pkg1, pkg_t *pkg2)
+{
+    if (pkg1->repo && !pkg2->repo)
+    {
+        return 1;
+    }
+    else if (!pkg1->repo && pkg2->repo)
+    {
+        return -1;
+    }
+    return str_cmp (pkg1->name_id, pkg2->name_id);
+}
+
+/* moves pkg (a dependency, not a main package) from its current group to the
+ * one for dep, updating their size & list */
+static void
+move_to_group (data_t *data, pkg_t *pkg, dep_t dep)
+{
+    alpm_list_t *i;
+
+    if (pkg->dep != DEP_UNKNOWN)
+    {
+        data->group[pkg->dep].size -= pkg->pkg->isize;
+        if (!pkg->repo)
+        {
+            data->group[pkg->dep].size_local -= pkg->pkg->isize;
+        }
+        FOR_LIST (i, data->group[pkg->dep].pkgs)
+        {
+            if (i->data == pkg)
+            {
+                data->group[pkg->dep].pkgs = alpm_list_remove_item (
+                        data->group[pkg->dep].pkgs, i);
+                free (i);
+                break;
+            }
+        }
+    }
+    if ((config.list_exclusive && dep == DEP_EXCLUSIVE)
+            || (config.list_exclusive_explicit && dep == DEP_EXCLUSIVE_EXPLICIT)
+            || (config.list_shared && dep == DEP_SHARED)
+            || (config.list_shared_explicit && dep == DEP_SHARED_EXPLICIT)
+            || (config.list_optional && dep == DEP_OPTIONAL)
+            || (config.list_optional_explicit && dep == DEP_OPTIONAL_EXPLICIT))
+    {
+        int len = (int) strlen (pkg->name) + 1; /* +1 for space after */
+        if (pkg->repo)
+        {
+            len += (int) strlen (pkg->repo) + 1; /* +1 for slash */
+        }
+
+        /* sorted once everything is known, see sort_groups() */
+        data->group[dep].pkgs = alpm_list_add (data->group[dep].pkgs, pkg);
+        if (len > data->group[dep].len_max)
+        {
+            data->group[dep].len_max = len;
+        }
+    }
+    data->group[dep].size += pkg->pkg->isize;
+    if (!pkg->repo)
+    {
+        data->group[dep].size_local += pkg->pkg->isize;
+    }
+}
+
+static void
+set_pkg_dep (data_t *data, alpm_list_t *refs, pkg_t *pkg, dep_t dep)
+{
+    alpm_list_t *i;
+
+    debug ("set %s to dep %d\n", pkg->name, dep);
+    if (pkg->dep == dep)
+    {
+        return;
+    }
+    /* size & list are only done for dependencies, not the main package */
+    if (!alpm_list_find_ptr (data->pkgs, pkg))
+    {
+        move_to_group (data, pkg, dep);
+    }
+    pkg->dep = dep;
+
+    FOR_LIST (i, pkg->deps)
+    {
+        pkg_t *p = i->data;
+        debug ("%s depends on %s\n", pkg->name, p->name);
+        if (pkg->dep == DEP_SHARED)
+        {
+            dep_t d;
+
+            d = get_dep_explicit (p, DEP_SHARED);
+            set_pkg_dep (data, refs, p, d);
+        }
+        else
+        {
+            dep_t d;
+            /* pkg might already be in refs (e.g. from get_pkg_dep_state), in
+             * which case it mustn't be removed, as it could be the head of
+             * the caller's list */
+            bool  add = !alpm_list_find_ptr (refs, pkg);
+
+            if (add)
+            {
+                refs = alpm_list_add (refs, pkg);
+            }
+            d = get_pkg_dep_state (data, refs, p);
+            set_pkg_dep (data, refs, p, d);
+            if (add)
+            {
+                refs = alpm_list_remove (refs,
+                        pkg,
+                        (alpm_list_fn_cmp) pkg_find_pkg_fn,
+                        NULL);
+            }
+        }
+    }
+}
+
+#ifdef PACDEP_ENGINES
+/* Indexed engine: same as get_pkg_dep_state()/set_pkg_dep() and giving the
+ * same results, only requirers of a package are resolved (to pkg_t) only
+ * once, using an index of our tree instead of going through it each time,
+ * and the chain of refs is a counter on each package instead of a list */
+
+/* resolves the requirers of pkg, in order, up to the first one not in our tree
+ * but installed (stored as NULL) since that one makes it shared */
+static void
+get_pkg_reqs (data_t *data, pkg_t *pkg)
+{
+    alpm_list_t *reqs, *i;
+
+    pkg->has_reqs = true;
+    index_deps (data);
+
+    reqs = compute_requiredby (data, pkg->pkg);
+    pkg->reqs = calloc (alpm_list_count (reqs) + 1, sizeof (*pkg->reqs));
+    if (!pkg->reqs)
+    {
+        alpm_list_free (reqs);
+        return;
+    }
+    FOR_LIST (i, reqs)
+    {
+        str_t        id = ((pkginfo_t *) i->data)->name_id;
+        alpm_list_t *l  = nameidx_get (&data->deps_by_name, id);
+
+        if (!l && !pkgdb_get_pkg (data->localdb->data, id))
+        {
+            continue;
+        }
+        pkg->reqs[pkg->nb_reqs++] = (l) ? l->data : NULL;
+        if (!l)
+        {
+            break;
+        }
+    }
+    alpm_list_free (reqs);
+}
+
+static dep_t
+get_pkg_dep_state_indexed (data_t *data, pkg_t *pkg)
+{
+    size_t n;
+
+    if (pkg->dep != DEP_UNKNOWN)
+    {
+        return pkg->dep;
+    }
+    if (!pkg->has_reqs)
+    {
+        get_pkg_reqs (data, pkg);
+    }
+
+    for (n = 0; n < pkg->nb_reqs; ++n)
+    {
+        pkg_t *p = pkg->reqs[n];
+
+        if (!p || p->dep == DEP_SHARED || p->dep == DEP_SHARED_EXPLICIT)
+        {
+            /* required by an (installed) outsider, or a shared dep */
+            return get_dep_explicit (pkg, DEP_SHARED);
+        }
+        else if (p->dep == DEP_UNKNOWN && p->nb_refs == 0)
+        {
+            dep_t d;
+
+            ++p->nb_refs;
+            d = get_pkg_dep_state_indexed (data, p);
+            set_pkg_dep_indexed (data, p, d);
+            --p->nb_refs;
+            if (d == DEP_SHARED || d == DEP_SHARED_EXPLICIT
+                    || (config.explicit && d == DEP_EXCLUSIVE_EXPLICIT))
+            {
+                return get_dep_explicit (pkg, DEP_SHARED);
+            }
+        }
+    }
+    return get_dep_explicit (pkg, DEP_EXCLUSIVE);
+}
+
+static void
+set_pkg_dep_indexed (data_t *data, pkg_t *pkg, dep_t dep)
+{
+    alpm_list_t *i;
+
+    if (pkg->dep == dep)
+    {
+        return;
+    }
+    if (!pkg->is_main)
+    {
+        move_to_group (data, pkg, dep);
+    }
+    pkg->dep = dep;
+
+    FOR_LIST (i, pkg->deps)
+    {
+        pkg_t *p = i->data;
+
+        if (pkg->dep == DEP_SHARED)
+        {
+            set_pkg_dep_indexed (data, p, get_dep_explicit (p, DEP_SHARED));
+        }
+        else
+        {
+            ++pkg->nb_refs;
+            set_pkg_dep_indexed (data, p, get_pkg_dep_state_indexed (data, p));
+            --pkg->nb_refs;
+        }
+    }
+}
+#endif /* PACDEP_ENGINES */
+
+/* index, by name of the optional dependency, all packages from dbs with
+ * optional dependencies. Done only once, on first use */
+static nameidx_t *
+get_optreqs (alpm_list_t *dbs, nameidx_t *optreqs)
+{
+    alpm_list_t *i;
+
+    if (optreqs->is_built)
+    {
+        return optreqs;
+    }
+    optreqs->is_built = true;
+
+    debug ("indexing optional dependencies\n");
+    FOR_LIST (i, dbs)
+    {
+        pkgdb_t *pkgdb = pkgdb_load (i->data);
+        size_t   n;
+
+        for (n = 0; n < pkgdb->nb_pkgs; ++n)
+        {
+            pkginfo_t   *p = &pkgdb->pkgs[n];
+            alpm_list_t *k;
+
+            FOR_LIST (k, p->optdepends)
+            {
+                const char   *name = ((alpm_depend_t *) k->data)->name;
+                alpm_list_t  *reqs;
+                str_t         id;
+
+                /* optdepends used to be info strings: "package: some desc" */
+                id = str_intern_len (name, strcspn (name, ":"));
+                if (!id)
+                {
+                    continue;
+                }
+                reqs = nameidx_get (optreqs, id);
+                /* in case the same optdep is listed twice */
+                if (!reqs || alpm_list_last (reqs)->data != p)
+                {
+                    nameidx_add (optreqs, id, p);
+                }
+            }
+        }
+    }
+    return optreqs;
+}
+
+static inline void
+get_pkg_optrequiredby (data_t *data, pkg_t *pkg)
+{
+    nameidx_t   *optreqs;
+    alpm_list_t *i;
+
+    debug ("create list of opt-requirers for %s\n", pkg->name);
+    optreqs = (pkg->repo)
+        ? get_optreqs (config.syncdbs, &config.optreqs_sync)
+        : get_optreqs (data->localdb, &data->optreqs_local);
+    FOR_LIST (i, nameidx_get (optreqs, pkg->name_id))
+    {
+        pkginfo_t   *p = i->data;
+        pkg_t       *r;
+
+        debug ("[%s] found optreq: %s\n", pkg->name, p->name);
+        r = find_pkg (data, p->name_id);
+        if (!r)
+        {
+            r = new_package (data, p);
+            set_pkg_dep (data, NULL, r, DEP_OPTIONAL);
+        }
+    }
+}
+
+static bool
+rev_budget_exceeded (data_t *data)
+{
+    if (config.max_nodes > 0 && data->rev_nodes >= config.max_nodes)
+    {
+        data->rev_stopped = "max nodes reached";
+        return true;
+    }
+    if (config.deadline > 0
+            && (unsigned long) ((now_us () - data->rev_start) / 1000) >= config.deadline)
+    {
+        data->rev_stopped = "deadline reached";
+        return true;
+    }
+    return false;
+}
+
+/* adds all (new) packages requiring pkg, returns how many, or -1 if the budget
+ * was exceeded before all were added (immediate requirers are always all
+ * added). They are also added to found if specified, for them to be processed
+ * in turn */
+static int
+get_pkg_requiredby (data_t *data, pkg_t *pkg, alpm_list_t **found)
+{
+    int          nb = 0;
+    alpm_list_t *reqs;
+    alpm_list_t *j;
+
+    debug ("create list of requirers for %s\n", pkg->name);
+    reqs = compute_requiredby (data, pkg->pkg);
+    FOR_LIST (j, reqs)
+    {
+        const char *name = ((pkginfo_t *) j->data)->name;
+        pkg_t *r;
+
+        r = find_pkg (data, ((pkginfo_t *) j->data)->name_id);
+        if (!r)
+        {
+            /* not in our tree, is it installed? */
+            pkginfo_t *p = NULL;
+
+            debug ("[%s] found req: %s\n", pkg->name, name);
+
+            if (data->source == SCE_LOCAL || data->source == SCE_MIXED)
+            {
+                p = find_satisfier (data, true, name, NULL);
+            }
+            /* SCE_SYNC and SCE_MIXED look in sync dbs (too) */
+            if (!p && data->source != SCE_LOCAL)
+            {
+                p = find_satisfier (data, false, name, NULL);
+            }
+
+            if (p)
+            {
+                if (data->rev_depth > 0 && rev_budget_exceeded (data))
+                {
+                    nb = -1;
+                    break;
+                }
+                ++nb;
+                ++data->rev_nodes;
+                r = new_package (data, p);
+                /* with -rrr only end packages are listed, which we only know
+                 * once they've been processed */
+                if (config.reverse <= 2)
+                {
+                    set_pkg_dep (data, NULL, r, DEP_EXCLUSIVE);
+                }
+                if (found)
+                {
+                    *found = alpm_list_add (*found, r);
+                }
+            }
+            else
+            {
+                fprintf (stderr, "Error: no package found for %s\n",
+                        name);
+            }
+        }
+    }
+    alpm_list_free (reqs);
+    return nb;
+}
+
+/* goes through the reverse dependency tree of all packages, breadth-first:
+ * each level is fully expanded before moving to the next one, so if the
+ * budget (--max-nodes/--deadline) is exceeded we have all requirers up to
+ * data->rev_depth */
+static void
+get_requiredby (data_t *data)
+{
+    alpm_list_t *level;
+    alpm_list_t *next;
+    alpm_list_t *i;
+
+    level = alpm_list_copy (data->pkgs);
+    while (level)
+    {
+        next = NULL;
+        FOR_LIST (i, level)
+        {
+            pkg_t *pkg = i->data;
+            int    nb;
+
+            if (data->rev_depth > 0 && rev_budget_exceeded (data))
+            {
+                break;
+            }
+            nb = get_pkg_requiredby (data, pkg,
+                    (config.reverse >= 2) ? &next : NULL);
+            if (nb < 0)
+            {
+                /* stopped while processing it */
+                break;
+            }
+            if (config.reverse == 3 && nb == 0 && data->rev_depth > 0)
+            {
+                set_pkg_dep (data, NULL, pkg, DEP_EXCLUSIVE);
+            }
+        }
+        if (i)
+        {
+            /* stopped: with -rrr what wasn't processed is as far as we
+             * got, so we list it */
+            if (config.reverse == 3)
+            {
+                alpm_list_t *j;
+
+                FOR_LIST (j, i)
+                {
+                    set_pkg_dep (data, NULL, j->data, DEP_EXCLUSIVE);
+                }
+                FOR_LIST (j, next)
+                {
+                    set_pkg_dep (data, NULL, j->data, DEP_EXCLUSIVE);
+                }
+            }
+            debug ("reverse: stopped at depth %d (%s)\n",
+                    data->rev_depth, data->rev_stopped);
+            alpm_list_free (next);
+            next = NULL;
+        }
+        else
+        {
+            ++data->rev_depth;
+        }
+        alpm_list_free (level);
+        level = next;
+    }
+}
+
+/* a file from a package, and its actual (allocated) size on disk */
+typedef struct _filestat_t {
+    const char      *name;          /* relative to rootdir */
+    pkg_t           *pkg;
+    dev_t            dev;
+    ino_t            ino;
+    off_t            size;
+    unsigned int     is_found : 1;
+} filestat_t;
+
+typedef struct _filestats_t {
+    const char      *rootdir;
+    filestat_t      *files;
+    size_t           nb;
+} filestats_t;
+
+/* files stat-ed by each job */
+#define STAT_CHUNK              256
+
+static void
+stat_files (filestats_t *ctx, size_t n)
+{
+    char    path[PATH_MAX];
+    size_t  i;
+    size_t  last;
+
+    last = (n + 1) * STAT_CHUNK;
+    if (last > ctx->nb)
+    {
+        last = ctx->nb;
+    }
+    for (i = n * STAT_CHUNK; i < last; ++i)
+    {
+        filestat_t  *f = &ctx->files[i];
+        struct stat  st;
+
+        if (snprintf (path, sizeof (path), "%s%s", ctx->rootdir, f->name)
+                >= (int) sizeof (path)
+                || lstat (path, &st) < 0)
+        {
+            continue;
+        }
+        f->dev      = st.st_dev;
+        f->ino      = st.st_ino;
+        f->size     = (off_t) st.st_blocks * 512;
+        f->is_found = true;
+    }
+}
+
+/* for all installed packages in data, sums the allocated size of all their
+ * files (under rootdir), i.e. what they really use on disk. Files are stat-ed
+ * in parallel, and each inode only counted once: for the first package it is
+ * found in, should it be shared/hardlinked */
+static void
+get_actual_sizes (data_t *data, const char *rootdir)
+{
+    filestats_t   ctx;
+    filestat_t  **table;
+    alpm_list_t  *i;
+    size_t        size;
+    size_t        missing = 0;
+    size_t        n;
+
+    if (!rootdir)
+    {
+        if (data->root)
+        {
+            fprintf (stderr, "Warning: sizes on disk unknown for snapshot %s\n",
+                    data->root);
+        }
+        else
+        {
+            fprintf (stderr, "Warning: sizes on disk unknown for a snapshot\n");
+        }
+        return;
+    }
+    data->has_actual = true;
+
+    /* only installed packages have files on disk */
+    ctx.rootdir = rootdir;
+    ctx.nb = 0;
+    FOR_LIST (i, data->deps)
+    {
+        pkg_t *p = i->data;
+
+        /* (libalpm isn't thread-safe, packages are looked up now) */
+        if (!p->repo && pkginfo_get_alpm (p->pkg))
+        {
+            ctx.nb += alpm_pkg_get_files (p->pkg->pkg)->count;
+        }
+    }
+    if (ctx.nb == 0)
+    {
+        return;
+    }
+    ctx.files = calloc (ctx.nb, sizeof (*ctx.files));
+    if (!ctx.files)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        return;
+    }
+
+    n = 0;
+    FOR_LIST (i, data->deps)
+    {
+        pkg_t           *p = i->data;
+        alpm_filelist_t *fl;
+        size_t           j;
+
+        if (p->repo || !p->pkg->pkg)
+        {
+            continue;
+        }
+        p->has_actual = true;
+        fl = alpm_pkg_get_files (p->pkg->pkg);
+        for (j = 0; j < fl->count; ++j)
+        {
+            const char *name = fl->files[j].name;
+            size_t      len = strlen (name);
+
+            /* directories are shared by many packages, we ignore them */
+            if (len == 0 || name[len - 1] == '/')
+            {
+                continue;
+            }
+            ctx.files[n].name = name;
+            ctx.files[n].pkg  = p;
+            ++n;
+        }
+    }
+    ctx.nb = n;
+
+    debug ("stat-ing %u files under %s\n", (unsigned int) ctx.nb, rootdir);
+    run_jobs ((job_fn) stat_files, &ctx, (ctx.nb + STAT_CHUNK - 1) / STAT_CHUNK);
+
+    /* hash table (open addressing) of inodes already counted */
+    for (size = 16; size < ctx.nb * 2; size <<= 1)
+        ;
+    table = calloc (size, sizeof (*table));
+    if (!table)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        free (ctx.files);
+        return;
+    }
+    for (n = 0; n < ctx.nb; ++n)
+    {
+        filestat_t *f = &ctx.files[n];
+        size_t      slot;
+
+        if (!f->is_found)
+        {
+            ++missing;
+            continue;
+        }
+        slot = ((size_t) f->ino * 31 + (size_t) f->dev) & (size - 1);
+        while (table[slot]
+                && (table[slot]->ino != f->ino || table[slot]->dev != f->dev))
+        {
+            slot = (slot + 1) & (size - 1);
+        }
+        if (table[slot])
+        {
+            continue;
+        }
+        table[slot] = f;
+        f->pkg->size_actual += f->size;
+    }
+    debug ("%u files missing\n", (unsigned int) missing);
+    free (table);
+    free (ctx.files);
+
+    FOR_LIST (i, data->deps)
+    {
+        pkg_t *p = i->data;
+
+        if (!p->has_actual)
+        {
+            continue;
+        }
+        if (alpm_list_find_ptr (data->pkgs, p))
+        {
+            data->group[DEP_UNKNOWN].size_actual += p->size_actual;
+        }
+        else if (p->dep != DEP_UNKNOWN)
+        {
+            data->group[p->dep].size_actual += p->size_actual;
+        }
+    }
+}
+
+static int
+cache_file_cmp (const void *f1, const void *f2)
+{
+    return strcmp (*(const char * const *) f1, *(const char * const *) f2);
+}
+
+/* lists (once) all files in the package cache dirs, so checking whether a
+ * package was already downloaded doesn't require a stat() each time */
+static int
+index_cache (void)
+{
+    alpm_list_t *i;
+    size_t       alloc = 0;
+
+    FOR_LIST (i, alpm_option_get_cachedirs (config.alpm))
+    {
+        DIR             *dir;
+        struct dirent   *entry;
+
+        dir = opendir (i->data);
+        if (!dir)
+        {
+            debug ("cannot open cache dir %s\n", (const char *) i->data);
+            continue;
+        }
+        while ((entry = readdir (dir)))
+        {
+            size_t len = strlen (entry->d_name);
+
+            /* partial downloads don't count */
+            if (entry->d_name[0] == '.'
+                    || (len > 5 && strcmp (entry->d_name + len - 5, ".part") == 0))
+            {
+                continue;
+            }
+            if (config.nb_cache_files == alloc)
+            {
+                char **files;
+
+                alloc += BUF_LEN;
+                files = realloc (config.cache_files, sizeof (*files) * alloc);
+                if (!files)
+                {
+                    closedir (dir);
+                    return E_NOMEM;
+                }
+                config.cache_files = files;
+            }
+            config.cache_files[config.nb_cache_files] = strdup (entry->d_name);
+            if (!config.cache_files[config.nb_cache_files])
+            {
+                closedir (dir);
+                return E_NOMEM;
+            }
+            ++config.nb_cache_files;
+        }
+        closedir (dir);
+    }
+    debug ("%u files in cache\n", (unsigned int) config.nb_cache_files);
+
+    if (config.nb_cache_files > 1)
+    {
+        qsort (config.cache_files, config.nb_cache_files,
+                sizeof (*config.cache_files), cache_file_cmp);
+    }
+    return E_OK;
+}
+
+static void
+free_cache_index (void)
+{
+    size_t n;
+
+    for (n = 0; n < config.nb_cache_files; ++n)
+    {
+        free (config.cache_files[n]);
+    }
+    free (config.cache_files);
+    config.cache_files = NULL;
+    config.nb_cache_files = 0;
+}
+
+static inline bool
+is_in_cache (const char *filename)
+{
+    return config.nb_cache_files > 0 && filename
+        && bsearch (&filename, config.cache_files, config.nb_cache_files,
+                sizeof (*config.cache_files), cache_file_cmp);
+}
+
+/* download size of all packages from sync dbs (0 if already in the cache),
+ * using the cache index from index_cache() */
+static void
+get_download_sizes (data_t *data)
+{
+    alpm_list_t *i;
+
+    data->has_download = true;
+    FOR_LIST (i, data->deps)
+    {
+        pkg_t *p = i->data;
+
+        if (!p->repo)
+        {
+            continue;
+        }
+        p->has_download = true;
+        if (!is_in_cache (p->pkg->filename))
+        {
+            p->size_download = p->pkg->size;
+        }
+
+        if (alpm_list_find_ptr (data->pkgs, p))
+        {
+            data->group[DEP_UNKNOWN].size_download += p->size_download;
+        }
+        else if (p->dep != DEP_UNKNOWN)
+        {
+            data->group[p->dep].size_download += p->size_download;
+        }
+    }
+}
+
+/* with --actual-size/--download-size, shown after the package's (installed)
+ * size */
+static void
+print_size_extra (const char *label, bool has_size, off_t size)
+{
+    if (config.quiet)
+    {
+        fputc (' ', config.out);
+        if (has_size)
+        {
+            print_size (size);
+        }
+        else
+        {
+            fputc ('-', config.out);
+        }
+    }
+    else if (has_size)
+    {
+        fprintf (config.out, " [%s: ", label);
+        print_size (size);
+        fputc (']', config.out);
+    }
+}
+
+static void
+print_sizes_extra (data_t   *data,
+        bool                 has_actual,
+        off_t                size_actual,
+        bool                 has_download,
+        off_t                size_download)
+{
+    if (data->has_actual)
+    {
+        print_size_extra ("on disk", has_actual, size_actual);
+    }
+    if (data->has_download)
+    {
+        print_size_extra ("download", has_download, size_download);
+    }
+}
+
+static void
+free_pkg (pkg_t *pkg)
+{
+    alpm_list_free (pkg->deps);
+    free (pkg->reqs);
+    free (pkg);
+}
+
+static void
+sort_groups (data_t *data)
+{
+    alpm_list_fn_cmp fn;
+    int d;
+
+    fn = (alpm_list_fn_cmp) ((config.sort_size)
+            ? pkg_origin_size_cmp
+            : pkg_origin_name_cmp);
+    /* so sorting by names only compares ranks */
+    strpool_rank ();
+    for (d = 0; d < NB_DEPS; ++d)
+    {
+        data->group[d].pkgs = alpm_list_msort (data->group[d].pkgs,
+                alpm_list_count (data->group[d].pkgs),
+                fn);
+    }
+}
+
+static void
+list_dependencies (data_t *data, dep_t dep)
+{
+    alpm_list_t *i;
+    int flag = 0;
+
+    /* is this group mixed (pkgs from local & sync) ? */
+    if (!config.quiet && data->group[dep].size_local > 0
+            && data->group[dep].size > data->group[dep].size_local)
+    {
+        flag = 1;
+    }
+
+    FOR_LIST (i, data->group[dep].pkgs)
+    {
+        pkg_t *p = i->data;
+
+        if (flag == 1)
+        {
+            fprintf (config.out, " %*s", -8, "local:");
+            print_size (data->group[dep].size_local);
+            fputc ('\n', config.out);
+            flag = 2;
+        }
+
+        if (p->repo)
+        {
+            if (flag == 2)
+            {
+                fprintf (config.out, " %*s", -8, "sync:");
+                print_size (data->group[dep].size - data->group[dep].size_local);
+                fputc ('\n', config.out);
+                flag = 3;
+            }
+            if (config.quiet)
+            {
+                fprintf (config.out, "%s/%s ", p->repo, p->name);
+            }
+            else
+            {
+                fprintf (config.out, (flag) ? "  %s/%*s" : " %s/%*s",
+                        p->repo,
+                        /* +1 for the slash */
+                        -data->group[dep].len_max + (int) strlen (p->repo) + 1,
+                        p->name);
+            }
+        }
+        else
+        {
+            if (config.quiet)
+            {
+                fprintf (config.out, "%s ", p->name);
+            }
+            else
+            {
+                fprintf (config.out, (flag) ? "  %*s" : " %*s",
+                        -data->group[dep].len_max,
+                        p->name);
+            }
+        }
+        print_size (p->pkg->isize);
+        print_sizes_extra (data, p->has_actual, p->size_actual,
+                p->has_download, p->size_download);
+        if (config.show_provider && p->provision)
+        {
+            fprintf (config.out, " (provides %s)", p->provision);
+        }
+        if (config.show_path && p->req_by)
+        {
+            pkg_t *d;
+
+            for (d = p->req_by; d; d = d->req_by)
+            {
+                if (d->repo)
+                {
+                    fprintf (config.out, " <- %s/%s", d->repo, d->name);
+                }
+                else
+                {
+                    fprintf (config.out, " <- %s", d->name);
+                }
+            }
+        }
+        fputc ('\n', config.out);
+    }
+}
+
+static void
+print_group (data_t *data,
+        dep_t        dep,
+        int          len_max,
+        off_t        size,
+        bool         list_deps,
+        bool         list_deps_explicit)
+{
+    if (!config.quiet)
+    {
+        fprintf (config.out, "%*s", -len_max, data->group[dep].title);
+        print_size (data->group[dep].size);
+        print_sizes_extra (data, true, data->group[dep].size_actual,
+                true, data->group[dep].size_download);
+        fputc ('\n', config.out);
+    }
+    if (list_deps)
+    {
+        list_dependencies (data, dep);
+    }
+    /* is this group mixed (pkgs from local & sync) ? */
+    else if (!config.quiet && data->group[dep].size_local > 0
+            && data->group[dep].size > data->group[dep].size_local)
+    {
+        fprintf (config.out, " %*s", -8, "local:");
+        print_size (data->group[dep].size_local);
+        fputc ('\n', config.out);
+        fprintf (config.out, " %*s", -8, "sync:");
+        print_size (data->group[dep].size - data->group[dep].size_local);
+        fputc ('\n', config.out);
+    }
+
+    if (config.explicit)
+    {
+        if (!config.quiet)
+        {
+            fprintf (config.out, "%*s", -len_max, data->group[dep + 1].title);
+            print_size (data->group[dep + 1].size);
+            print_sizes_extra (data, true, data->group[dep + 1].size_actual,
+                    true, data->group[dep + 1].size_download);
+            if (data->group[dep].size > 0 && data->group[dep + 1].size > 0)
+            {
+                fputs (" (", config.out);
+                print_size (size);
+                fputs (")\n", config.out);
+            }
+            else
+            {
+                fputc ('\n', config.out);
+            }
+        }
+        if (list_deps_explicit)
+        {
+            list_dependencies (data, dep + 1);
+        }
+        /* is this group mixed (pkgs from local & sync) ? */
+        else if (!config.quiet && data->group[dep].size_local > 0
+                && data->group[dep].size > data->group[dep].size_local)
+        {
+            fprintf (config.out, " %*s", -8, "local:");
+            print_size (data->group[dep + 1].size_local);
+            fputc ('\n', config.out);
+            fprintf (config.out, " %*s", -8, "sync:");
+            print_size (data->group[dep + 1].size
+                    - data->group[dep + 1].size_local);
+            fputc ('\n', config.out);
+        }
+    }
+}
+
+/* adds pkg (asked for as pkgname) to the main packages, with its deps */
+static void
+add_main_package (data_t *data, pkginfo_t *pkg, const char *pkgname)
+{
+    pkg_t       *p;
+
+    if (!config.reverse)
+    {
+        long long t = trace_begin ();
+
+        /* not from within a job (e.g. --root), which has its own thread */
+        if (config.jobs > 1 && !in_jobs && !find_pkg (data, pkg->name_id))
+        {
+            expand_parallel (data, pkg);
+        }
+        debug ("create list of all dependencies for %s\n", pkgname);
+        p = add_to_deps (data, pkg, NULL);
+        trace_end ("expand", pkg->name, t);
+    }
+    else
+    {
+        /* we simply create the pkg_t, nothing else to do at this point. This
+         * will also add it to data->deps */
+        p = new_package (data, pkg);
+    }
+    p->name_asked = pkgname;
+    /* mark exclusive right now, so when dependencies are sorted out all
+     * "main" packages are seen as exclusive */
+    p->dep = DEP_EXCLUSIVE;
+    if (p->repo)
+    {
+        if (data->source == SCE_UNKNOWN)
+        {
+            data->source = SCE_SYNC;
+        }
+        else if (data->source == SCE_LOCAL)
+        {
+            data->source = SCE_MIXED;
+        }
+    }
+    else
+    {
+        if (data->source == SCE_UNKNOWN)
+        {
+            data->source = SCE_LOCAL;
+        }
+        else if (data->source == SCE_SYNC)
+        {
+            data->source = SCE_MIXED;
+        }
+    }
+    /* in case the same package is listed twice on cmdline */
+    if (alpm_list_find_ptr (data->pkgs, p))
+    {
+        return;
+    }
+    data->pkgs = alpm_list_add (data->pkgs, p);
+    p->is_main = true;
+
+    if (!config.reverse && config.show_optional)
+    {
+        alpm_list_t *i;
+
+        debug ("add %s's optional dependencies\n", pkgname);
+        FOR_LIST (i, pkg->optdepends)
+        {
+            alpm_depend_t *optdep = i->data;
+            const char    *provision;
+            pkg_t         *d;
+
+            /* is this dependency installed ? */
+            pkg = find_satisfier (data, true, optdep->name, &provision);
+            if (!pkg)
+            {
+                /* should we list non-installed deps ? */
+                if (config.show_optional < 3)
+                {
+                    debug ("ignoring non-installed %s\n", optdep->name);
+                    continue;
+                }
+                pkg = find_satisfier (data, false, optdep->name, &provision);
+            }
+            if (!pkg)
+            {
+                debug ("ignoring non-found %s\n", optdep->name);
+                continue;
+            }
+
+            /* explicitly installed optdep are ignored by default */
+            if (config.show_optional < 3
                     && !config.explicit
-                    && alpm_pkg_get_origin (pkg) == ALPM_PKG_FROM_LOCALDB
-                    && alpm_pkg_get_reason (pkg) == ALPM_PKG_REASON_EXPLICIT)
+                    && !pkg->db->name
+                    && pkg->reason == ALPM_PKG_REASON_EXPLICIT)
+            {
+                debug ("ignoring explicitly installed %s\n", pkg->name);
+                continue;
+            }
+
+            if (config.show_optional < 2)
+            {
+                /* we now make sure it isn't required by smthg installed
+                 * but outside of our deptree */
+                alpm_list_t *reqs;
+                alpm_list_t *j;
+                bool         ignore = false;
+
+                reqs = compute_requiredby (data, pkg);
+                FOR_LIST (j, reqs)
+                {
+                    const char *name = ((pkginfo_t *) j->data)->name;
+                    pkg_t *_p;
+
+                    _p = find_pkg (data, ((pkginfo_t *) j->data)->name_id);
+                    if (!_p)
+                    {
+                        /* not in our tree, is it installed? */
+                        if (find_satisfier (data, true, name, NULL))
+                        {
+                            ignore = true;
+                            debug ("ignoring %s required by %s\n",
+                                    pkg->name,
+                                    name);
+                            break;
+                        }
+                    }
+                }
+                alpm_list_free (reqs);
+                if (ignore)
+                {
+                    continue;
+                }
+            }
+
+            debug ("add %s's optdep %s\n", p->name, pkg->name);
+            d = add_to_deps (data, pkg, p);
+            if (provision && !d->provision)
+            {
+                d->provision = provision;
+            }
+        }
+    }
+}
+
+static void
+preprocess_package (data_t *data, const char *pkgname)
+{
+    pkginfo_t   *pkg = NULL;
+
+    if (!config.from_sync)
+    {
+        /* seach all dbs (local, then sync) and find match even the name
+         * was a provider */
+        pkg = find_satisfier (data, true, pkgname, NULL);
+    }
+    if (!pkg)
+    {
+        pkg = find_satisfier (data, false, pkgname, NULL);
+    }
+    if (!pkg)
+    {
+        if (data->root)
+        {
+            fprintf (stderr, "Package not found: %s (in %s)\n",
+                    pkgname, data->root);
+        }
+        else
+        {
+            fprintf (stderr, "Package not found: %s\n", pkgname);
+        }
+        return;
+    }
+    add_main_package (data, pkg, pkgname);
+}
+
+/* package arguments with glob characters, or all of them with --regex, are
+ * patterns matched against package names */
+static inline bool
+is_pattern (const char *name)
+{
+    return config.regex || strpbrk (name, "*?[") != NULL;
+}
+
+/* compiles pattern (a glob, or with --regex an extended regex) into re, to
+ * match whole names */
+static int
+compile_pattern (const char *pattern, regex_t *re)
+{
+    char       *buf, *b;
+    const char *s;
+    int         r;
+
+    /* worst case, every char escaped, plus "^(" ")$" */
+    buf = malloc (sizeof (*buf) * (2 * strlen (pattern) + 5));
+    if (!buf)
+    {
+        return REG_ESPACE;
+    }
+    b = buf;
+    *b++ = '^';
+    *b++ = '(';
+    for (s = pattern; *s; ++s)
+    {
+        if (config.regex)
+        {
+            *b++ = *s;
+        }
+        else if (*s == '*')
+        {
+            *b++ = '.';
+            *b++ = '*';
+        }
+        else if (*s == '?')
+        {
+            *b++ = '.';
+        }
+        else if (*s == '[')
+        {
+            /* copied as is, up to the closing bracket */
+            *b++ = *s++;
+            if (*s == '!')
+            {
+                *b++ = '^';
+                ++s;
+            }
+            if (*s == ']')
+            {
+                *b++ = *s++;
+            }
+            for ( ; *s && *s != ']'; ++s)
+            {
+                *b++ = *s;
+            }
+            if (!*s)
+            {
+                break;
+            }
+            *b++ = *s;
+        }
+        else
+        {
+            if (strchr (".+(){}|^$\\", *s))
+            {
+                *b++ = '\\';
+            }
+            *b++ = *s;
+        }
+    }
+    *b++ = ')';
+    *b++ = '$';
+    *b = '\0';
+
+    debug ("pattern %s: %s\n", pattern, buf);
+    r = regcomp (re, buf, REG_EXTENDED | REG_NOSUB);
+    free (buf);
+    return r;
+}
+
+typedef void (*match_fn) (data_t *data, pkginfo_t *pkg, void *ctx);
+
+/* all patterns are compiled once, then matched in one pass over dbs, fn being
+ * called for every package matching (in db order) */
+static void
+match_patterns (data_t *data, alpm_list_t *dbs, alpm_list_t *patterns,
+        match_fn fn, void *ctx)
+{
+    alpm_list_t *i, *j;
+    regex_t     *res;
+    int         *state;         /* 0: no match (yet), 1: matched, else error */
+    size_t       nb = alpm_list_count (patterns);
+    size_t       n, k;
+
+    res = malloc (sizeof (*res) * nb);
+    state = calloc (nb, sizeof (*state));
+    if (!res || !state)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        free (res);
+        free (state);
+        return;
+    }
+    for (k = 0, i = patterns; k < nb; ++k, i = i->next)
+    {
+        int r = compile_pattern (i->data, &res[k]);
+
+        if (r == REG_ESPACE)
+        {
+            fprintf (stderr, "Error: out of memory\n");
+            state[k] = -1;
+        }
+        else if (r != 0)
+        {
+            char err[256];
+
+            regerror (r, &res[k], err, sizeof (err));
+            fprintf (stderr, "Invalid pattern %s: %s\n", (char *) i->data, err);
+            state[k] = -1;
+        }
+    }
+
+    load_pkgdbs (dbs);
+    FOR_LIST (i, dbs)
+    {
+        pkgdb_t *pkgdb = i->data;
+
+        for (n = 0; n < pkgdb->nb_pkgs; ++n)
+        {
+            pkginfo_t *pkg = &pkgdb->pkgs[n];
+            bool       matched = false;
+
+            /* every pattern matching it is matched, not only the first one */
+            for (k = 0; k < nb; ++k)
+            {
+                if (state[k] >= 0 && regexec (&res[k], pkg->name, 0, NULL, 0) == 0)
+                {
+                    state[k] = 1;
+                    matched = true;
+                }
+            }
+            if (!matched)
+            {
+                continue;
+            }
+            /* as with names, the first repo wins */
+            for (j = dbs; j != i && !pkgdb_get_pkg (j->data, pkg->name_id); j = j->next)
+                ;
+            if (j == i)
+            {
+                fn (data, pkg, ctx);
+            }
+        }
+    }
+
+    for (k = 0, i = patterns; k < nb; ++k, i = i->next)
+    {
+        if (state[k] < 0)
+        {
+            continue;
+        }
+        if (state[k] == 0)
+        {
+            if (data->root)
+            {
+                fprintf (stderr, "No package matches: %s (in %s)\n",
+                        (char *) i->data, data->root);
+            }
+            else
+            {
+                fprintf (stderr, "No package matches: %s\n", (char *) i->data);
+            }
+        }
+        regfree (&res[k]);
+    }
+    free (res);
+    free (state);
+}
+
+static void
+add_matched_package (data_t *data, pkginfo_t *pkg, void *ctx)
+{
+    (void) ctx;
+    add_main_package (data, pkg, pkg->name);
+}
+
+/* packages matching patterns in the local db (sync dbs with --from-sync) are
+ * added as if they were specified */
+static void
+preprocess_patterns (data_t *data, alpm_list_t *patterns)
+{
+    match_patterns (data,
+            (config.from_sync) ? config.syncdbs : data->localdb,
+            patterns, add_matched_package, NULL);
+}
+
+static void
+init_data (data_t *data, pkgdb_t *localdb, const char *root)
+{
+    memset (data, 0, sizeof (*data));
+    data->localdb = alpm_list_add (NULL, localdb);
+    data->root = root;
+}
+
+/* indexes are only needed during analyse(), not for printing results */
+static void
+free_data_indexes (data_t *data)
+{
+    free_nameidx (&data->optreqs_local);
+    free_nameidx (&data->provides_local);
+    free_nameidx (&data->requiredby_local);
+    free_nameidx (&data->deps_by_name);
+    free_satisfiers (data);
+    if (data->localdb)
+    {
+        pkgdb_t *pkgdb = data->localdb->data;
+
+        free_nameidx (&pkgdb->by_name);
+        pkgdb->by_name.is_built = false;
+    }
+}
+
+static void
+free_data (data_t *data)
+{
+    int d;
+
+    /* free list of deps */
+    alpm_list_free_inner (data->deps, (alpm_list_fn_free) free_pkg);
+    alpm_list_free (data->deps);
+    alpm_list_free (data->pkgs);
+
+    /* free groups list of packages */
+    for (d = 0; d < NB_DEPS; ++d)
+    {
+        alpm_list_free (data->group[d].pkgs);
+    }
+
+    free_data_indexes (data);
+    if (data->localdb)
+    {
+        free_pkgdb (data->localdb->data);
+    }
+    alpm_list_free (data->localdb);
+    memset (data, 0, sizeof (*data));
+}
+
+/* sets the group of pkg, with the reference engine unless told otherwise
+ * (the indexed one only exists for --compare-engines & the benchmarks) */
+static void
+classify_pkg (data_t *data, pkg_t *pkg, dep_t dep, bool reference)
+{
+#ifdef PACDEP_ENGINES
+    if (!reference)
+    {
+        set_pkg_dep_indexed (data, pkg, dep);
+        return;
+    }
+#else
+    (void) reference;
+#endif
+    set_pkg_dep (data, NULL, pkg, dep);
+}
+
+/* sorts out all dependencies of the main packages (exclusive, shared...)
+ * using either the reference engine, or the indexed one */
+static void
+classify (data_t *data, bool reference)
+{
+    alpm_list_t *i;
+
+    FOR_LIST (i, data->pkgs)
+    {
+        pkg_t *pkg = i->data;
+
+        debug ("determine dependencies type (exclusive/shared)\n");
+        /* restore to DEP_UNKNOWN so it's fully processed */
+        pkg->dep = DEP_UNKNOWN;
+        classify_pkg (data, pkg, DEP_EXCLUSIVE, reference);
+        if (config.show_optional)
+        {
+            alpm_list_t *j;
+            long long    t = trace_begin ();
+
+            FOR_LIST (j, pkg->pkg->optdepends)
+            {
+                const char *name = ((alpm_depend_t *) j->data)->name;
+                pkg_t *p;
+
+                /* if it's in data->deps it is an optdep to list/count as
+                 * such. (optdepends used to be info strings: "package:
+                 * some desc") */
+                p = find_pkg (data,
+                        str_lookup_len (name, strcspn (name, ":")));
+                if (!p)
+                {
+                    continue;
+                }
+
+                dep_t dep;
+
+                if (!config.explicit)
+                {
+                    dep = DEP_OPTIONAL;
+                }
+                else
+                {
+                    if (!p->repo
+                            && p->pkg->reason == ALPM_PKG_REASON_EXPLICIT)
+                    {
+                        dep = DEP_OPTIONAL_EXPLICIT;
+                    }
+                    else
+                    {
+                        dep = DEP_OPTIONAL;
+                    }
+                }
+                classify_pkg (data, p, dep, reference);
+            }
+            trace_end ("optional", pkg->name, t);
+        }
+    }
+}
+
+#ifdef PACDEP_ENGINES
+/* back to before classify() */
+static void
+reset_classification (data_t *data)
+{
+    alpm_list_t *i;
+    int          d;
+
+    FOR_LIST (i, data->deps)
+    {
+        pkg_t *p = i->data;
+
+        /* see preprocess_package() */
+        p->dep = (p->is_main) ? DEP_EXCLUSIVE : DEP_UNKNOWN;
+    }
+    for (d = DEP_UNKNOWN + 1; d < NB_DEPS; ++d)
+    {
+        alpm_list_free (data->group[d].pkgs);
+        data->group[d].pkgs         = NULL;
+        data->group[d].size         = 0;
+        data->group[d].size_local   = 0;
+        data->group[d].len_max      = 0;
+    }
+}
+
+/* classifies data with both engines: the reference one, then the indexed one
+ * whose results are kept, and compares them. If verbose, how long each took
+ * and all differences are reported on stderr.
+ * Returns the number of differences found */
+static unsigned int
+compare_engines (data_t *data, bool verbose)
+{
+    const char *names[NB_DEPS] = { "unknown", "exclusive", "exclusive explicit",
+        "shared", "shared explicit", "optional", "optional explicit" };
+    group_t      group[NB_DEPS];
+    dep_t       *deps;
+    alpm_list_t *i, *j;
+    long long    t_ref, t_idx;
+    unsigned int diff = 0;
+    size_t       n;
+    int          d;
+
+    deps = calloc (alpm_list_count (data->deps) + 1, sizeof (*deps));
+    if (!deps)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        classify (data, false);
+        return 0;
+    }
+
+    t_ref = now_us ();
+    classify (data, true);
+    t_ref = now_us () - t_ref;
+    sort_groups (data);
+    for (i = data->deps, n = 0; i; i = i->next, ++n)
+    {
+        deps[n] = ((pkg_t *) i->data)->dep;
+    }
+    /* we now own the lists */
+    memcpy (group, data->group, sizeof (group));
+    for (d = DEP_UNKNOWN + 1; d < NB_DEPS; ++d)
+    {
+        data->group[d].pkgs = NULL;
+    }
+
+    reset_classification (data);
+    t_idx = now_us ();
+    classify (data, false);
+    t_idx = now_us () - t_idx;
+    sort_groups (data);
+
+    for (i = data->deps, n = 0; i; i = i->next, ++n)
+    {
+        pkg_t *p = i->data;
+
+        if (p->dep != deps[n])
+        {
+            ++diff;
+            if (verbose)
+            {
+                fprintf (stderr, "Engines differ: %s is %s (reference) vs %s (indexed)\n",
+                        p->name, names[deps[n]], names[p->dep]);
+            }
+        }
+    }
+    for (d = DEP_UNKNOWN + 1; d < NB_DEPS; ++d)
+    {
+        if (group[d].size != data->group[d].size
+                || group[d].size_local != data->group[d].size_local)
+        {
+            ++diff;
+            if (verbose)
+            {
+                fprintf (stderr, "Engines differ: size of %s dependencies is %lld/%lld (reference) vs %lld/%lld (indexed)\n",
+                        names[d],
+                        (long long) group[d].size, (long long) group[d].size_local,
+                        (long long) data->group[d].size,
+                        (long long) data->group[d].size_local);
+            }
+        }
+        for (i = group[d].pkgs, j = data->group[d].pkgs;
+                i || j;
+                i = (i) ? i->next : NULL, j = (j) ? j->next : NULL)
+        {
+            if (!i || !j || i->data != j->data)
+            {
+                ++diff;
+                if (verbose)
+                {
+                    fprintf (stderr, "Engines differ: list of %s dependencies\n",
+                            names[d]);
+                }
+                break;
+            }
+        }
+        alpm_list_free (group[d].pkgs);
+    }
+    free (deps);
+
+    if (verbose)
+    {
+        fprintf (stderr, "Engines: reference %lld us, indexed %lld us, %u difference(s)\n",
+                t_ref, t_idx, diff);
+    }
+    data->engines_diff = diff;
+    data->engines_us[0] = t_ref;
+    data->engines_us[1] = t_idx;
+    return diff;
+}
+#endif /* PACDEP_ENGINES */
+
+/* process all package names, and sort out all dependencies into data. Returns
+ * E_NOTHING if no package could be found */
+static int
+analyse (data_t *data, alpm_list_t *names)
+{
+    alpm_list_t *patterns = NULL;
+    alpm_list_t *i;
+    long long    t;
+
+    data->rev_start = now_us ();
+    FOR_LIST (i, names)
+    {
+        if (is_pattern (i->data))
+        {
+            patterns = alpm_list_add (patterns, i->data);
+            continue;
+        }
+        t = trace_begin ();
+        preprocess_package (data, i->data);
+        trace_end ("preprocess_package", i->data, t);
+    }
+    if (patterns)
+    {
+        t = trace_begin ();
+        preprocess_patterns (data, patterns);
+        trace_end ("preprocess_patterns", NULL, t);
+        alpm_list_free (patterns);
+    }
+
+    if (!data->pkgs)
+    {
+        return E_NOTHING;
+    }
+
+    if (config.reverse)
+    {
+        debug ("create list of requirers\n");
+        t = trace_begin ();
+        get_requiredby (data);
+        trace_end ("get_requiredby", NULL, t);
+    }
+
+    FOR_LIST (i, data->pkgs)
+    {
+        pkg_t *pkg = i->data;
+
+        pkg->is_provided = (strcmp (pkg->name_asked, pkg->name) != 0);
+        if (config.reverse && config.show_optional)
+        {
+            get_pkg_optrequiredby (data, pkg);
+        }
+        /* put the package size under DEP_UNKNOWN (not used otherwise) */
+        data->group[DEP_UNKNOWN].size_local += pkg->pkg->isize;
+    }
+
+    /* all packages and their deps are known. time to "sort" everything
+     * (--hook=install only needs to know what they are) */
+    if (!config.reverse && config.hook != HOOK_INSTALL)
+    {
+        t = trace_begin ();
+#ifdef PACDEP_ENGINES
+        if (config.compare_engines)
+        {
+            compare_engines (data, config.fuzz_rounds == 0);
+        }
+        else
+#endif
+        {
+            classify (data, true);
+        }
+        trace_end ("classify", NULL, t);
+    }
+
+    t = trace_begin ();
+    sort_groups (data);
+    trace_end ("sort_groups", NULL, t);
+
+    /* package size doesn't apply in reverse, or with SCE_MIXED */
+    if (!config.reverse && data->source != SCE_MIXED)
+    {
+        /* pkg size + exclusive & optional deps of its kind (local/sync) */
+        data->group[DEP_UNKNOWN].size = data->group[DEP_EXCLUSIVE].size_local
+            + data->group[DEP_EXCLUSIVE_EXPLICIT].size_local
+            + data->group[DEP_OPTIONAL].size_local
+            + data->group[DEP_OPTIONAL_EXPLICIT].size_local;
+        if (data->source == SCE_SYNC)
+        {
+            data->group[DEP_UNKNOWN].size *= -1;
+            data->group[DEP_UNKNOWN].size += data->group[DEP_EXCLUSIVE].size
+                + data->group[DEP_EXCLUSIVE_EXPLICIT].size
+                + data->group[DEP_OPTIONAL].size
+                + data->group[DEP_OPTIONAL_EXPLICIT].size;
+        }
+        data->group[DEP_UNKNOWN].size += data->group[DEP_UNKNOWN].size_local;
+    }
+
+    if (config.attribute)
+    {
+        t = trace_begin ();
+        attribute_sizes (data);
+        trace_end ("attribute_sizes", NULL, t);
+    }
+
+    return E_OK;
+}
+
+#ifdef PACDEP_ENGINES
+/* --fuzz-engines: random graphs (with cycles, provisions, optional deps and
+ * explicitly installed packages) on which to compare both engines */
+#define FUZZ_MAX_PKGS           32
+#define FUZZ_MAX_DEPS           4
+#define FUZZ_MAX_NAMES          3
+#define FUZZ_VIRTUAL            0x100   /* dep on what pkg provides */
+
+typedef struct _fuzz_pkg_t {
+    off_t            isize;
+    unsigned int     deps[FUZZ_MAX_DEPS];
+    unsigned int     nb_deps;
+    unsigned int     optdeps[FUZZ_MAX_DEPS];
+    unsigned int     nb_optdeps;
+    unsigned int     is_explicit : 1;
+    unsigned int     has_provision : 1;
+    unsigned int     is_removed : 1;
+} fuzz_pkg_t;
+
+typedef struct _fuzz_t {
+    fuzz_pkg_t       pkgs[FUZZ_MAX_PKGS];
+    unsigned int     nb_pkgs;
+    unsigned int     names[FUZZ_MAX_NAMES];
+    unsigned int     nb_names;
+    unsigned int     explicit : 1;
+    unsigned int     show_optional : 2;
+} fuzz_t;
+
+/* xorshift64*, so a seed always gives the same graphs. state must not be 0,
+ * as it would stay so */
+static unsigned int
+fuzz_rand (unsigned long long *state, unsigned int max)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return (unsigned int) ((*state * 2685821657736338717ULL) >> 33) % max;
+}
+
+static void
+fuzz_generate (fuzz_t *fuzz, unsigned long long *state)
+{
+    unsigned int n, k;
+
+    memset (fuzz, 0, sizeof (*fuzz));
+    fuzz->nb_pkgs = 2 + fuzz_rand (state, FUZZ_MAX_PKGS - 1);
+    for (n = 0; n < fuzz->nb_pkgs; ++n)
+    {
+        fuzz->pkgs[n].has_provision = (fuzz_rand (state, 4) == 0);
+    }
+    for (n = 0; n < fuzz->nb_pkgs; ++n)
+    {
+        fuzz_pkg_t *pkg = &fuzz->pkgs[n];
+
+        pkg->isize = (off_t) (1 + fuzz_rand (state, 1000)) * 1024;
+        pkg->is_explicit = (fuzz_rand (state, 3) == 0);
+        pkg->nb_deps = fuzz_rand (state, FUZZ_MAX_DEPS + 1);
+        for (k = 0; k < pkg->nb_deps; ++k)
+        {
+            unsigned int d = fuzz_rand (state, fuzz->nb_pkgs);
+
+            if (d == n)
+            {
+                d = (d + 1) % fuzz->nb_pkgs;
+            }
+            if (fuzz->pkgs[d].has_provision && fuzz_rand (state, 2))
+            {
+                d |= FUZZ_VIRTUAL;
+            }
+            pkg->deps[k] = d;
+        }
+        pkg->nb_optdeps = fuzz_rand (state, 3);
+        for (k = 0; k < pkg->nb_optdeps; ++k)
+        {
+            pkg->optdeps[k] = fuzz_rand (state, fuzz->nb_pkgs);
+        }
+    }
+    fuzz->nb_names = 1 + fuzz_rand (state, FUZZ_MAX_NAMES);
+    for (k = 0; k < fuzz->nb_names; ++k)
+    {
+        fuzz->names[k] = fuzz_rand (state, fuzz->nb_pkgs);
+    }
+    fuzz->explicit = (fuzz_rand (state, 2) == 1);
+    fuzz->show_optional = fuzz_rand (state, 4) & 3;
+}
+
+static void
+fuzz_write_deps (FILE *fp, fuzz_t *fuzz, unsigned int *deps, unsigned int nb)
+{
+    const char  *sep = "";
+    unsigned int k;
+
+    for (k = 0; k < nb; ++k)
+    {
+        unsigned int d = deps[k] & ~(unsigned int) FUZZ_VIRTUAL;
+
+        if (!fuzz->pkgs[d].is_removed)
+        {
+            fprintf (fp, "%s%c%u", sep, (deps[k] & FUZZ_VIRTUAL) ? 'v' : 'p', d);
+            sep = " ";
+        }
+    }
+}
+
+/* the graph as a snapshot, with (as comment) the command to run on it */
+static void
+fuzz_write_snapshot (FILE *fp, fuzz_t *fuzz)
+{
+    unsigned int n;
+
+    fputs (SNAPSHOT_HEADER "\n", fp);
+    fprintf (fp, "# pacdep --snapshot=FILE --compare-engines -es%s%s%s%s",
+            (fuzz->explicit) ? "ES" : "",
+            (fuzz->show_optional) ? "o" : "",
+            (fuzz->show_optional && fuzz->explicit) ? "O" : "",
+            (fuzz->show_optional == 3) ? "ppp"
+            : (fuzz->show_optional == 2) ? "pp" : "");
+    for (n = 0; n < fuzz->nb_names; ++n)
+    {
+        fprintf (fp, " p%u", fuzz->names[n]);
+    }
+    fputc ('\n', fp);
+
+    for (n = 0; n < fuzz->nb_pkgs; ++n)
+    {
+        fuzz_pkg_t *pkg = &fuzz->pkgs[n];
+
+        if (pkg->is_removed)
+        {
+            continue;
+        }
+        fprintf (fp, "p%u\t1-1\t%lld\t%c\t",
+                n, (long long) pkg->isize, (pkg->is_explicit) ? 'e' : 'd');
+        fuzz_write_deps (fp, fuzz, pkg->deps, pkg->nb_deps);
+        fputc ('\t', fp);
+        fuzz_write_deps (fp, fuzz, pkg->optdeps, pkg->nb_optdeps);
+        fputc ('\t', fp);
+        if (pkg->has_provision)
+        {
+            fprintf (fp, "v%u", n);
+        }
+        fputc ('\n', fp);
+    }
+}
+
+/* analyses the graph, comparing both engines. Returns the number of
+ * differences, adding how long each engine took to us (if not NULL) */
+static unsigned int
+fuzz_run (fuzz_t *fuzz, long long *us)
+{
+    char         names[FUZZ_MAX_NAMES][16];
+    alpm_list_t *list = NULL;
+    pkgdb_t     *pkgdb;
+    data_t       data;
+    char        *buf = NULL;
+    char        *error;
+    size_t       len = 0;
+    unsigned int n;
+    unsigned int diff = 0;
+    FILE        *fp;
+    int          rc;
+
+    fp = open_memstream (&buf, &len);
+    if (!fp)
+    {
+        return 0;
+    }
+    fuzz_write_snapshot (fp, fuzz);
+    fclose (fp);
+    fp = fmemopen (buf, len, "r");
+    if (!fp)
+    {
+        free (buf);
+        return 0;
+    }
+    rc = load_snapshot_fp (fp, "fuzz", &pkgdb, &error);
+    fclose (fp);
+    free (buf);
+    if (rc != E_OK)
+    {
+        fprintf (stderr, "Error: %s", error);
+        free (error);
+        return 0;
+    }
+
+    config.explicit = fuzz->explicit;
+    config.show_optional = fuzz->show_optional & 3;
+    config.list_exclusive_explicit = fuzz->explicit;
+    config.list_shared_explicit = fuzz->explicit;
+    config.list_optional = (fuzz->show_optional > 0);
+    config.list_optional_explicit = (fuzz->show_optional > 0 && fuzz->explicit);
+    for (n = 0; n < fuzz->nb_names; ++n)
+    {
+        snprintf (names[n], sizeof (names[n]), "p%u", fuzz->names[n]);
+        list = alpm_list_add (list, names[n]);
+    }
+
+    init_data (&data, pkgdb, NULL);
+    if (analyse (&data, list) == E_OK)
+    {
+        diff = data.engines_diff;
+        if (us)
+        {
+            us[0] += data.engines_us[0];
+            us[1] += data.engines_us[1];
+        }
+    }
+    free_data (&data);
+    alpm_list_free (list);
+    return diff;
+}
+
+/* removes packages & dependencies from the graph, as long as the engines
+ * still differ on it */
+static void
+fuzz_minimize (fuzz_t *fuzz)
+{
+    bool changed;
+
+    do
+    {
+        unsigned int n, k;
+
+        changed = false;
+        for (n = fuzz->nb_pkgs; n > 0; --n)
+        {
+            fuzz_pkg_t *pkg = &fuzz->pkgs[n - 1];
+            bool        is_name = false;
+
+            for (k = 0; k < fuzz->nb_names; ++k)
+            {
+                is_name = is_name || fuzz->names[k] == n - 1;
+            }
+            if (pkg->is_removed || is_name)
+            {
+                continue;
+            }
+            pkg->is_removed = true;
+            if (fuzz_run (fuzz, NULL) > 0)
+            {
+                changed = true;
+            }
+            else
+            {
+                pkg->is_removed = false;
+            }
+        }
+
+        for (n = 0; n < fuzz->nb_pkgs; ++n)
+        {
+            fuzz_pkg_t *pkg = &fuzz->pkgs[n];
+
+            for (k = pkg->nb_deps; !pkg->is_removed && k > 0; --k)
+            {
+                unsigned int d = pkg->deps[k - 1];
+
+                memmove (&pkg->deps[k - 1], &pkg->deps[k],
+                        sizeof (*pkg->deps) * (pkg->nb_deps - k));
+                --pkg->nb_deps;
+                if (fuzz_run (fuzz, NULL) > 0)
+                {
+                    changed = true;
+                    continue;
+                }
+                memmove (&pkg->deps[k], &pkg->deps[k - 1],
+                        sizeof (*pkg->deps) * (pkg->nb_deps - k + 1));
+                pkg->deps[k - 1] = d;
+                ++pkg->nb_deps;
+            }
+            for (k = pkg->nb_optdeps; !pkg->is_removed && k > 0; --k)
+            {
+                unsigned int d = pkg->optdeps[k - 1];
+
+                memmove (&pkg->optdeps[k - 1], &pkg->optdeps[k],
+                        sizeof (*pkg->optdeps) * (pkg->nb_optdeps - k));
+                --pkg->nb_optdeps;
+                if (fuzz_run (fuzz, NULL) > 0)
+                {
+                    changed = true;
+                    continue;
+                }
+                memmove (&pkg->optdeps[k], &pkg->optdeps[k - 1],
+                        sizeof (*pkg->optdeps) * (pkg->nb_optdeps - k + 1));
+                pkg->optdeps[k - 1] = d;
+                ++pkg->nb_optdeps;
+            }
+        }
+    } while (changed);
+}
+
+/* compares both engines on rounds random graphs. On the first difference,
+ * the graph is minimized and written (as a snapshot) on stdout */
+static int
+fuzz_engines (unsigned int rounds, unsigned long long seed)
+{
+    fuzz_t              fuzz;
+    unsigned long long  state = seed;
+    long long           us[2] = { 0, 0 };
+    unsigned int        r;
+
+    config.compare_engines = true;
+    config.list_exclusive = true;
+    config.list_shared = true;
+    for (r = 1; r <= rounds; ++r)
+    {
+        fuzz_generate (&fuzz, &state);
+        if (fuzz_run (&fuzz, us) == 0)
+        {
+            continue;
+        }
+
+        fprintf (stderr, "Engines differ on round %u (seed %llu), minimizing...\n",
+                r, seed);
+        fuzz_minimize (&fuzz);
+        fuzz_write_snapshot (stdout, &fuzz);
+        return E_MISMATCH;
+    }
+    fprintf (stderr, "%u rounds (seed %llu): reference %lld us, indexed %lld us\n",
+            rounds, seed, us[0], us[1]);
+    return E_OK;
+}
+#endif /* PACDEP_ENGINES */
+
+/* --attribute: what each main package accounts for, once the size of every
+ * dependency was split among those needing it */
+static void
+print_attribution (data_t *data, int len_max)
+{
+    alpm_list_t *i;
+
+    if (!config.quiet)
+    {
+        fprintf (config.out, "Attributed sizes (%s split of shared dependencies):\n",
+                (config.attribute == ATTRIBUTE_EVEN) ? "even" : "weighted");
+    }
+    FOR_LIST (i, data->pkgs)
+    {
+        pkg_t *pkg = i->data;
+
+        if (config.quiet)
+        {
+            fprintf (config.out, "%s ", pkg->name);
+            print_size (pkg->size_attributed);
+            fputc ('\n', config.out);
+            continue;
+        }
+        fprintf (config.out, " %*s", -len_max, pkg->name);
+        print_size (pkg->size_attributed);
+        fputs (" (own: ", config.out);
+        print_size (pkg->size_own);
+        fputs (", shared: ", config.out);
+        print_size (pkg->size_attributed - pkg->size_own);
+        fputs (")\n", config.out);
+    }
+    if (!config.quiet && data->nb_outside > 0)
+    {
+        fprintf (config.out, " %*s", -len_max, "(outside)");
+        print_size (data->size_outside);
+        fprintf (config.out, " (shared with %zu installed package%s)\n",
+                data->nb_outside, (data->nb_outside > 1) ? "s" : "");
+    }
+}
+
+/* --explain: why a dependency is shared, i.e. paths from installed packages
+ * outside our tree to it. A breadth-first search over requirers (from the
+ * dependency up), so each outside package is found through a shortest path,
+ * only going through packages in our tree (but not main ones), and stopping
+ * after EXPLAIN_MAX_PATHS paths or EXPLAIN_MAX_DEPTH levels */
+#define EXPLAIN_MAX_PATHS       20
+#define EXPLAIN_MAX_DEPTH       8
+
+static void
+print_explain (data_t *data)
+{
+    const char  *dep_names[NB_DEPS] = { "unknown", "exclusive", "exclusive explicit",
+        "shared", "shared explicit", "optional", "optional explicit" };
+    pkgdb_t     *localdb = data->localdb->data;
+    alpm_list_t *l;
+    pkg_t       *pkg = NULL;
+    size_t      *parent = NULL;     /* local package -> requiree + 1 */
+    size_t      *queue = NULL;
+    int         *depth = NULL;
+    size_t       head = 0, tail = 0;
+    size_t       nb_paths = 0;
+    size_t       start;
+    bool         is_stopped = false;
+
+    index_deps (data);
+    FOR_LIST (l, nameidx_get (&data->deps_by_name, str_lookup (config.explain)))
+    {
+        if (!((pkg_t *) l->data)->repo)
+        {
+            pkg = l->data;
+        }
+    }
+    if (!pkg)
+    {
+        fprintf (stderr, "%s is not an installed package in the tree\n", config.explain);
+        return;
+    }
+    if (!config.quiet)
+    {
+        fprintf (config.out, "\nWhy %s is %s:\n", pkg->name,
+                (pkg->is_main) ? "specified" : dep_names[pkg->dep]);
+    }
+
+    parent = calloc (localdb->nb_pkgs + 1, sizeof (*parent));
+    queue = malloc (sizeof (*queue) * (localdb->nb_pkgs + 1));
+    depth = malloc (sizeof (*depth) * (localdb->nb_pkgs + 1));
+    if (!parent || !queue || !depth)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        goto done;
+    }
+
+    start = (size_t) (pkg->pkg - localdb->pkgs);
+    parent[start] = start + 1;
+    queue[tail] = start;
+    depth[tail++] = 0;
+    while (head < tail && !is_stopped)
+    {
+        size_t       n = queue[head];
+        int          d = depth[head++];
+        alpm_list_t *reqs, *i;
+
+        if (d >= EXPLAIN_MAX_DEPTH)
+        {
+            is_stopped = true;
+            break;
+        }
+        reqs = compute_requiredby (data, &localdb->pkgs[n]);
+        FOR_LIST (i, reqs)
+        {
+            pkginfo_t *r = i->data;
+            size_t     k = (size_t) (r - localdb->pkgs);
+            size_t     p;
+
+            if (parent[k])
+            {
+                continue;
+            }
+            parent[k] = n + 1;
+            l = nameidx_get (&data->deps_by_name, r->name_id);
+            if (l)
+            {
+                /* in our tree: keep going, unless it's a main package */
+                if (!((pkg_t *) l->data)->is_main)
+                {
+                    queue[tail] = k;
+                    depth[tail++] = d + 1;
+                }
+                continue;
+            }
+
+            if (nb_paths == EXPLAIN_MAX_PATHS)
+            {
+                is_stopped = true;
+                break;
+            }
+            ++nb_paths;
+            fputs ((config.quiet) ? "" : " ", config.out);
+            for (p = k; ; p = parent[p] - 1)
+            {
+                fputs (localdb->pkgs[p].name, config.out);
+                if (p == start)
+                {
+                    break;
+                }
+                fputs ((config.quiet) ? " " : " -> ", config.out);
+            }
+            fputc ('\n', config.out);
+        }
+        alpm_list_free (reqs);
+    }
+
+    if (nb_paths == 0 && !is_stopped && !config.quiet)
+    {
+        fputs (" not required by anything installed outside the tree\n", config.out);
+    }
+    if (is_stopped && config.quiet)
+    {
+        fprintf (stderr, "Warning: partial results, stopped after %zu paths\n",
+                nb_paths);
+    }
+    else if (is_stopped)
+    {
+        fprintf (config.out, " (partial: stopped after %zu paths, at depth %d)\n",
+                nb_paths, (nb_paths == EXPLAIN_MAX_PATHS) ? depth[head - 1] : EXPLAIN_MAX_DEPTH);
+    }
+
+done:
+    free (parent);
+    free (queue);
+    free (depth);
+}
+
+static void
+print_data (data_t *data)
+{
+    alpm_list_t *i;
+    int len_max = 0;
+    int len;
+
+    if (!config.quiet)
+    {
+        data->group[DEP_UNKNOWN].title            = "Total dependencies:";
+        data->group[DEP_EXCLUSIVE].title          = "Exclusive dependencies:";
+        data->group[DEP_EXCLUSIVE_EXPLICIT].title = "Exclusive explicit dependencies:";
+        data->group[DEP_OPTIONAL].title           = "Optional dependencies:";
+        data->group[DEP_OPTIONAL_EXPLICIT].title  = "Optional explicit dependencies:";
+        data->group[DEP_SHARED].title             = "Shared dependencies:";
+        data->group[DEP_SHARED_EXPLICIT].title    = "Shared explicit dependencies:";
+        if (config.reverse)
+        {
+            data->group[DEP_EXCLUSIVE].title      = "Required by:";
+            data->group[DEP_OPTIONAL].title       = "Optionally required by:";
+        }
+
+        len = (int) strlen (data->group[DEP_UNKNOWN].title) + 1;
+        len_max = len;
+
+        const char **t, *titles[] = { data->group[DEP_EXCLUSIVE].title,
+            data->group[DEP_EXCLUSIVE_EXPLICIT].title,
+            data->group[DEP_OPTIONAL].title,
+            data->group[DEP_OPTIONAL_EXPLICIT].title,
+            data->group[DEP_SHARED].title,
+            data->group[DEP_SHARED_EXPLICIT].title,
+            NULL
+        };
+        for (t = titles; *t; ++t)
+        {
+            if (config.reverse && t == titles + 3)
+            {
+                break;
+            }
+            if ((t - titles) % 2 && !config.explicit)
+            {
+                continue;
+            }
+            len = (int) strlen (*t) + 1;
+            if (len > len_max)
+            {
+                len_max = len;
+            }
+        }
+    }
+
+    FOR_LIST (i, data->pkgs)
+    {
+        pkg_t *pkg = i->data;
+
+        if (!config.quiet)
+        {
+            /* calculate len_max to show package name (/w repo/provided if apply) */
+            if (!pkg->is_provided)
+            {
+                len = (int) strlen (pkg->name_asked) + 1;
+            }
+            else
+            {
+                len = (int) strlen (pkg->name) + 1;
+                /* 16 == strlen (" is provided by ") */
+                len += (int) strlen (pkg->name_asked) + 16;
+            }
+            if (pkg->repo)
+            {
+                /* +1 for the / */
+                len += 1 + (int) strlen (pkg->repo);
+            }
+            if (len > len_max)
+            {
+                len_max = len;
+            }
+        }
+    }
+
+    off_t size_exclusive = data->group[DEP_EXCLUSIVE].size
+        + data->group[DEP_EXCLUSIVE_EXPLICIT].size;
+    off_t size_shared = data->group[DEP_SHARED].size
+        + data->group[DEP_SHARED_EXPLICIT].size;
+    off_t size_optional = data->group[DEP_OPTIONAL].size
+        + data->group[DEP_OPTIONAL_EXPLICIT].size;
+
+    int nb_pkg = (int) alpm_list_count (data->pkgs);
+    FOR_LIST (i, data->pkgs)
+    {
+        pkg_t *pkg = i->data;
+
+        if (pkg->repo)
+        {
+            if (!pkg->is_provided)
+            {
+                fprintf (config.out, "%s/%*s",
+                        pkg->repo,
+                        -len_max + (int) strlen (pkg->repo) + 1,
+                        pkg->name_asked);
+            }
+            else
+            {
+                if (config.quiet)
+                {
+                    fprintf (config.out, "%s %s/%s",
+                            pkg->name_asked,
+                            pkg->repo,
+                            pkg->name);
+                }
+                else
+                {
+                    fprintf (config.out, "%s is provided by %s/%*s",
+                            pkg->name_asked,
+                            pkg->repo,
+                            -len_max + (int) strlen (pkg->name_asked) + 16
+                                + (int) strlen (pkg->repo) + 1,
+                            pkg->name);
+                }
+            }
+        }
+        else if (!pkg->is_provided)
+        {
+            fprintf (config.out, "%*s", -len_max, pkg->name_asked);
+        }
+        else
+        {
+            if (config.quiet)
+            {
+                fprintf (config.out, "%s %s",
+                        pkg->name_asked,
+                        pkg->name);
+            }
+            else
+            {
+                fprintf (config.out, "%s is provided by %*s",
+                        pkg->name_asked,
+                        -len_max + (int) strlen (pkg->name_asked) + 16,
+                        pkg->name);
+            }
+        }
+        if (config.quiet)
+        {
+            fputc (' ', config.out);
+        }
+        print_size (pkg->pkg->isize);
+        print_sizes_extra (data, pkg->has_actual, pkg->size_actual,
+                pkg->has_download, pkg->size_download);
+
+        /* more than one pkg, no package size -- it'll be on a new line, since
+         * it's a combined size for all packages.
+         * In quiet or reverse mode, no package size either. */
+        if (nb_pkg > 1 || config.quiet || config.reverse)
+        {
+            fputc ('\n', config.out);
+        }
+    }
+
+    /* package size doesn't apply in quiet, reverse, or with SCE_MIXED */
+    if (!config.quiet && !config.reverse && data->source != SCE_MIXED)
+    {
+        if (nb_pkg > 1)
+        {
+            fprintf (config.out, "%*s", -len_max, "");
+            print_size (data->group[DEP_UNKNOWN].size_local);
+            print_sizes_extra (data, true, data->group[DEP_UNKNOWN].size_actual,
+                    true, data->group[DEP_UNKNOWN].size_download);
+        }
+
+        if (data->group[DEP_UNKNOWN].size > data->group[DEP_UNKNOWN].size_local)
+        {
+            fputs (" (", config.out);
+            print_size (data->group[DEP_UNKNOWN].size);
+            fputs (")\n", config.out);
+        }
+        else
+        {
+            fputc ('\n', config.out);
+        }
+    }
+
+    /* exclusive deps */
+    print_group (data,
+            DEP_EXCLUSIVE,
+            len_max,
+            size_exclusive,
+            config.list_exclusive,
+            config.list_exclusive_explicit);
+
+    if (config.show_optional)
+    {
+        /* optional deps */
+        print_group (data,
+                DEP_OPTIONAL,
+                len_max,
+                size_optional,
+                config.list_optional,
+                config.list_optional_explicit);
+    }
+
+    if (!config.reverse)
+    {
+        /* shared deps */
+        print_group (data,
+                DEP_SHARED,
+                len_max,
+                size_shared,
+                config.list_shared,
+                config.list_shared_explicit);
+    }
+
+    if (data->rev_stopped)
+    {
+        if (config.quiet)
+        {
+            fprintf (stderr, "Warning: partial results, stopped at depth %d (%s)\n",
+                    data->rev_depth, data->rev_stopped);
+        }
+        else
+        {
+            fprintf (config.out, "%*s%d (partial: %s)\n",
+                    -len_max, "Depth reached:",
+                    data->rev_depth, data->rev_stopped);
+        }
+    }
+
+    if (!config.quiet)
+    {
+        /* total deps */
+        fprintf (config.out, "%*s", -len_max, data->group[DEP_UNKNOWN].title);
+        print_size (size_exclusive + size_shared + size_optional);
+        if (data->has_actual || data->has_download)
+        {
+            int d;
+            off_t size_actual = 0;
+            off_t size_download = 0;
+
+            for (d = DEP_UNKNOWN + 1; d < NB_DEPS; ++d)
+            {
+                size_actual += data->group[d].size_actual;
+                size_download += data->group[d].size_download;
+            }
+            print_sizes_extra (data, true, size_actual, true, size_download);
+        }
+        fputs (" (", config.out);
+        print_size (data->group[DEP_UNKNOWN].size_local
+                + size_exclusive
+                + size_shared
+                + size_optional);
+        fputs (")\n", config.out);
+    }
+
+    if (config.attribute)
+    {
+        print_attribution (data, len_max);
+    }
+    if (config.explain)
+    {
+        print_explain (data);
+    }
+}
+
+static void
+print_json_pkg (data_t *data, pkg_t *pkg)
+{
+    FILE *fp = config.out;
+
+    fputs ("{\"name\":", fp);
+    write_json_str (fp, pkg->name);
+    fputs (",\"repo\":", fp);
+    if (pkg->repo)
+    {
+        write_json_str (fp, pkg->repo);
+    }
+    else
+    {
+        fputs ("null", fp);
+    }
+    fprintf (fp, ",\"size\":%lld", (long long) pkg->pkg->isize);
+    if (data->has_actual && pkg->has_actual)
+    {
+        fprintf (fp, ",\"size_actual\":%lld", (long long) pkg->size_actual);
+    }
+    if (data->has_download && pkg->has_download)
+    {
+        fprintf (fp, ",\"size_download\":%lld", (long long) pkg->size_download);
+    }
+    if (pkg->is_main && pkg->is_provided)
+    {
+        fputs (",\"provides\":", fp);
+        write_json_str (fp, pkg->name_asked);
+    }
+    else if (!pkg->is_main && pkg->provision)
+    {
+        fputs (",\"provides\":", fp);
+        write_json_str (fp, pkg->provision);
+    }
+    if (!pkg->is_main && pkg->req_by)
+    {
+        pkg_t *d;
+
+        fputs (",\"path\":[", fp);
+        for (d = pkg->req_by; d; d = d->req_by)
+        {
+            write_json_str (fp, d->name);
+            if (d->req_by)
+            {
+                fputc (',', fp);
+            }
+        }
+        fputc (']', fp);
+    }
+    fputc ('}', fp);
+}
+
+/* --output=json: what print_data() shows, as a JSON object (sizes in bytes).
+ * root is the path of the system analysed, if from --root/--snapshot */
+static void
+print_json (data_t *data, const char *root)
+{
+    FILE        *fp = config.out;
+    alpm_list_t *i;
+    off_t        size_deps = 0;
+    dep_t        d;
+    bool         listed[NB_DEPS] = { false,
+        config.list_exclusive, config.list_exclusive_explicit,
+        config.list_shared, config.list_shared_explicit,
+        config.list_optional, config.list_optional_explicit };
+    const char  *keys[NB_DEPS] = { NULL,
+        (config.reverse) ? "required_by" : "exclusive", "exclusive_explicit",
+        "shared", "shared_explicit",
+        (config.reverse) ? "optionally_required_by" : "optional",
+        "optional_explicit" };
+
+    fputc ('{', fp);
+    if (root)
+    {
+        fputs ("\"root\":", fp);
+        write_json_str (fp, root);
+        fputc (',', fp);
+    }
+    fputs ("\"packages\":[", fp);
+    FOR_LIST (i, data->pkgs)
+    {
+        print_json_pkg (data, i->data);
+        if (i->next)
+        {
+            fputc (',', fp);
+        }
+    }
+    fputs ("],\"groups\":{", fp);
+    for (d = DEP_UNKNOWN + 1; d < NB_DEPS; ++d)
+    {
+        /* same groups as print_data() */
+        if (((d == DEP_OPTIONAL || d == DEP_OPTIONAL_EXPLICIT) && !config.show_optional)
+                || ((d == DEP_SHARED || d == DEP_SHARED_EXPLICIT) && config.reverse)
+                || ((d - DEP_EXCLUSIVE) % 2 && !config.explicit))
+        {
+            continue;
+        }
+        size_deps += data->group[d].size;
+        fprintf (fp, "%s\"%s\":{\"size\":%lld,\"size_local\":%lld",
+                (d > DEP_EXCLUSIVE) ? "," : "", keys[d],
+                (long long) data->group[d].size,
+                (long long) data->group[d].size_local);
+        if (data->has_actual)
+        {
+            fprintf (fp, ",\"size_actual\":%lld",
+                    (long long) data->group[d].size_actual);
+        }
+        if (data->has_download)
+        {
+            fprintf (fp, ",\"size_download\":%lld",
+                    (long long) data->group[d].size_download);
+        }
+        if (listed[d])
+        {
+            fputs (",\"packages\":[", fp);
+            FOR_LIST (i, data->group[d].pkgs)
+            {
+                print_json_pkg (data, i->data);
+                if (i->next)
+                {
+                    fputc (',', fp);
+                }
+            }
+            fputc (']', fp);
+        }
+        fputc ('}', fp);
+    }
+    fprintf (fp, "},\"size\":%lld,\"size_deps\":%lld",
+            (long long) data->group[DEP_UNKNOWN].size_local,
+            (long long) size_deps);
+    if (data->rev_stopped)
+    {
+        fprintf (fp, ",\"partial\":{\"depth\":%d,\"reason\":", data->rev_depth);
+        write_json_str (fp, data->rev_stopped);
+        fputc ('}', fp);
+    }
+    if (config.attribute)
+    {
+        fprintf (fp, ",\"attribution\":{\"policy\":\"%s\",\"packages\":[",
+                (config.attribute == ATTRIBUTE_EVEN) ? "even" : "weighted");
+        FOR_LIST (i, data->pkgs)
+        {
+            pkg_t *pkg = i->data;
+
+            fputs ("{\"name\":", fp);
+            write_json_str (fp, pkg->name);
+            fprintf (fp, ",\"size\":%lld,\"own\":%lld}%s",
+                    (long long) pkg->size_attributed,
+                    (long long) pkg->size_own,
+                    (i->next) ? "," : "");
+        }
+        fprintf (fp, "],\"outside\":{\"size\":%lld,\"packages\":%zu}}",
+                (long long) data->size_outside, data->nb_outside);
+    }
+    fputc ('}', fp);
+}
+
+/* --hook: run from a PreTransaction hook, with the targets on stdin. Only
+ * what's needed is loaded (the local db to remove, plus only the targets from
+ * sync dbs to install, since all packages of the transaction are), and what
+ * it frees/costs is printed in a few lines.
+ * Since pacman waits for it, how long each phase took is reported when over
+ * HOOK_BUDGET_MS */
+#define HOOK_BUDGET_MS          50
+
+static int
+run_hook (data_t *data, alpm_list_t *names, long long startup_us)
+{
+    pkgdb_t     *localdb = data->localdb->data;
+    nameidx_t    targets;
+    alpm_list_t *i;
+    off_t        size = 0;
+    off_t        size_deps = 0;
+    size_t       nb = 0;
+    size_t       nb_deps = 0;
+    size_t       nb_upgrades = 0;
+    long long    analysis_us, output_us;
+    long long    t;
+    int          rc;
+
+    t = now_us ();
+    memset (&targets, 0, sizeof (targets));
+    if (config.hook == HOOK_INSTALL)
+    {
+        FOR_LIST (i, names)
+        {
+            str_t id = str_intern (i->data);
+
+            if (!id || !nameidx_add (&targets, id, i->data))
+            {
+                fprintf (stderr, "Error: out of memory\n");
+                free_nameidx (&targets);
+                return E_NOMEM;
+            }
+        }
+        FOR_LIST (i, config.syncdbs)
+        {
+            ((pkgdb_t *) i->data)->only = &targets;
+        }
+    }
+    rc = analyse (data, names);
+    FOR_LIST (i, config.syncdbs)
+    {
+        ((pkgdb_t *) i->data)->only = NULL;
+    }
+    free_nameidx (&targets);
+    analysis_us = now_us () - t;
+    if (rc == E_NOTHING)
+    {
+        /* nothing pacdep knows of, e.g. only package files */
+        return E_OK;
+    }
+
+    t = now_us ();
+    if (config.hook == HOOK_REMOVE)
+    {
+        size = data->group[DEP_UNKNOWN].size_local;
+        nb = alpm_list_count (data->pkgs);
+        FOR_LIST (i, data->deps)
+        {
+            pkg_t *pkg = i->data;
+
+            if (!pkg->is_main && pkg->dep == DEP_EXCLUSIVE)
+            {
+                size_deps += pkg->pkg->isize;
+                ++nb_deps;
+            }
+        }
+
+        if (config.quiet)
+        {
+            fprintf (config.out, "remove %zu ", nb);
+            print_size (size);
+            fprintf (config.out, " %zu ", nb_deps);
+            print_size (size_deps);
+            fputc ('\n', config.out);
+        }
+        else
+        {
+            fputs ("Removal will free:       ", config.out);
+            print_size (size);
+            fprintf (config.out, " (%zu package%s)\n", nb, (nb > 1) ? "s" : "");
+            if (nb_deps > 0)
+            {
+                fputs ("Exclusive dependencies:  ", config.out);
+                print_size (size_deps);
+                fprintf (config.out, " (%zu more with pacman -Rs)\n", nb_deps);
+            }
+        }
+    }
+    else
+    {
+        /* whatever comes from a sync db is installed, replacing the installed
+         * version if any */
+        FOR_LIST (i, data->deps)
+        {
+            pkg_t     *pkg = i->data;
+            pkginfo_t *installed;
+
+            if (!pkg->repo)
+            {
+                continue;
+            }
+            installed = pkgdb_get_pkg (localdb, pkg->name_id);
+            if (pkg->is_main)
+            {
+                size += pkg->pkg->isize - ((installed) ? installed->isize : 0);
+                ++nb;
+                nb_upgrades += (installed != NULL);
+            }
+            else
+            {
+                size_deps += pkg->pkg->isize - ((installed) ? installed->isize : 0);
+                ++nb_deps;
+            }
+        }
+
+        if (config.quiet)
+        {
+            fprintf (config.out, "install %zu ", nb);
+            print_size (size);
+            fprintf (config.out, " %zu ", nb_deps);
+            print_size (size_deps);
+            fputc ('\n', config.out);
+        }
+        else
+        {
+            fputs ("Install will use:        ", config.out);
+            print_size (size);
+            fprintf (config.out, " (%zu package%s, %zu upgraded)\n",
+                    nb, (nb > 1) ? "s" : "", nb_upgrades);
+            if (nb_deps > 0)
+            {
+                fputs ("New dependencies:        ", config.out);
+                print_size (size_deps);
+                fprintf (config.out, " (%zu package%s)\n",
+                        nb_deps, (nb_deps > 1) ? "s" : "");
+            }
+        }
+    }
+    fflush (config.out);
+    output_us = now_us () - t;
+
+    debug ("hook: startup %lld us, analysis %lld us, output %lld us\n",
+            startup_us, analysis_us, output_us);
+    if (startup_us + analysis_us + output_us > HOOK_BUDGET_MS * 1000LL)
+    {
+        fprintf (stderr, "Warning: pacdep took %.1f ms (startup %.1f ms, analysis %.1f ms, output %.1f ms)\n",
+                (double) (startup_us + analysis_us + output_us) / 1000.0,
+                (double) startup_us / 1000.0,
+                (double) analysis_us / 1000.0,
+                (double) output_us / 1000.0);
+    }
+    return E_OK;
+}
+
+/* a system (from --root or --snapshot) analysed on its own, sharing the sync
+ * dbs */
+typedef struct _root_t {
+    const char      *path;
+    alpm_handle_t   *alpm;
+    data_t           data;
+    int              rc;
+    unsigned int     is_snapshot : 1;
+} root_t;
+
+typedef struct _roots_t {
+    root_t          *roots;
+    alpm_list_t     *names;
+} roots_t;
+
+/* sync dbs are shared by all roots, and used from different threads. Make sure
+ * everything that is loaded/built on demand is done beforehand, so they're
+ * then only read from */
+static void
+preload_syncdbs (void)
+{
+    debug ("preloading sync dbs\n");
+    load_pkgdbs (config.syncdbs);
+    get_provides (config.syncdbs, &config.provides_sync);
+    get_revdeps (config.syncdbs, &config.requiredby_sync);
+    if (config.reverse && config.show_optional)
+    {
+        get_optreqs (config.syncdbs, &config.optreqs_sync);
+    }
+}
+
+static void
+analyse_root (roots_t *ctx, size_t n)
+{
+    root_t     *root = &ctx->roots[n];
+    long long   t;
+
+    if (root->rc != E_OK)
+    {
+        return;
+    }
+    t = trace_begin ();
+    if (root->is_snapshot)
+    {
+        pkgdb_t *localdb;
+        char    *error;
+
+        root->rc = load_snapshot (root->path, &localdb, &error);
+        if (root->rc != E_OK)
+        {
+            fprintf (stderr, "Error: %s", error);
+            free (error);
+            return;
+        }
+        init_data (&root->data, localdb, root->path);
+    }
+    debug ("analysing root %s\n", root->path);
+    root->rc = analyse (&root->data, ctx->names);
+    free_data_indexes (&root->data);
+    trace_end ("analyse_root", root->path, t);
+}
+
+static void
+print_roots_summary (root_t *roots, size_t nb_roots, alpm_list_t *names)
+{
+    alpm_list_t *i;
+    size_t       n;
+    int          len_max = 0;
+
+    for (n = 0; n < nb_roots; ++n)
+    {
+        int len = (int) strlen (roots[n].path) + 1;
+
+        if (len > len_max)
+        {
+            len_max = len;
+        }
+    }
+
+    if (!config.quiet)
+    {
+        fputs ("Summary:\n", config.out);
+    }
+    FOR_LIST (i, names)
+    {
+        const char  *name = i->data;
+        pkg_t      **pkgs;
+        size_t       nb_found = 0;
+
+        /* what matches can differ from one root to another */
+        if (is_pattern (name))
+        {
+            continue;
+        }
+
+        pkgs = calloc (nb_roots, sizeof (*pkgs));
+        if (!pkgs)
+        {
+            fprintf (stderr, "Error: out of memory\n");
+            return;
+        }
+        for (n = 0; n < nb_roots; ++n)
+        {
+            alpm_list_t *j;
+
+            if (roots[n].rc != E_OK)
+            {
+                continue;
+            }
+            FOR_LIST (j, roots[n].data.pkgs)
+            {
+                pkg_t *pkg = j->data;
+
+                /* name_asked points to the name from our list */
+                if (pkg->name_asked == name)
+                {
+                    pkgs[n] = pkg;
+                    if (!pkg->repo)
+                    {
+                        ++nb_found;
+                    }
+                    break;
+                }
+            }
+        }
+
+        if (!config.quiet)
+        {
+            fprintf (config.out, "%s (installed in %u of %u roots)\n",
+                    name, (unsigned int) nb_found, (unsigned int) nb_roots);
+        }
+        for (n = 0; n < nb_roots; ++n)
+        {
+            pkg_t *pkg = pkgs[n];
+
+            if (config.quiet)
+            {
+                fprintf (config.out, "%s %s ", name, roots[n].path);
+            }
+            else
+            {
+                fprintf (config.out, " %*s", -len_max, roots[n].path);
+            }
+            if (!pkg)
+            {
+                fputs ("-\n", config.out);
+                continue;
+            }
+            if (pkg->repo)
+            {
+                fprintf (config.out, "%s/", pkg->repo);
+            }
+            if (pkg->is_provided)
+            {
+                fprintf (config.out, "%s ", pkg->name);
+            }
+            fprintf (config.out, "%s ", pkg->pkg->version);
+            print_size (pkg->pkg->isize);
+            print_sizes_extra (&roots[n].data, pkg->has_actual, pkg->size_actual,
+                    pkg->has_download, pkg->size_download);
+            fputc ('\n', config.out);
+        }
+        free (pkgs);
+    }
+}
+
+static int
+print_roots (root_t *roots, size_t nb_roots, alpm_list_t *names)
+{
+    size_t n;
+    int    rc = E_NOTHING;
+
+    for (n = 0; n < nb_roots; ++n)
+    {
+        root_t *root = &roots[n];
+
+        if (config.quiet)
+        {
+            fprintf (config.out, "%s:\n", root->path);
+        }
+        else
+        {
+            fprintf (config.out, "%sRoot: %s\n", (n > 0) ? "\n" : "", root->path);
+        }
+        if (root->rc == E_OK)
+        {
+            print_data (&root->data);
+            rc = E_OK;
+        }
+        /* only reported once, not for every --output */
+        else if (root->rc == E_NOTHING && config.out == stdout)
+        {
+            fprintf (stderr, "No package to process in %s\n", root->path);
+        }
+    }
+
+    if (rc == E_OK)
+    {
+        if (!config.quiet)
+        {
+            fputc ('\n', config.out);
+        }
+        print_roots_summary (roots, nb_roots, names);
+    }
+    return rc;
+}
+
+/* --output: the results (of data, or of all roots) rendered once more for
+ * each output, from what was analysed once */
+static int
+write_outputs (data_t *data, root_t *roots, size_t nb_roots, alpm_list_t *names)
+{
+    bool         quiet = config.quiet;
+    bool         raw_sizes = config.raw_sizes;
+    alpm_list_t *i;
+    size_t       n;
+    int          rc = E_OK;
+
+    FOR_LIST (i, config.outputs)
+    {
+        output_t  *output = i->data;
+        long long  t = trace_begin ();
+        int        r;
+
+        config.out = fopen (output->file, "w");
+        if (!config.out)
+        {
+            fprintf (stderr, "Error: unable to open %s: %s\n", output->file,
+                    strerror (errno));
+            config.out = stdout;
+            rc = E_FILEWRITE;
+            continue;
+        }
+        config.quiet = (output->format == OUTPUT_QUIET
+                || output->format == OUTPUT_RAW);
+        config.raw_sizes = (output->format == OUTPUT_RAW) || raw_sizes;
+
+        if (output->format != OUTPUT_JSON)
+        {
+            if (roots)
+            {
+                print_roots (roots, nb_roots, names);
+            }
+            else
+            {
+                print_data (data);
+            }
+        }
+        else if (roots)
+        {
+            fputs ("{\"roots\":[", config.out);
+            for (n = 0; n < nb_roots; ++n)
+            {
+                if (roots[n].rc == E_OK)
+                {
+                    print_json (&roots[n].data, roots[n].path);
+                }
+                else
+                {
+                    fputs ("{\"root\":", config.out);
+                    write_json_str (config.out, roots[n].path);
+                    fputs (",\"packages\":[]}", config.out);
+                }
+                fputs ((n + 1 < nb_roots) ? "," : "", config.out);
+            }
+            fputs ("]}\n", config.out);
+        }
+        else
+        {
+            print_json (data, NULL);
+            fputc ('\n', config.out);
+        }
+
+        r = ferror (config.out);
+        r |= fclose (config.out);
+        if (r != 0)
+        {
+            fprintf (stderr, "Error: unable to write output to %s\n", output->file);
+            rc = E_FILEWRITE;
+        }
+        config.out = stdout;
+        trace_end ("output", output->file, t);
+    }
+
+    config.quiet = quiet;
+    config.raw_sizes = raw_sizes;
+    return rc;
+}
+
+/* analyses every root from config.roots, each with its own local db but all
+ * using our sync dbs. Roots are analysed in parallel, then results are printed
+ * in order, followed by a summary of the specified packages across roots */
+static int
+analyse_roots (alpm_list_t *names)
+{
+    roots_t      ctx;
+    root_t      *roots;
+    size_t       nb_roots;
+    size_t       n;
+    alpm_list_t *i;
+    long long    t;
+    int          rc = E_NOTHING;
+
+    nb_roots = alpm_list_count (config.roots) + alpm_list_count (config.snapshots);
+    roots = calloc (nb_roots, sizeof (*roots));
+    if (!roots)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        return E_NOMEM;
+    }
+
+    for (i = config.roots, n = 0; i; i = i->next, ++n)
+    {
+        root_t              *root = &roots[n];
+        char                *dbpath;
+        size_t               len;
+        enum _alpm_errno_t   err;
+
+        root->path = i->data;
+        len = strlen (root->path) + strlen (PACMAN_DBPATH) + 1;
+        dbpath = malloc (sizeof (*dbpath) * len);
+        if (!dbpath)
+        {
+            fprintf (stderr, "Error: out of memory\n");
+            root->rc = E_NOMEM;
+            continue;
+        }
+        snprintf (dbpath, len, "%s%s", root->path, PACMAN_DBPATH);
+
+        debug ("setting up libalpm for root %s\n", root->path);
+        root->alpm = alpm_initialize (root->path, dbpath, &err);
+        free (dbpath);
+        if (!root->alpm)
+        {
+            fprintf (stderr, "Error: Failed to initialize alpm library for %s: %s\n",
+                    root->path, alpm_strerror (err));
+            root->rc = E_ALPM;
+            continue;
+        }
+        init_data (&root->data,
+                new_handle_pkgdb (root->alpm, NULL),
+                root->path);
+    }
+    /* snapshots are loaded when analysed, i.e. in parallel */
+    FOR_LIST (i, config.snapshots)
+    {
+        roots[n].path = i->data;
+        roots[n].is_snapshot = true;
+        ++n;
+    }
+
+    t = trace_begin ();
+    preload_syncdbs ();
+    trace_end ("preload_syncdbs", NULL, t);
+    ctx.roots = roots;
+    ctx.names = names;
+    run_jobs ((job_fn) analyse_root, &ctx, nb_roots);
+
+    for (n = 0; config.download_size && n < nb_roots; ++n)
+    {
+        if (roots[n].rc == E_OK)
+        {
+            t = trace_begin ();
+            get_download_sizes (&roots[n].data);
+            trace_end ("get_download_sizes", roots[n].path, t);
+        }
+    }
+
+    /* done after, each root then stat-ing files using all threads */
+    for (n = 0; config.actual_size && n < nb_roots; ++n)
+    {
+        if (roots[n].rc == E_OK)
+        {
+            t = trace_begin ();
+            get_actual_sizes (&roots[n].data,
+                    (roots[n].alpm) ? alpm_option_get_root (roots[n].alpm) : NULL);
+            trace_end ("get_actual_sizes", roots[n].path, t);
+        }
+    }
+
+    t = trace_begin ();
+    rc = print_roots (roots, nb_roots, names);
+    trace_end ("output", NULL, t);
+    if (config.outputs && rc == E_OK)
+    {
+        rc = write_outputs (NULL, roots, nb_roots, names);
+    }
+
+    for (n = 0; n < nb_roots; ++n)
+    {
+        free_data (&roots[n].data);
+        if (roots[n].alpm)
+        {
+            alpm_release (roots[n].alpm);
+        }
+    }
+    free (roots);
+    return rc;
+}
+
+/* graph of all installed packages (for --free and --graph-stats): each one
+ * gets its (local) deps resolved once, and a count of installed packages
+ * requiring it */
+typedef struct _graph_pkg_t {
+    pkginfo_t       *pkg;
+    size_t          *deps;          /* in graph->pkgs, each only once */
+    size_t           nb_deps;
+    unsigned int     nb_reqs;       /* installed packages requiring it */
+    /* --free */
+    size_t           pick;          /* candidate whose cascade removed it, +1 */
+    unsigned int     is_allowed : 1;
+    unsigned int     is_removed : 1;
+} graph_pkg_t;
+
+typedef struct _graph_t {
+    data_t          *data;
+    graph_pkg_t     *pkgs;          /* same order as the local db */
+    size_t           nb_pkgs;
+    size_t          *stack;         /* room for every package, as needed */
+} graph_t;
+
+#define GRAPH_CHUNK             64
+
+static void
+graph_resolve (graph_t *graph, size_t n)
+{
+    size_t p, end = (n + 1) * GRAPH_CHUNK;
+
+    for (p = n * GRAPH_CHUNK; p < end && p < graph->nb_pkgs; ++p)
+    {
+        graph_pkg_t *pp = &graph->pkgs[p];
+        alpm_list_t *i;
+
+        pp->deps = malloc (sizeof (*pp->deps) * alpm_list_count (pp->pkg->depends));
+        FOR_LIST (i, (pp->deps) ? pp->pkg->depends : NULL)
+        {
+            pkginfo_t *dep;
+            size_t     d, k;
+
+            dep = find_dep_satisfier (graph->data, true, i->data, NULL);
+            if (!dep)
+            {
+                continue;
+            }
+            d = (size_t) (dep - graph->pkgs[0].pkg);
+            for (k = 0; k < pp->nb_deps && pp->deps[k] != d; ++k)
+                ;
+            if (k == pp->nb_deps && d != p)
+            {
+                pp->deps[pp->nb_deps++] = d;
+            }
+        }
+    }
+}
+
+static int
+load_graph (data_t *data, graph_t *graph)
+{
+    pkgdb_t *pkgdb = data->localdb->data;
+    size_t   n, k;
+
+    memset (graph, 0, sizeof (*graph));
+    graph->data = data;
+    load_pkgdbs (data->localdb);
+    get_provides (data->localdb, &data->provides_local);
+    graph->nb_pkgs = pkgdb->nb_pkgs;
+    graph->pkgs = calloc (graph->nb_pkgs + 1, sizeof (*graph->pkgs));
+    graph->stack = malloc (sizeof (*graph->stack) * (graph->nb_pkgs + 1));
+    if (!graph->pkgs || !graph->stack)
+    {
+        return E_NOMEM;
+    }
+    for (n = 0; n < graph->nb_pkgs; ++n)
+    {
+        graph->pkgs[n].pkg = &pkgdb->pkgs[n];
+    }
+
+    run_jobs ((job_fn) graph_resolve, graph,
+            (graph->nb_pkgs + GRAPH_CHUNK - 1) / GRAPH_CHUNK);
+    for (n = 0; n < graph->nb_pkgs; ++n)
+    {
+        for (k = 0; k < graph->pkgs[n].nb_deps; ++k)
+        {
+            ++graph->pkgs[graph->pkgs[n].deps[k]].nb_reqs;
+        }
+    }
+    return E_OK;
+}
+
+static void
+free_graph (graph_t *graph)
+{
+    size_t n;
+
+    for (n = 0; graph->pkgs && n < graph->nb_pkgs; ++n)
+    {
+        free (graph->pkgs[n].deps);
+    }
+    free (graph->pkgs);
+    free (graph->stack);
+}
+
+/* --free: removal planner. Removing a package also removes, as pacman -Rs
+ * would, every dependency no longer required (unless explicitly installed),
+ * and so on. Candidates are packages not required by any other, installed as
+ * dependencies or allowed (specified, or all with --explicit). Each round, the
+ * cascade of every candidate is simulated (counts decremented, then restored),
+ * and the best one applied */
+
+/* removes the top packages on the stack (flagged is_removed) and their
+ * cascade, adding it to the stack; Returns the size freed */
+static off_t
+graph_cascade (graph_t *graph, size_t *top)
+{
+    off_t   size = 0;
+    size_t  n, k;
+
+    for (n = 0; n < *top; ++n)
+    {
+        graph_pkg_t *pp = &graph->pkgs[graph->stack[n]];
+
+        size += pp->pkg->isize;
+        for (k = 0; k < pp->nb_deps; ++k)
+        {
+            graph_pkg_t *dp = &graph->pkgs[pp->deps[k]];
+
+            if (--dp->nb_reqs == 0 && !dp->is_removed
+                    && dp->pkg->reason != ALPM_PKG_REASON_EXPLICIT)
+            {
+                dp->is_removed = true;
+                graph->stack[(*top)++] = pp->deps[k];
+            }
+        }
+    }
+    return size;
+}
+
+/* undoes graph_cascade() */
+static void
+graph_restore (graph_t *graph, size_t top)
+{
+    size_t  n, k;
+
+    for (n = 0; n < top; ++n)
+    {
+        graph_pkg_t *pp = &graph->pkgs[graph->stack[n]];
+
+        pp->is_removed = false;
+        for (k = 0; k < pp->nb_deps; ++k)
+        {
+            ++graph->pkgs[pp->deps[k]].nb_reqs;
+        }
+    }
+}
+
+/* removes c and its cascade; Returns the size freed, with the number of
+ * packages in nb. Unless apply, everything is restored afterwards */
+static off_t
+plan_cascade (graph_t *plan, size_t c, size_t *nb, bool apply)
+{
+    off_t   size;
+    size_t  top = 0;
+    size_t  n;
+
+    plan->pkgs[c].is_removed = true;
+    plan->stack[top++] = c;
+    size = graph_cascade (plan, &top);
+    *nb = top;
+
+    if (!apply)
+    {
+        graph_restore (plan, top);
+        return size;
+    }
+    for (n = 0; n < top; ++n)
+    {
+        plan->pkgs[plan->stack[n]].pick = c + 1;
+    }
+    return size;
+}
+
+/* suggests packages to remove to free config.free_target bytes: as long as
+ * the target isn't reached, picks the candidate freeing the most space, unless
+ * some would reach it, then the one of those removing the fewest packages */
+static int
+plan_removal (data_t *data, alpm_list_t *names)
+{
+    graph_t      plan;
+    pkgdb_t     *pkgdb = data->localdb->data;
+    alpm_list_t *picks = NULL;
+    alpm_list_t *i;
+    off_t        freed = 0;
+    size_t       nb_freed = 0;
+    size_t       n;
+    int          len_max = (int) strlen ("Target:") + 1;
+    int          rc = E_OK;
+
+    if (load_graph (data, &plan) != E_OK)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        rc = E_NOMEM;
+        goto done;
+    }
+    for (n = 0; n < plan.nb_pkgs; ++n)
+    {
+        plan.pkgs[n].is_allowed = config.explicit;
+    }
+    FOR_LIST (i, names)
+    {
+        pkginfo_t *pkg = pkgdb_get_pkg (pkgdb, str_lookup (i->data));
+
+        if (!pkg)
+        {
+            fprintf (stderr, "Package not found: %s\n", (const char *) i->data);
+            continue;
+        }
+        plan.pkgs[pkg - pkgdb->pkgs].is_allowed = true;
+    }
+
+    while (freed < config.free_target)
+    {
+        size_t  best = plan.nb_pkgs;
+        size_t  best_nb = 0;
+        off_t   best_size = 0;
+        bool    best_reaches = false;
+
+        for (n = 0; n < plan.nb_pkgs; ++n)
+        {
+            graph_pkg_t *pp = &plan.pkgs[n];
+            off_t       size;
+            size_t      nb;
+            bool        reaches;
+
+            if (pp->is_removed || pp->nb_reqs > 0
+                    || (pp->pkg->reason == ALPM_PKG_REASON_EXPLICIT && !pp->is_allowed))
+            {
+                continue;
+            }
+            size = plan_cascade (&plan, n, &nb, false);
+            if (size <= 0)
+            {
+                continue;
+            }
+            reaches = (freed + size >= config.free_target);
+            if (best == plan.nb_pkgs
+                    || (reaches && !best_reaches)
+                    || (reaches && (nb < best_nb
+                            || (nb == best_nb && size < best_size)))
+                    || (!reaches && !best_reaches && (size > best_size
+                            || (size == best_size && nb < best_nb))))
+            {
+                best = n;
+                best_nb = nb;
+                best_size = size;
+                best_reaches = reaches;
+            }
+        }
+        if (best == plan.nb_pkgs)
+        {
+            break;
+        }
+
+        debug ("removing %s frees %lld bytes (%zu packages)\n",
+                plan.pkgs[best].pkg->name, (long long) best_size, best_nb);
+        plan_cascade (&plan, best, &best_nb, true);
+        freed += best_size;
+        nb_freed += best_nb;
+        picks = alpm_list_add (picks, &plan.pkgs[best]);
+    }
+
+    if (!picks)
+    {
+        fprintf (stderr, "No package can be removed\n");
+        rc = E_NOTHING;
+        goto done;
+    }
+    if (freed < config.free_target)
+    {
+        fprintf (stderr, "Warning: target cannot be reached\n");
+    }
+
+    for (n = 0; n < plan.nb_pkgs; ++n)
+    {
+        int len = (int) strlen (plan.pkgs[n].pkg->name) + 1;
+
+        if (plan.pkgs[n].is_removed && len > len_max)
+        {
+            len_max = len;
+        }
+    }
+    if (!config.quiet)
+    {
+        fputs ("Packages to remove (with pacman -Rs):\n", stdout);
+    }
+    FOR_LIST (i, picks)
+    {
+        graph_pkg_t *pick = i->data;
+        size_t      c = (size_t) (pick - plan.pkgs);
+        off_t       size = 0;
+        size_t      nb = 0;
+
+        for (n = 0; n < plan.nb_pkgs; ++n)
+        {
+            if (plan.pkgs[n].pick == c + 1)
+            {
+                size += plan.pkgs[n].pkg->isize;
+                ++nb;
+            }
+        }
+        if (config.quiet)
+        {
+            fprintf (stdout, "%s ", pick->pkg->name);
+            print_size (size);
+            fprintf (stdout, " %zu\n", nb);
+        }
+        else
+        {
+            fprintf (stdout, " %*s", -len_max, pick->pkg->name);
+            print_size (size);
+            fprintf (stdout, " (%zu package%s)\n", nb, (nb > 1) ? "s" : "");
+        }
+
+        /* the cascade, i.e. its exclusive dependencies */
+        for (n = 0; config.list_exclusive && n < plan.nb_pkgs; ++n)
+        {
+            if (n == c || plan.pkgs[n].pick != c + 1)
+            {
+                continue;
+            }
+            if (config.quiet)
+            {
+                fprintf (stdout, " %s ", plan.pkgs[n].pkg->name);
+            }
+            else
+            {
+                fprintf (stdout, "  %*s", -(len_max - 1), plan.pkgs[n].pkg->name);
+            }
+            print_size (plan.pkgs[n].pkg->isize);
+            fputc ('\n', stdout);
+        }
+    }
+    if (!config.quiet)
+    {
+        fprintf (stdout, " %*s", -len_max, "Total:");
+        print_size (freed);
+        fprintf (stdout, " (%zu package%s)\n", nb_freed, (nb_freed > 1) ? "s" : "");
+        fprintf (stdout, " %*s", -len_max, "Target:");
+        print_size (config.free_target);
+        fputc ('\n', stdout);
+    }
+
+done:
+    alpm_list_free (picks);
+    free_graph (&plan);
+    return rc;
+}
+
+/* Tarjan's algorithm (iterative): sets the strongly connected component of
+ * every package in scc. Components are numbered in reverse topological order,
+ * i.e. one only requires components with lower numbers. Returns how many there
+ * are, or 0 on error */
+static size_t
+graph_sccs (graph_t *graph, size_t *scc)
+{
+    const size_t undef = (size_t) -1;
+    size_t      *index, *low, *edge, *calls;
+    bool        *on_stack;
+    size_t       nb_sccs = 0;
+    size_t       next = 0;
+    size_t       top = 0;
+    size_t       r;
+
+    index = malloc (sizeof (*index) * (graph->nb_pkgs + 1));
+    low = malloc (sizeof (*low) * (graph->nb_pkgs + 1));
+    edge = malloc (sizeof (*edge) * (graph->nb_pkgs + 1));
+    calls = malloc (sizeof (*calls) * (graph->nb_pkgs + 1));
+    on_stack = calloc (graph->nb_pkgs + 1, sizeof (*on_stack));
+    if (!index || !low || !edge || !calls || !on_stack)
+    {
+        goto done;
+    }
+    memset (index, 0xff, sizeof (*index) * graph->nb_pkgs);
+
+    for (r = 0; r < graph->nb_pkgs; ++r)
+    {
+        size_t nb_calls = 0;
+
+        if (index[r] != undef)
+        {
+            continue;
+        }
+        index[r] = low[r] = next++;
+        edge[r] = 0;
+        graph->stack[top++] = r;
+        on_stack[r] = true;
+        calls[nb_calls++] = r;
+
+        while (nb_calls > 0)
+        {
+            size_t v = calls[nb_calls - 1];
+
+            if (edge[v] < graph->pkgs[v].nb_deps)
+            {
+                size_t w = graph->pkgs[v].deps[edge[v]++];
+
+                if (index[w] == undef)
+                {
+                    index[w] = low[w] = next++;
+                    edge[w] = 0;
+                    graph->stack[top++] = w;
+                    on_stack[w] = true;
+                    calls[nb_calls++] = w;
+                }
+                else if (on_stack[w] && index[w] < low[v])
+                {
+                    low[v] = index[w];
+                }
+                continue;
+            }
+
+            --nb_calls;
+            if (nb_calls > 0 && low[v] < low[calls[nb_calls - 1]])
+            {
+                low[calls[nb_calls - 1]] = low[v];
+            }
+            if (low[v] == index[v])
+            {
+                size_t w;
+
+                do
+                {
+                    w = graph->stack[--top];
+                    on_stack[w] = false;
+                    scc[w] = nb_sccs;
+                } while (w != v);
+                ++nb_sccs;
+            }
+        }
+    }
+
+done:
+    free (index);
+    free (low);
+    free (edge);
+    free (calls);
+    free (on_stack);
+    return nb_sccs;
+}
+
+/* --attribute: the size of every dependency is split among those needing it,
+ * i.e. the main packages and the installed packages outside the tree from
+ * which it can be reached. All at once: the claimants of every strongly
+ * connected component of the tree (as bitsets) are propagated in topological
+ * order, instead of going through the tree once per package.
+ * Splits are even, or weighted by the claimants' own size: for a main package
+ * itself and the deps only it needs, for an outsider itself */
+#define WORD_BITS               (8 * sizeof (unsigned long))
+
+static void
+attribute_sizes (data_t *data)
+{
+    pkgdb_t        *localdb = data->localdb->data;
+    graph_t         graph;
+    pkg_t         **pkgs = NULL;
+    alpm_list_t   **reqs = NULL;        /* requirers of each package */
+    size_t         *scc = NULL;
+    size_t         *order = NULL;       /* packages, by scc */
+    size_t         *end = NULL;         /* scc -> end in order */
+    size_t         *outsider = NULL;    /* local package -> claimant + 1 */
+    pkginfo_t     **claimants = NULL;   /* main packages, then outsiders */
+    unsigned long  *bits = NULL;
+    off_t          *own = NULL;
+    double         *weight = NULL;
+    double         *share = NULL;
+    size_t          nb_mains, nb_claimants, nb_words;
+    size_t          nb_sccs = 0;
+    size_t          n, k, c, w;
+    alpm_list_t    *i;
+
+    memset (&graph, 0, sizeof (graph));
+    graph.nb_pkgs = alpm_list_count (data->deps);
+    nb_mains = alpm_list_count (data->pkgs);
+    graph.pkgs = calloc (graph.nb_pkgs + 1, sizeof (*graph.pkgs));
+    graph.stack = malloc (sizeof (*graph.stack) * (graph.nb_pkgs + 1));
+    pkgs = malloc (sizeof (*pkgs) * (graph.nb_pkgs + 1));
+    reqs = calloc (graph.nb_pkgs + 1, sizeof (*reqs));
+    scc = malloc (sizeof (*scc) * (graph.nb_pkgs + 1));
+    order = malloc (sizeof (*order) * (graph.nb_pkgs + 1));
+    end = calloc (graph.nb_pkgs + 1, sizeof (*end));
+    outsider = calloc (localdb->nb_pkgs + 1, sizeof (*outsider));
+    claimants = malloc (sizeof (*claimants) * (nb_mains + localdb->nb_pkgs + 1));
+    if (!graph.pkgs || !graph.stack || !pkgs || !reqs || !scc || !order
+            || !end || !outsider || !claimants)
+    {
+        goto done;
+    }
+
+    /* the tree, as a graph */
+    for (i = data->deps, n = 0; i; i = i->next, ++n)
+    {
+        pkgs[n] = i->data;
+        pkgs[n]->pos = n;
+        graph.pkgs[n].pkg = pkgs[n]->pkg;
+    }
+    for (n = 0; n < graph.nb_pkgs; ++n)
+    {
+        graph_pkg_t *gp = &graph.pkgs[n];
+
+        gp->deps = malloc (sizeof (*gp->deps)
+                * (alpm_list_count (pkgs[n]->deps) + 1));
+        if (!gp->deps)
+        {
+            goto done;
+        }
+        FOR_LIST (i, pkgs[n]->deps)
+        {
+            gp->deps[gp->nb_deps++] = ((pkg_t *) i->data)->pos;
+        }
+    }
+    nb_sccs = graph_sccs (&graph, scc);
+    if (nb_sccs == 0)
+    {
+        goto done;
+    }
+
+    /* claimants: main packages, then installed packages outside the tree
+     * requiring a (local) dependency in it -- as for classify(), requirers of
+     * a main package do not make its deps shared */
+    nb_claimants = 0;
+    FOR_LIST (i, data->pkgs)
+    {
+        claimants[nb_claimants++] = ((pkg_t *) i->data)->pkg;
+    }
+    index_deps (data);
+    for (n = 0; n < graph.nb_pkgs; ++n)
+    {
+        if (pkgs[n]->repo || pkgs[n]->is_main)
+        {
+            continue;
+        }
+        reqs[n] = compute_requiredby (data, pkgs[n]->pkg);
+        FOR_LIST (i, reqs[n])
+        {
+            pkginfo_t *r = i->data;
+            size_t     o = (size_t) (r - localdb->pkgs);
+
+            if (outsider[o] == 0 && !nameidx_get (&data->deps_by_name, r->name_id))
+            {
+                claimants[nb_claimants] = r;
+                outsider[o] = ++nb_claimants;
+            }
+        }
+    }
+
+    nb_words = (nb_claimants + WORD_BITS - 1) / WORD_BITS;
+    bits = calloc (nb_sccs * nb_words + 1, sizeof (*bits));
+    own = calloc (nb_mains + 1, sizeof (*own));
+    weight = calloc (nb_claimants + 1, sizeof (*weight));
+    share = calloc (nb_claimants + 1, sizeof (*share));
+    if (!bits || !own || !weight || !share)
+    {
+        goto done;
+    }
+
+#define CLAIM(c, k)     bits[(c) * nb_words + (k) / WORD_BITS] |= 1UL << ((k) % WORD_BITS)
+    for (i = data->pkgs, k = 0; i; i = i->next, ++k)
+    {
+        CLAIM (scc[((pkg_t *) i->data)->pos], k);
+    }
+    for (n = 0; n < graph.nb_pkgs; ++n)
+    {
+        FOR_LIST (i, reqs[n])
+        {
+            size_t o = (size_t) ((pkginfo_t *) i->data - localdb->pkgs);
+
+            if (outsider[o] > 0)
+            {
+                CLAIM (scc[n], outsider[o] - 1);
+            }
+        }
+    }
+#undef CLAIM
+
+    /* propagation, from requirers (higher scc numbers) down */
+    for (n = 0; n < graph.nb_pkgs; ++n)
+    {
+        ++end[scc[n]];
+    }
+    for (c = 1; c < nb_sccs; ++c)
+    {
+        end[c] += end[c - 1];
+    }
+    for (n = graph.nb_pkgs; n > 0; --n)
+    {
+        order[--end[scc[n - 1]]] = n - 1;
+    }
+    /* end[c] is now where c starts, it ends where c + 1 starts */
+    for (c = nb_sccs; c > 0; --c)
+    {
+        unsigned long *from = &bits[(c - 1) * nb_words];
+        size_t         last = (c < nb_sccs) ? end[c] : graph.nb_pkgs;
+
+        for (n = end[c - 1]; n < last; ++n)
+        {
+            graph_pkg_t *gp = &graph.pkgs[order[n]];
+
+            for (k = 0; k < gp->nb_deps; ++k)
+            {
+                unsigned long *to = &bits[scc[gp->deps[k]] * nb_words];
+
+                for (w = 0; to != from && w < nb_words; ++w)
+                {
+                    to[w] |= from[w];
+                }
+            }
+        }
+    }
+
+    /* own size of main packages: themselves, and deps only they need */
+    for (i = data->pkgs, k = 0; i; i = i->next, ++k)
+    {
+        own[k] = ((pkg_t *) i->data)->pkg->isize;
+    }
+    for (n = 0; n < graph.nb_pkgs; ++n)
+    {
+        unsigned long *b = &bits[scc[n] * nb_words];
+        size_t         nb = 0;
+
+        for (w = 0, k = 0; w < nb_words; ++w)
+        {
+            nb += (size_t) __builtin_popcountl (b[w]);
+            if (b[w] && nb == 1)
+            {
+                k = w * WORD_BITS + (size_t) __builtin_ctzl (b[w]);
+            }
+        }
+        if (nb == 1 && k < nb_mains && !pkgs[n]->is_main)
+        {
+            own[k] += pkgs[n]->pkg->isize;
+        }
+    }
+    for (k = 0; k < nb_claimants; ++k)
+    {
+        weight[k] = (double) ((k < nb_mains) ? own[k] : claimants[k]->isize);
+    }
+
+    /* and the split */
+    for (n = 0; n < graph.nb_pkgs; ++n)
+    {
+        unsigned long *b = &bits[scc[n] * nb_words];
+        double         total = 0.0;
+        size_t         nb = 0;
+        bool           even;
+
+        if (pkgs[n]->is_main)
+        {
+            continue;
+        }
+        for (w = 0; w < nb_words; ++w)
+        {
+            unsigned long x;
+
+            for (x = b[w]; x; x &= x - 1)
+            {
+                total += weight[w * WORD_BITS + (size_t) __builtin_ctzl (x)];
+                ++nb;
+            }
+        }
+        even = (config.attribute == ATTRIBUTE_EVEN || total <= 0.0);
+        for (w = 0; w < nb_words; ++w)
+        {
+            unsigned long x;
+
+            for (x = b[w]; x; x &= x - 1)
+            {
+                k = w * WORD_BITS + (size_t) __builtin_ctzl (x);
+                share[k] += (double) pkgs[n]->pkg->isize
+                    * ((even) ? 1.0 / (double) nb : weight[k] / total);
+            }
+        }
+    }
+
+    for (i = data->pkgs, k = 0; i; i = i->next, ++k)
+    {
+        pkg_t *pkg = i->data;
+
+        pkg->size_own = own[k];
+        pkg->size_attributed = pkg->pkg->isize + (off_t) (share[k] + 0.5);
+    }
+    for (k = nb_mains; k < nb_claimants; ++k)
+    {
+        data->size_outside += (off_t) (share[k] + 0.5);
+    }
+    data->nb_outside = nb_claimants - nb_mains;
+
+done:
+    if (!share)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+    }
+    for (n = 0; reqs && n < graph.nb_pkgs; ++n)
+    {
+        alpm_list_free (reqs[n]);
+    }
+    free (pkgs);
+    free (reqs);
+    free (scc);
+    free (order);
+    free (end);
+    free (outsider);
+    free (claimants);
+    free (bits);
+    free (own);
+    free (weight);
+    free (share);
+    free_graph (&graph);
+}
+
+/* prints counts by power-of-two buckets (0, 1, 2, 3-4, 5-8, ...) of values */
+static void
+print_histogram (const char *key, unsigned int *values, size_t nb)
+{
+    size_t       counts[8 * sizeof (unsigned int) + 1] = { 0 };
+    size_t       nb_buckets = 0;
+    size_t       n, b;
+
+    for (n = 0; n < nb; ++n)
+    {
+        unsigned int v = values[n];
+
+        /* bucket of v is the number of bits of v - 1, plus one (0 for 0) */
+        for (b = 0; v > 0 && (v - 1) >> b; ++b)
+            ;
+        b += (v > 0);
+        ++counts[b];
+        if (b + 1 > nb_buckets)
+        {
+            nb_buckets = b + 1;
+        }
+    }
+    fputs (key, stdout);
+    for (b = 0; b < nb_buckets; ++b)
+    {
+        unsigned int max = (b > 0) ? 1U << (b - 1) : 0;
+        unsigned int min = (b > 1) ? (max >> 1) + 1 : max;
+
+        if (min == max)
+        {
+            fprintf (stdout, " %u:%zu", max, counts[b]);
+        }
+        else
+        {
+            fprintf (stdout, " %u-%u:%zu", min, max, counts[b]);
+        }
+    }
+    fputc ('\n', stdout);
+}
+
+#define GRAPH_HUBS              10
+
+/* --graph-stats: numbers about the graph of installed packages, one per line
+ * as "key value..." All are computed in linear time: strongly connected
+ * components (cycles) with Tarjan's algorithm, the longest chain of
+ * dependencies over those components, and layers with a BFS from packages not
+ * required by any other */
+static int
+graph_stats (data_t *data)
+{
+    graph_t       graph;
+    size_t       *scc = NULL;
+    size_t       *first = NULL;     /* scc -> offset in members */
+    size_t       *members = NULL;   /* packages, by scc */
+    size_t       *height = NULL;    /* scc -> longest chain from it */
+    size_t       *layer = NULL;
+    unsigned int *values = NULL;
+    size_t        hubs[GRAPH_HUBS];
+    size_t        nb_hubs = 0;
+    size_t        nb_sccs = 0;
+    size_t        nb_edges = 0;
+    size_t        nb_explicit = 0;
+    size_t        nb_orphans = 0;
+    size_t        nb_cycles = 0;
+    size_t        longest = 0;
+    size_t        n, k, c;
+    int           rc = E_OK;
+
+    rc = load_graph (data, &graph);
+    if (rc == E_OK)
+    {
+        size_t nb = graph.nb_pkgs + 1;
+
+        scc = malloc (sizeof (*scc) * nb);
+        first = calloc (nb + 1, sizeof (*first));
+        members = malloc (sizeof (*members) * nb);
+        height = calloc (nb, sizeof (*height));
+        layer = malloc (sizeof (*layer) * nb);
+        values = malloc (sizeof (*values) * nb);
+        if (!scc || !first || !members || !height || !layer || !values)
+        {
+            rc = E_NOMEM;
+        }
+    }
+    if (rc == E_OK && graph.nb_pkgs > 0)
+    {
+        nb_sccs = graph_sccs (&graph, scc);
+        rc = (nb_sccs > 0) ? E_OK : E_NOMEM;
+    }
+    if (rc != E_OK)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        goto done;
+    }
+
+    for (n = 0; n < graph.nb_pkgs; ++n)
+    {
+        graph_pkg_t *gp = &graph.pkgs[n];
+
+        nb_edges += gp->nb_deps;
+        if (gp->pkg->reason == ALPM_PKG_REASON_EXPLICIT)
+        {
+            ++nb_explicit;
+        }
+        else if (gp->nb_reqs == 0)
+        {
+            ++nb_orphans;
+        }
+        /* heaviest hubs, i.e. most required, sorted */
+        if (gp->nb_reqs > 1 && (nb_hubs < GRAPH_HUBS
+                    || gp->nb_reqs > graph.pkgs[hubs[nb_hubs - 1]].nb_reqs))
+        {
+            if (nb_hubs < GRAPH_HUBS)
+            {
+                ++nb_hubs;
+            }
+            for (k = nb_hubs - 1;
+                    k > 0 && graph.pkgs[hubs[k - 1]].nb_reqs < gp->nb_reqs;
+                    --k)
+            {
+                hubs[k] = hubs[k - 1];
+            }
+            hubs[k] = n;
+        }
+        ++first[scc[n] + 1];
+    }
+
+    /* members of each scc, for the longest chain */
+    for (c = 0; c < nb_sccs; ++c)
+    {
+        first[c + 1] += first[c];
+        if (first[c + 1] - first[c] > 1)
+        {
+            ++nb_cycles;
+        }
+    }
+    for (n = 0; n < graph.nb_pkgs; ++n)
+    {
+        members[first[scc[n]] + height[scc[n]]++] = n;
+    }
+    for (c = 0; c < nb_sccs; ++c)
+    {
+        height[c] = 1;
+        for (n = first[c]; n < first[c + 1]; ++n)
+        {
+            graph_pkg_t *gp = &graph.pkgs[members[n]];
+
+            for (k = 0; k < gp->nb_deps; ++k)
+            {
+                size_t d = scc[gp->deps[k]];
+
+                if (d != c && height[d] + 1 > height[c])
+                {
+                    height[c] = height[d] + 1;
+                }
+            }
+        }
+        if (height[c] > height[longest])
+        {
+            longest = c;
+        }
+    }
+
+    fprintf (stdout, "packages %zu\n", graph.nb_pkgs);
+    fprintf (stdout, "explicit %zu\n", nb_explicit);
+    fprintf (stdout, "orphans %zu\n", nb_orphans);
+    fprintf (stdout, "dependencies %zu\n", nb_edges);
+
+    fprintf (stdout, "longest_chain %zu", (nb_sccs > 0) ? height[longest] : 0);
+    for (c = longest; nb_sccs > 0; )
+    {
+        size_t next = nb_sccs;
+        size_t pkg = members[first[c]];
+
+        /* through a cycle, the package requiring the next one is listed */
+        for (n = first[c]; next == nb_sccs && n < first[c + 1]; ++n)
+        {
+            graph_pkg_t *gp = &graph.pkgs[members[n]];
+
+            for (k = 0; k < gp->nb_deps; ++k)
+            {
+                size_t d = scc[gp->deps[k]];
+
+                if (d != c && height[d] + 1 == height[c])
+                {
+                    pkg = members[n];
+                    next = d;
+                    break;
+                }
+            }
+        }
+        fprintf (stdout, " %s", graph.pkgs[pkg].pkg->name);
+        if (next == nb_sccs)
+        {
+            break;
+        }
+        c = next;
+    }
+    fputc ('\n', stdout);
+
+    /* BFS, from packages not required by any other */
+    {
+        size_t head = 0, tail = 0;
+        size_t nb_layers = 0;
+
+        for (n = 0; n < graph.nb_pkgs; ++n)
+        {
+            layer[n] = (size_t) -1;
+            if (graph.pkgs[n].nb_reqs == 0)
+            {
+                layer[n] = 0;
+                graph.stack[tail++] = n;
+            }
+        }
+        while (head < tail)
+        {
+            graph_pkg_t *gp;
+
+            n = graph.stack[head++];
+            gp = &graph.pkgs[n];
+            if (layer[n] + 1 > nb_layers)
+            {
+                nb_layers = layer[n] + 1;
+            }
+            for (k = 0; k < gp->nb_deps; ++k)
+            {
+                if (layer[gp->deps[k]] == (size_t) -1)
+                {
+                    layer[gp->deps[k]] = layer[n] + 1;
+                    graph.stack[tail++] = gp->deps[k];
+                }
+            }
+        }
+        /* counts, by layer (reusing height as it's no longer needed) */
+        memset (height, 0, sizeof (*height) * (nb_layers + 1));
+        for (n = 0; n < graph.nb_pkgs; ++n)
+        {
+            if (layer[n] != (size_t) -1)
+            {
+                ++height[layer[n]];
+            }
+        }
+        fputs ("layers", stdout);
+        for (n = 0; n < nb_layers; ++n)
+        {
+            fprintf (stdout, " %zu", height[n]);
+        }
+        fputc ('\n', stdout);
+        /* only in cycles no package outside them requires */
+        fprintf (stdout, "unlayered %zu\n", graph.nb_pkgs - tail);
+    }
+
+    for (n = 0; n < graph.nb_pkgs; ++n)
+    {
+        values[n] = graph.pkgs[n].nb_reqs;
+    }
+    print_histogram ("fan_in", values, graph.nb_pkgs);
+    for (n = 0; n < graph.nb_pkgs; ++n)
+    {
+        values[n] = (unsigned int) graph.pkgs[n].nb_deps;
+    }
+    print_histogram ("fan_out", values, graph.nb_pkgs);
+
+    fprintf (stdout, "cycles %zu\n", nb_cycles);
+    for (c = 0; c < nb_sccs; ++c)
+    {
+        if (first[c + 1] - first[c] < 2)
+        {
+            continue;
+        }
+        fprintf (stdout, "cycle %zu", first[c + 1] - first[c]);
+        for (n = first[c]; n < first[c + 1]; ++n)
+        {
+            fprintf (stdout, " %s", graph.pkgs[members[n]].pkg->name);
+        }
+        fputc ('\n', stdout);
+    }
+    for (k = 0; k < nb_hubs; ++k)
+    {
+        graph_pkg_t *gp = &graph.pkgs[hubs[k]];
+
+        fprintf (stdout, "hub %s %u %lld\n",
+                gp->pkg->name, gp->nb_reqs, (long long) gp->pkg->isize);
+    }
+
+done:
+    free (scc);
+    free (first);
+    free (members);
+    free (height);
+    free (layer);
+    free (values);
+    free_graph (&graph);
+    return rc;
+}
+
+/* --check: every dependency (and optional one) of every installed package is
+ * resolved, all at once using the same indexes as everything else, and those
+ * not satisfied reported */
+typedef enum {
+    CHECK_BROKEN = 0,   /* nothing satisfies it */
+    CHECK_VERSION,      /* installed, but wrong version */
+    CHECK_SYNC,         /* only satisfied by a package from sync dbs */
+} check_kind_t;
+
+static const char *check_kinds[] = { "broken", "version", "sync" };
+
+typedef struct _check_issue_t {
+    check_kind_t     kind;
+    bool             is_optional;
+    alpm_depend_t   *dep;
+    pkginfo_t       *found;         /* VERSION/SYNC */
+    const char      *provision;     /* if found is a provider */
+} check_issue_t;
+
+typedef struct _check_t {
+    data_t          *data;
+    pkgdb_t         *pkgdb;
+    alpm_list_t    **issues;        /* check_issue_t, by package */
+    bool             has_sync;
+    bool             failed;
+} check_t;
+
+#define CHECK_CHUNK             64
+
+/* returns whether an issue was found (and added to issues) for dep */
+static bool
+check_dep (check_t *check, alpm_depend_t *dep, bool is_optional,
+           alpm_list_t **issues)
+{
+    check_issue_t    issue = { CHECK_BROKEN, is_optional, dep, NULL, NULL };
+    check_issue_t   *ci;
+
+    if (find_dep_satisfier (check->data, true, dep, NULL))
+    {
+        return false;
+    }
+    if (dep->mod != ALPM_DEP_MOD_ANY)
+    {
+        alpm_depend_t any = *dep;
+
+        any.mod = ALPM_DEP_MOD_ANY;
+        issue.found = find_dep_satisfier (check->data, true, &any,
+                &issue.provision);
+        issue.kind = (issue.found) ? CHECK_VERSION : CHECK_BROKEN;
+    }
+    /* an optional dependency that isn't installed is fine */
+    if (is_optional && !issue.found)
+    {
+        return false;
+    }
+    /* whether a sync package satisfies it is only checked afterwards, see
+     * check_sync() */
+
+    ci = malloc (sizeof (*ci));
+    if (!ci)
+    {
+        check->failed = true;
+        return true;
+    }
+    *ci = issue;
+    *issues = alpm_list_add (*issues, ci);
+    return true;
+}
+
+static void
+check_resolve (check_t *check, size_t n)
+{
+    size_t p, end = (n + 1) * CHECK_CHUNK;
+
+    for (p = n * CHECK_CHUNK; p < end && p < check->pkgdb->nb_pkgs; ++p)
+    {
+        pkginfo_t   *pkg = &check->pkgdb->pkgs[p];
+        alpm_list_t *i;
+
+        FOR_LIST (i, pkg->depends)
+        {
+            check_dep (check, i->data, false, &check->issues[p]);
+        }
+        FOR_LIST (i, pkg->optdepends)
+        {
+            check_dep (check, i->data, true, &check->issues[p]);
+        }
+    }
+}
+
+/* resolves against sync dbs the dependencies broken locally. Those are only
+ * loaded (and their provisions indexed) then, if there's any */
+static void
+check_sync (check_t *check)
+{
+    bool    is_loaded = false;
+    size_t  n;
+
+    for (n = 0; n < check->pkgdb->nb_pkgs; ++n)
+    {
+        alpm_list_t *i;
+
+        FOR_LIST (i, check->issues[n])
+        {
+            check_issue_t *ci = i->data;
+
+            if (ci->kind != CHECK_BROKEN)
+            {
+                continue;
+            }
+            if (!is_loaded)
+            {
+                load_pkgdbs (config.syncdbs);
+                get_provides (config.syncdbs, &config.provides_sync);
+                is_loaded = true;
+            }
+            ci->found = find_dep_satisfier (check->data, false, ci->dep,
+                    &ci->provision);
+            ci->kind = (ci->found) ? CHECK_SYNC : CHECK_BROKEN;
+        }
+    }
+}
+
+static void
+print_check_dep (alpm_depend_t *dep)
+{
+    char *s = alpm_dep_compute_string (dep);
+
+    fprintf (stdout, " %s", (s) ? s : dep->name);
+    free (s);
+}
+
+/* one line per issue: "KIND TYPE PACKAGE DEPENDENCY [FOUND VERSION [PROVISION]]"
+ * Returns E_BROKEN if any dependency (not optional) isn't satisfied locally */
+static int
+check_deps (data_t *data)
+{
+    check_t      check;
+    size_t       nb_broken = 0;
+    size_t       n;
+    long long    t;
+    int          rc = E_OK;
+
+    memset (&check, 0, sizeof (check));
+    check.data = data;
+    load_pkgdbs (data->localdb);
+    check.pkgdb = data->localdb->data;
+    check.has_sync = (config.syncdbs != NULL);
+    check.issues = calloc (check.pkgdb->nb_pkgs + 1, sizeof (*check.issues));
+    if (!check.issues)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        return E_NOMEM;
+    }
+
+    t = trace_begin ();
+    /* indexes are built here, only once, rather than by whichever job gets
+     * there first */
+    get_provides (data->localdb, &data->provides_local);
+    run_jobs ((job_fn) check_resolve, &check,
+            (check.pkgdb->nb_pkgs + CHECK_CHUNK - 1) / CHECK_CHUNK);
+    trace_end ("check", NULL, t);
+    if (check.has_sync)
+    {
+        t = trace_begin ();
+        check_sync (&check);
+        trace_end ("check_sync", NULL, t);
+    }
+
+    for (n = 0; n < check.pkgdb->nb_pkgs; ++n)
+    {
+        alpm_list_t *i;
+
+        FOR_LIST (i, check.issues[n])
+        {
+            check_issue_t *ci = i->data;
+
+            if (!ci->is_optional)
+            {
+                ++nb_broken;
+            }
+            fprintf (stdout, "%s %s %s", check_kinds[ci->kind],
+                    (ci->is_optional) ? "optdepends" : "depends",
+                    check.pkgdb->pkgs[n].name);
+            print_check_dep (ci->dep);
+            if (ci->found)
+            {
+                fprintf (stdout, " %s %s", ci->found->name, ci->found->version);
+            }
+            if (ci->provision)
+            {
+                const char *name = ci->provision;
+                alpm_list_t *k;
+
+                /* the provision itself, with its version if any */
+                FOR_LIST (k, ci->found->provides)
+                {
+                    if (((alpm_depend_t *) k->data)->name == name)
+                    {
+                        print_check_dep (k->data);
+                        break;
+                    }
+                }
+            }
+            fputc ('\n', stdout);
+        }
+        FREELIST (check.issues[n]);
+    }
+    free (check.issues);
+
+    if (check.failed)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        rc = E_NOMEM;
+    }
+    else if (nb_broken > 0)
+    {
+        rc = E_BROKEN;
+    }
+    return rc;
+}
+
+/* --overlap: the closure (package, and all it requires) of each specified
+ * package is built once, as a bitset over the local db. Every pair is then
+ * compared a word at a time, only the bits set in both being summed up */
+typedef struct _overlap_t {
+    pkgdb_t         *pkgdb;
+    bool            *is_selected;   /* by package, in the local db */
+    size_t          *sel;           /* packages selected, in order */
+    size_t           nb_sel;
+} overlap_t;
+
+static void
+overlap_select (data_t *data, pkginfo_t *pkg, overlap_t *overlap)
+{
+    size_t n = (size_t) (pkg - overlap->pkgdb->pkgs);
+
+    (void) data;
+    if (!overlap->is_selected[n])
+    {
+        overlap->is_selected[n] = true;
+        overlap->sel[overlap->nb_sel++] = n;
+    }
+}
+
+static int
+print_overlap (data_t *data, alpm_list_t *names)
+{
+    graph_t        graph;
+    overlap_t      overlap;
+    alpm_list_t   *patterns = NULL;
+    alpm_list_t   *i;
+    unsigned long *bits = NULL;
+    off_t         *shared = NULL;
+    size_t         nb_words = 0;
+    size_t         n, k, w;
+    int            len_max = 0;
+    int            width = 0;
+    int            rc;
+
+    memset (&overlap, 0, sizeof (overlap));
+    overlap.pkgdb = data->localdb->data;
+    rc = load_graph (data, &graph);
+    if (rc == E_OK)
+    {
+        overlap.is_selected = calloc (graph.nb_pkgs + 1, sizeof (*overlap.is_selected));
+        overlap.sel = malloc (sizeof (*overlap.sel) * (graph.nb_pkgs + 1));
+        if (!overlap.is_selected || !overlap.sel)
+        {
+            rc = E_NOMEM;
+        }
+    }
+    if (rc != E_OK)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        goto done;
+    }
+
+    FOR_LIST (i, names)
+    {
+        pkginfo_t *pkg;
+
+        if (is_pattern (i->data))
+        {
+            patterns = alpm_list_add (patterns, i->data);
+            continue;
+        }
+        pkg = pkgdb_get_pkg (overlap.pkgdb, str_lookup (i->data));
+        if (!pkg)
+        {
+            fprintf (stderr, "Package not found: %s\n", (const char *) i->data);
+            continue;
+        }
+        overlap_select (data, pkg, &overlap);
+    }
+    if (patterns)
+    {
+        match_patterns (data, data->localdb, patterns,
+                (match_fn) overlap_select, &overlap);
+        alpm_list_free (patterns);
+    }
+    if (overlap.nb_sel == 0)
+    {
+        fprintf (stderr, "No package to process\n");
+        rc = E_NOTHING;
+        goto done;
+    }
+
+    nb_words = (graph.nb_pkgs + WORD_BITS - 1) / WORD_BITS;
+    bits = calloc (overlap.nb_sel * nb_words + 1, sizeof (*bits));
+    shared = malloc (sizeof (*shared) * overlap.nb_sel * overlap.nb_sel);
+    if (!bits || !shared)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        rc = E_NOMEM;
+        goto done;
+    }
+
+    /* closures, each one's size on the diagonal */
+#define IS_SET(b, n)    ((b)[(n) / WORD_BITS] & (1UL << ((n) % WORD_BITS)))
+#define SET(b, n)       ((b)[(n) / WORD_BITS] |= 1UL << ((n) % WORD_BITS))
+    for (k = 0; k < overlap.nb_sel; ++k)
+    {
+        unsigned long *b = &bits[k * nb_words];
+        off_t          size = 0;
+        size_t         nb_stack = 0;
+
+        SET (b, overlap.sel[k]);
+        graph.stack[nb_stack++] = overlap.sel[k];
+        while (nb_stack > 0)
+        {
+            graph_pkg_t *gp = &graph.pkgs[graph.stack[--nb_stack]];
+
+            size += gp->pkg->isize;
+            for (n = 0; n < gp->nb_deps; ++n)
+            {
+                if (!IS_SET (b, gp->deps[n]))
+                {
+                    SET (b, gp->deps[n]);
+                    graph.stack[nb_stack++] = gp->deps[n];
+                }
+            }
+        }
+        shared[k * overlap.nb_sel + k] = size;
+    }
+#undef IS_SET
+#undef SET
+
+    for (k = 0; k < overlap.nb_sel; ++k)
+    {
+        unsigned long *a = &bits[k * nb_words];
+
+        for (n = k + 1; n < overlap.nb_sel; ++n)
+        {
+            unsigned long *b = &bits[n * nb_words];
+            off_t          size = 0;
+
+            for (w = 0; w < nb_words; ++w)
+            {
+                unsigned long x;
+
+                for (x = a[w] & b[w]; x; x &= x - 1)
+                {
+                    size += graph.pkgs[w * WORD_BITS
+                        + (size_t) __builtin_ctzl (x)].pkg->isize;
+                }
+            }
+            shared[k * overlap.nb_sel + n] = shared[n * overlap.nb_sel + k] = size;
+        }
+    }
+
+    /* shared size, and Jaccard ratio (shared over the size of both) */
+#define SHARED(k, n)    shared[(k) * overlap.nb_sel + (n)]
+#define JACCARD(k, n)   ((SHARED (k, k) + SHARED (n, n) - SHARED (k, n) > 0)    \
+        ? (double) SHARED (k, n) / (double) (SHARED (k, k) + SHARED (n, n)      \
+            - SHARED (k, n))                                                    \
+        : 0.0)
+    if (config.quiet)
+    {
+        for (k = 0; k < overlap.nb_sel; ++k)
+        {
+            for (n = k; n < overlap.nb_sel; ++n)
+            {
+                fprintf (config.out, "%s %s ",
+                        graph.pkgs[overlap.sel[k]].pkg->name,
+                        graph.pkgs[overlap.sel[n]].pkg->name);
+                print_size (SHARED (k, n));
+                fprintf (config.out, " %.3f\n", JACCARD (k, n));
+            }
+        }
+        goto done;
+    }
+
+    for (k = 0; k < overlap.nb_sel; ++k)
+    {
+        char buf[32];
+        int  len = (int) strlen (graph.pkgs[overlap.sel[k]].pkg->name);
+
+        len_max = (len > len_max) ? len : len_max;
+        width = (len > width) ? len : width;
+        for (n = 0; n < overlap.nb_sel; ++n)
+        {
+            format_size (buf, sizeof (buf), SHARED (k, n));
+            len = (int) strlen (buf);
+            width = (len > width) ? len : width;
+        }
+    }
+
+    fputs ("Shared closure sizes:\n", config.out);
+    for (k = 0; k <= overlap.nb_sel; ++k)
+    {
+        fprintf (config.out, "%*s", -len_max, (k > 0)
+                ? graph.pkgs[overlap.sel[k - 1]].pkg->name : "");
+        for (n = 0; n < overlap.nb_sel; ++n)
+        {
+            char buf[32];
+
+            if (k == 0)
+            {
+                fprintf (config.out, "  %*s", width,
+                        graph.pkgs[overlap.sel[n]].pkg->name);
+                continue;
+            }
+            format_size (buf, sizeof (buf), SHARED (k - 1, n));
+            fprintf (config.out, "  %*s", width, buf);
+        }
+        fputc ('\n', config.out);
+    }
+
+    fputs ("\nJaccard ratios:\n", config.out);
+    for (k = 0; k <= overlap.nb_sel; ++k)
+    {
+        fprintf (config.out, "%*s", -len_max, (k > 0)
+                ? graph.pkgs[overlap.sel[k - 1]].pkg->name : "");
+        for (n = 0; n < overlap.nb_sel; ++n)
+        {
+            if (k == 0)
+            {
+                fprintf (config.out, "  %*s", width,
+                        graph.pkgs[overlap.sel[n]].pkg->name);
+                continue;
+            }
+            fprintf (config.out, "  %*.3f", width, JACCARD (k - 1, n));
+        }
+        fputc ('\n', config.out);
+    }
+#undef SHARED
+#undef JACCARD
+
+done:
+    free (bits);
+    free (shared);
+    free (overlap.is_selected);
+    free (overlap.sel);
+    free_graph (&graph);
+    return rc;
+}
+
+/* --upgrades: what upgrading installed packages to their sync version would
+ * change in installed size. Local and sync packages are joined in one pass,
+ * probing the by-name index of each sync db (first one wins, as for pacman)
+ * for every installed package. For each outdated one, on top of the change in
+ * size of the package itself:
+ * - new dependencies: the closure of the dependencies of the new version, over
+ *   what isn't installed (nor being upgraded), from the sync dbs;
+ * - orphans: installed dependencies no longer required once the package
+ *   requires what its new version does (and new dependencies what they do),
+ *   and their cascade, as plan_cascade() does for --free.
+ * Each upgrade is computed on its own, and the total on the graph with all of
+ * them applied, so a dependency pulled in (or orphaned) by several is only
+ * counted once, and one another upgrade requires isn't orphaned */
+typedef struct _upgrade_t {
+    size_t           n;             /* in graph->pkgs */
+    pkginfo_t       *sync;
+    off_t            size_new;
+    size_t           nb_new;
+    off_t            size_orphaned;
+    size_t           nb_orphaned;
+    /* requirements, in edges: first the nb_deps of the new version, then
+     * those of new dependencies, up to nb_edges */
+    size_t           first;
+    size_t           nb_deps;
+    size_t           nb_edges;
+    /* while applied, see upgrade_orphans() */
+    size_t          *deps_old;
+    size_t           nb_deps_old;
+} upgrade_t;
+
+/* signed size, as print_size() would show it */
+static void
+format_delta (char *buf, size_t len, off_t size)
+{
+    size_t pad;
+
+    format_size (buf + 1, len - 1, (size < 0) ? -size : size);
+    pad = strspn (buf + 1, " ");
+    buf[pad] = (size < 0) ? '-' : '+';
+    memmove (buf, buf + pad, strlen (buf + pad) + 1);
+}
+
+/* resolves dep of a new version, or new dependency: Returns the installed
+ * package satisfying it (one being upgraded included), else adds the one from
+ * the sync dbs to news, unless already seen (seen[name_id] == stamp) */
+static pkginfo_t *
+upgrade_resolve (data_t         *data,
+                 alpm_depend_t  *dep,
+                 unsigned int   *seen,
+                 unsigned int    stamp,
+                 alpm_list_t   **news)
+{
+    pkgdb_t     *pkgdb = data->localdb->data;
+    pkginfo_t   *pkg;
+    pkginfo_t   *installed;
+
+    pkg = find_dep_satisfier (data, true, dep, NULL);
+    if (pkg)
+    {
+        return pkg;
+    }
+    pkg = find_dep_satisfier (data, false, dep, NULL);
+    if (!pkg)
+    {
+        debug ("upgrade: nothing satisfies %s\n", dep->name);
+        return NULL;
+    }
+    installed = pkgdb_get_pkg (pkgdb, pkg->name_id);
+    if (installed)
+    {
+        return installed;
+    }
+    if (seen[pkg->name_id] != stamp)
+    {
+        seen[pkg->name_id] = stamp;
+        *news = alpm_list_add (*news, pkg);
+    }
+    return NULL;
+}
+
+/* appends d to edges, grown as needed; Returns false if out of memory */
+static bool
+upgrade_add_edge (size_t **edges, size_t *nb, size_t *alloc, size_t d)
+{
+    if (*nb == *alloc)
+    {
+        size_t *e;
+
+        *alloc = (*alloc) ? *alloc * 2 : 1024;
+        e = realloc (*edges, sizeof (*e) * *alloc);
+        if (!e)
+        {
+            return false;
+        }
+        *edges = e;
+    }
+    (*edges)[(*nb)++] = d;
+    return true;
+}
+
+/* orphans from applying the nb_ups upgrades of ups: each package then requires
+ * what its new version does (its deps in the graph being swapped), and new
+ * dependencies what they do. Returns the size of what's no longer required,
+ * and its cascade, with their number in nb. The graph is restored afterwards */
+static off_t
+upgrade_orphans (graph_t   *graph,
+                 upgrade_t *ups,
+                 size_t     nb_ups,
+                 size_t    *edges,
+                 size_t    *nb)
+{
+    off_t   size;
+    size_t  top = 0;
+    size_t  u, k;
+
+    /* new requirements first, so only what's left without any is orphaned */
+    for (u = 0; u < nb_ups; ++u)
+    {
+        for (k = 0; k < ups[u].nb_edges; ++k)
+        {
+            ++graph->pkgs[edges[ups[u].first + k]].nb_reqs;
+        }
+    }
+    for (u = 0; u < nb_ups; ++u)
+    {
+        graph_pkg_t *gp = &graph->pkgs[ups[u].n];
+
+        for (k = 0; k < gp->nb_deps; ++k)
+        {
+            graph_pkg_t *dp = &graph->pkgs[gp->deps[k]];
+
+            if (--dp->nb_reqs == 0 && !dp->is_removed
+                    && dp->pkg->reason != ALPM_PKG_REASON_EXPLICIT)
+            {
+                dp->is_removed = true;
+                graph->stack[top++] = gp->deps[k];
+            }
+        }
+        /* so an upgraded package orphaned cascades to its new deps */
+        ups[u].deps_old = gp->deps;
+        ups[u].nb_deps_old = gp->nb_deps;
+        gp->deps = &edges[ups[u].first];
+        gp->nb_deps = ups[u].nb_deps;
+    }
+    size = graph_cascade (graph, &top);
+    *nb = top;
+
+    graph_restore (graph, top);
+    for (u = 0; u < nb_ups; ++u)
+    {
+        graph_pkg_t *gp = &graph->pkgs[ups[u].n];
+
+        gp->deps = ups[u].deps_old;
+        gp->nb_deps = ups[u].nb_deps_old;
+        for (k = 0; k < gp->nb_deps; ++k)
+        {
+            ++graph->pkgs[gp->deps[k]].nb_reqs;
+        }
+        for (k = 0; k < ups[u].nb_edges; ++k)
+        {
+            --graph->pkgs[edges[ups[u].first + k]].nb_reqs;
+        }
+    }
+    return size;
+}
+
+static int
+print_upgrades (data_t *data)
+{
+    graph_t       graph;
+    pkgdb_t      *pkgdb = data->localdb->data;
+    upgrade_t    *upgrades = NULL;
+    size_t        nb_upgrades = 0;
+    size_t       *edges = NULL;     /* requirements, of all upgrades */
+    size_t        nb_edges = 0;
+    size_t        alloc_edges = 0;
+    unsigned int *kept = NULL;      /* in graph->pkgs -> stamp */
+    unsigned int *seen = NULL;      /* name_id -> stamp */
+    bool         *is_new = NULL;    /* name_id -> new for any upgrade */
+    off_t         total_pkgs = 0;
+    off_t         total_new = 0;
+    size_t        nb_total_new = 0;
+    off_t         total_orphaned;
+    size_t        nb_total_orphaned;
+    size_t        n, k;
+    int           len_max = 0;
+    int           len_versions = 0;
+    int           len_delta = 0;
+    long long     t;
+    int           rc;
+
+    rc = load_graph (data, &graph);
+    if (rc == E_OK && config.syncdbs)
+    {
+        load_pkgdbs (config.syncdbs);
+        get_provides (config.syncdbs, &config.provides_sync);
+    }
+    if (rc == E_OK)
+    {
+        upgrades = malloc (sizeof (*upgrades) * (graph.nb_pkgs + 1));
+        kept = calloc (graph.nb_pkgs + 1, sizeof (*kept));
+        /* all names are interned by now, sync dbs & provisions loaded */
+        seen = calloc ((size_t) pool.count + 1, sizeof (*seen));
+        is_new = calloc ((size_t) pool.count + 1, sizeof (*is_new));
+        if (!upgrades || !kept || !seen || !is_new)
+        {
+            rc = E_NOMEM;
+        }
+    }
+    if (rc != E_OK)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        goto done;
+    }
+
+    t = trace_begin ();
+    for (n = 0; rc == E_OK && n < graph.nb_pkgs; ++n)
+    {
+        graph_pkg_t *gp = &graph.pkgs[n];
+        upgrade_t   *up = &upgrades[nb_upgrades];
+        pkginfo_t   *sync = NULL;
+        alpm_list_t *news = NULL;
+        alpm_list_t *i, *j;
+        unsigned int stamp;
+
+        FOR_LIST (i, config.syncdbs)
+        {
+            sync = pkgdb_get_pkg (i->data, gp->pkg->name_id);
+            if (sync)
+            {
+                break;
+            }
+        }
+        if (!sync || alpm_pkg_vercmp (sync->version, gp->pkg->version) <= 0)
+        {
+            continue;
+        }
+        memset (up, 0, sizeof (*up));
+        up->n = n;
+        up->sync = sync;
+        up->first = nb_edges;
+        stamp = (unsigned int) ++nb_upgrades;
+
+        /* what the new version requires; New dependencies are expanded as
+         * they're found, the list growing behind i */
+        FOR_LIST (i, sync->depends)
+        {
+            pkginfo_t *pkg;
+            size_t     d;
+
+            pkg = upgrade_resolve (data, i->data, seen, stamp, &news);
+            if (!pkg)
+            {
+                continue;
+            }
+            d = (size_t) (pkg - pkgdb->pkgs);
+            /* each only once, as in the graph */
+            if (kept[d] != stamp && d != n)
+            {
+                kept[d] = stamp;
+                if (!upgrade_add_edge (&edges, &nb_edges, &alloc_edges, d))
+                {
+                    rc = E_NOMEM;
+                }
+            }
+        }
+        up->nb_deps = nb_edges - up->first;
+        FOR_LIST (i, news)
+        {
+            pkginfo_t *pkg = i->data;
+
+            up->size_new += pkg->isize;
+            ++up->nb_new;
+            FOR_LIST (j, pkg->depends)
+            {
+                pkginfo_t *req;
+
+                req = upgrade_resolve (data, j->data, seen, stamp, &news);
+                if (req && !upgrade_add_edge (&edges, &nb_edges, &alloc_edges,
+                            (size_t) (req - pkgdb->pkgs)))
+                {
+                    rc = E_NOMEM;
+                }
+            }
+            if (!is_new[pkg->name_id])
+            {
+                is_new[pkg->name_id] = true;
+                total_new += pkg->isize;
+                ++nb_total_new;
+            }
+        }
+        alpm_list_free (news);
+        if (rc != E_OK)
+        {
+            break;
+        }
+
+        up->nb_edges = nb_edges - up->first;
+        up->size_orphaned = upgrade_orphans (&graph, up, 1, edges,
+                &up->nb_orphaned);
+
+        total_pkgs += sync->isize - gp->pkg->isize;
+    }
+    if (rc != E_OK)
+    {
+        fprintf (stderr, "Error: out of memory\n");
+        goto done;
+    }
+    /* all together */
+    total_orphaned = upgrade_orphans (&graph, upgrades, nb_upgrades, edges,
+            &nb_total_orphaned);
+    trace_end ("upgrades", NULL, t);
+
+    if (nb_upgrades == 0)
+    {
+        if (!config.quiet)
+        {
+            fputs ("Nothing to upgrade\n", config.out);
+        }
+        goto done;
+    }
+
+#define DELTA(up)   ((up)->sync->isize - graph.pkgs[(up)->n].pkg->isize \
+        + (up)->size_new - (up)->size_orphaned)
+    if (config.quiet)
+    {
+        /* NAME OLD NEW DELTA PACKAGE NEW NB_NEW ORPHANED NB_ORPHANED */
+        for (k = 0; k < nb_upgrades; ++k)
+        {
+            upgrade_t *up = &upgrades[k];
+            pkginfo_t *pkg = graph.pkgs[up->n].pkg;
+            char       buf[4][32];
+
+            format_delta (buf[0], sizeof (buf[0]), DELTA (up));
+            format_delta (buf[1], sizeof (buf[1]), up->sync->isize - pkg->isize);
+            format_delta (buf[2], sizeof (buf[2]), up->size_new);
+            format_delta (buf[3], sizeof (buf[3]), -up->size_orphaned);
+            fprintf (config.out, "%s %s %s %s %s %s %zu %s %zu\n",
+                    pkg->name, pkg->version, up->sync->version, buf[0], buf[1],
+                    buf[2], up->nb_new, buf[3], up->nb_orphaned);
+        }
+        goto done;
+    }
+
+    for (k = 0; k < nb_upgrades; ++k)
+    {
+        upgrade_t *up = &upgrades[k];
+        pkginfo_t *pkg = graph.pkgs[up->n].pkg;
+        char       buf[32];
+        int        len;
+
+        len = (int) strlen (pkg->name);
+        len_max = (len > len_max) ? len : len_max;
+        len = (int) (strlen (pkg->version) + strlen (" -> ") + strlen (up->sync->version));
+        len_versions = (len > len_versions) ? len : len_versions;
+        format_delta (buf, sizeof (buf), DELTA (up));
+        len = (int) strlen (buf);
+        len_delta = (len > len_delta) ? len : len_delta;
+    }
+
+    fputs ("Upgrades:\n", config.out);
+    for (k = 0; k < nb_upgrades; ++k)
+    {
+        upgrade_t *up = &upgrades[k];
+        pkginfo_t *pkg = graph.pkgs[up->n].pkg;
+        char       versions[256];
+        char       buf[32];
+
+        snprintf (versions, sizeof (versions), "%s -> %s",
+                pkg->version, up->sync->version);
+        format_delta (buf, sizeof (buf), DELTA (up));
+        fprintf (config.out, " %*s  %*s  %*s", -len_max, pkg->name,
+                -len_versions, versions, len_delta, buf);
+        format_delta (buf, sizeof (buf), up->sync->isize - pkg->isize);
+        fprintf (config.out, "  (package %s", buf);
+        if (up->nb_new > 0)
+        {
+            format_delta (buf, sizeof (buf), up->size_new);
+            fprintf (config.out, ", %zu new %s", up->nb_new, buf);
+        }
+        if (up->nb_orphaned > 0)
+        {
+            format_delta (buf, sizeof (buf), -up->size_orphaned);
+            fprintf (config.out, ", %zu orphaned %s", up->nb_orphaned, buf);
+        }
+        fputs (")\n", config.out);
+    }
+#undef DELTA
+
+    {
+        char buf[32];
+
+        format_delta (buf, sizeof (buf), total_pkgs + total_new - total_orphaned);
+        fprintf (config.out, "\nTotal: %zu upgrade%s, %s", nb_upgrades,
+                (nb_upgrades > 1) ? "s" : "", buf);
+        format_delta (buf, sizeof (buf), total_pkgs);
+        fprintf (config.out, "  (packages %s", buf);
+        if (nb_total_new > 0)
+        {
+            format_delta (buf, sizeof (buf), total_new);
+            fprintf (config.out, ", %zu new %s", nb_total_new, buf);
+        }
+        if (nb_total_orphaned > 0)
+        {
+            format_delta (buf, sizeof (buf), -total_orphaned);
+            fprintf (config.out, ", %zu orphaned %s", nb_total_orphaned, buf);
+        }
+        fputs (")\n", config.out);
+    }
+
+done:
+    free (upgrades);
+    free (edges);
+    free (kept);
+    free (seen);
+    free (is_new);
+    free_graph (&graph);
+    return rc;
+}
+
+/* reads all of fp at once into buf (to be freed once done), and adds every name
+ * in it to names, pointing into buf. Names are separated by whitespace or NUL
+ * (e.g. from find -print0 or xargs -0) */
+static int
+read_names (FILE *fp, char **buf, alpm_list_t **names)
+{
+    char    *b      = NULL;
+    char    *s, *e;
+    size_t   alloc  = 0;
+    size_t   len    = 0;
+
+    for (;;)
+    {
+        size_t n;
+
+        /* always room for the final NUL */
+        if (alloc - len <= 1)
+        {
+            alloc = (alloc) ? alloc * 2 : 64 * 1024;
+            s = realloc (b, sizeof (*b) * alloc);
+            if (!s)
+            {
+                free (b);
+                return E_NOMEM;
+            }
+            b = s;
+        }
+        n = fread (b + len, sizeof (*b), alloc - len - 1, fp);
+        if (n == 0)
+        {
+            break;
+        }
+        len += n;
+    }
+    if (ferror (fp))
+    {
+        free (b);
+        return E_FILEREAD;
+    }
+    b[len] = '\0';
+    *buf = b;
+
+    for (s = b, e = b + len; s < e; ++s)
+    {
+        char *name;
+
+        while (s < e && (*s == '\0' || isspace ((unsigned char) *s)))
+        {
+            ++s;
+        }
+        if (s == e)
+        {
+            break;
+        }
+        name = s;
+        while (*s != '\0' && !isspace ((unsigned char) *s))
+        {
+            ++s;
+        }
+        *s = '\0';
+        *names = alpm_list_add (*names, name);
+    }
+    return E_OK;
+}
+
+typedef struct _name_pos_t {
+    const char  *name;
+    size_t       pos;
+} name_pos_t;
+
+static int
+name_pos_cmp (const void *np1, const void *np2)
+{
+    const name_pos_t *n1 = np1;
+    const name_pos_t *n2 = np2;
+    int r;
+
+    r = strcmp (n1->name, n2->name);
+    if (r == 0)
+    {
+        r = (n1->pos > n2->pos) - (n1->pos < n2->pos);
+    }
+    return r;
+}
+
+/* removes all but the first occurrence of every name in names */
+static alpm_list_t *
+dedup_names (alpm_list_t *names)
+{
+    name_pos_t  *np;
+    bool        *is_dup;
+    alpm_list_t *i, *next;
+    size_t       nb = alpm_list_count (names);
+    size_t       n;
+
+    if (nb < 2)
+    {
+        return names;
+    }
+    np = malloc (sizeof (*np) * nb);
+    is_dup = calloc (nb, sizeof (*is_dup));
+    if (!np || !is_dup)
+    {
+        /* not a problem, preprocess_package() would skip them anyway */
+        free (np);
+        free (is_dup);
+        return names;
+    }
+    for (n = 0, i = names; i; i = i->next, ++n)
+    {
+        np[n].name = i->data;
+        np[n].pos = n;
+    }
+    qsort (np, nb, sizeof (*np), name_pos_cmp);
+    for (n = 1; n < nb; ++n)
+    {
+        if (strcmp (np[n - 1].name, np[n].name) == 0)
+        {
+            is_dup[np[n].pos] = true;
+        }
+    }
+    for (n = 0, i = names; i; i = next, ++n)
+    {
+        next = i->next;
+        if (is_dup[n])
+        {
+            debug ("ignoring duplicate name %s\n", (char *) i->data);
+            names = alpm_list_remove_item (names, i);
+            free (i);
+        }
+    }
+    free (np);
+    free (is_dup);
+    return names;
+}
+
+#ifdef PACDEP_BENCH
+/* pacdep-bench (make bench): micro-benchmarks of the core primitives, each on
+ * generated local dbs of controlled size, reporting ns & allocations per op.
+ * Always built with ALLOC_STATS */
+
+#define BENCH_MIN_NS            100000000LL /* per primitive & size */
+#define BENCH_MIN_ROUNDS        3
+#define BENCH_MAX_ROUNDS        20
+#define BENCH_MAX_DEPS          5
+#define BENCH_SPAN              64          /* deps are among the next ones */
+
+typedef struct _bench_t bench_t;
+typedef void (*bench_fn) (bench_t *b, data_t *data);
+
+struct _bench_t {
+    long long        ns;
+    size_t           ops;
+    size_t           allocs;
+    size_t           bytes;
+    /* current timed section */
+    long long        start;
+    size_t           start_allocs;
+    size_t           start_bytes;
+    int              rc;            /* E_OK unless the primitive failed */
+};
+
+static long long
+now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline void
+bench_start (bench_t *b)
+{
+    b->start_allocs = alloc_stats.calls;
+    b->start_bytes = alloc_stats.bytes;
+    b->start = now_ns ();
+}
+
+static inline void
+bench_stop (bench_t *b, size_t ops)
+{
+    b->ns += now_ns () - b->start;
+    b->allocs += alloc_stats.calls - b->start_allocs;
+    b->bytes += alloc_stats.bytes - b->start_bytes;
+    b->ops += ops;
+}
+
+/* sends stdout to /dev/null for the output primitives, the original one
+ * being kept in saved for bench_unmute(). On failure, stdout is left (or put
+ * back) as it was */
+static int
+bench_mute (int *saved)
+{
+    int null;
+
+    fflush (stdout);
+    *saved = dup (STDOUT_FILENO);
+    if (*saved < 0)
+    {
+        fprintf (stderr, "Error: cannot duplicate stdout: %s\n", strerror (errno));
+        return E_FILEWRITE;
+    }
+    null = open ("/dev/null", O_WRONLY);
+    if (null < 0)
+    {
+        fprintf (stderr, "Error: cannot open /dev/null: %s\n", strerror (errno));
+        close (*saved);
+        return E_FILEWRITE;
+    }
+    if (dup2 (null, STDOUT_FILENO) < 0)
+    {
+        fprintf (stderr, "Error: cannot redirect stdout: %s\n", strerror (errno));
+        close (null);
+        /* it was left untouched */
+        close (*saved);
+        return E_FILEWRITE;
+    }
+    close (null);
+    return E_OK;
+}
+
+/* puts back stdout as saved by bench_mute() */
+static int
+bench_unmute (int saved)
+{
+    int rc = E_OK;
+
+    fflush (stdout);
+    if (dup2 (saved, STDOUT_FILENO) < 0)
+    {
+        fprintf (stderr, "Error: cannot restore stdout: %s\n", strerror (errno));
+        rc = E_FILEWRITE;
+    }
+    close (saved);
+    return rc;
+}
+
+static alpm_list_t bench_names = { (void *) "p0", &bench_names, NULL };
+
+/* the whole analysis of p0, per package in its tree; What the allocation
+ * budget (-a) applies to */
+static void
+bench_analyse (bench_t *b, data_t *data)
+{
+    bench_start (b);
+    analyse (data, &bench_names);
+    bench_stop (b, alpm_list_count (data->deps));
+}
+
+/* satisfier resolution, as done by add_to_deps() for every dependency */
+static void
+bench_resolve (bench_t *b, data_t *data)
+{
+    pkgdb_t     *pkgdb = data->localdb->data;
+    size_t       nb = 0;
+    size_t       n;
+
+    get_provides (data->localdb, &data->provides_local);
+    bench_start (b);
+    for (n = 0; n < pkgdb->nb_pkgs; ++n)
+    {
+        alpm_list_t *i;
+
+        FOR_LIST (i, pkgdb->pkgs[n].depends)
+        {
+            const char *provision;
+
+            find_dep_satisfier (data, true, i->data, &provision);
+            ++nb;
+        }
+    }
+    bench_stop (b, nb);
+}
+
+/* requirers of a package, as used by both engines & reverse mode */
+static void
+bench_requiredby (bench_t *b, data_t *data)
+{
+    pkgdb_t     *pkgdb = data->localdb->data;
+    size_t       n;
+
+    get_revdeps (data->localdb, &data->requiredby_local);
+    bench_start (b);
+    for (n = 0; n < pkgdb->nb_pkgs; ++n)
+    {
+        alpm_list_free (compute_requiredby (data, &pkgdb->pkgs[n]));
+    }
+    bench_stop (b, pkgdb->nb_pkgs);
+}
+
+/* (re)classification of the whole tree, with each engine */
+static void
+bench_classify_reference (bench_t *b, data_t *data)
+{
+    reset_classification (data);
+    bench_start (b);
+    classify (data, true);
+    bench_stop (b, alpm_list_count (data->deps));
+}
+
+static void
+bench_classify_indexed (bench_t *b, data_t *data)
+{
+    reset_classification (data);
+    bench_start (b);
+    classify (data, false);
+    bench_stop (b, alpm_list_count (data->deps));
+}
+
+/* insertion of every package in its group, then sorting them */
+static void
+bench_groups (bench_t *b, data_t *data)
+{
+    alpm_list_t *i;
+    dep_t       *deps;
+    size_t       n;
+
+    deps = malloc (sizeof (*deps) * (alpm_list_count (data->deps) + 1));
+    if (!deps)
+    {
+        return;
+    }
+    for (i = data->deps, n = 0; i; i = i->next, ++n)
+    {
+        deps[n] = ((pkg_t *) i->data)->dep;
+    }
+    reset_classification (data);
+
+    bench_start (b);
+    for (i = data->deps, n = 0; i; i = i->next, ++n)
+    {
+        pkg_t *p = i->data;
+
+        if (!p->is_main)
+        {
+            move_to_group (data, p, deps[n]);
+            p->dep = deps[n];
+        }
+    }
+    sort_groups (data);
+    bench_stop (b, n);
+    free (deps);
+}
+
+/* sweep of the optional requirers of every package in the tree */
+static void
+bench_optrequiredby (bench_t *b, data_t *data)
+{
+    alpm_list_t *pkgs, *i;
+
+    get_optreqs (data->localdb, &data->optreqs_local);
+    /* as new packages get added to data->deps */
+    pkgs = alpm_list_copy (data->deps);
+    bench_start (b);
+    FOR_LIST (i, pkgs)
+    {
+        get_pkg_optrequiredby (data, i->data);
+    }
+    bench_stop (b, alpm_list_count (pkgs));
+    alpm_list_free (pkgs);
+}
+
+/* listing of all groups */
+static void
+bench_list (bench_t *b, data_t *data)
+{
+    size_t  nb = 0;
+    int     fd;
+    dep_t   d;
+
+    b->rc = bench_mute (&fd);
+    if (b->rc != E_OK)
+    {
+        return;
+    }
+    bench_start (b);
+    for (d = DEP_UNKNOWN + 1; d < NB_DEPS; ++d)
+    {
+        list_dependencies (data, d);
+        nb += alpm_list_count (data->group[d].pkgs);
+    }
+    fflush (stdout);
+    bench_stop (b, nb);
+    b->rc = bench_unmute (fd);
+}
+
+static void
+bench_print_size (bench_t *b, data_t *data)
+{
+    pkgdb_t *pkgdb = data->localdb->data;
+    size_t   n;
+    int      fd;
+
+    b->rc = bench_mute (&fd);
+    if (b->rc != E_OK)
+    {
+        return;
+    }
+    bench_start (b);
+    for (n = 0; n < pkgdb->nb_pkgs; ++n)
+    {
+        print_size (pkgdb->pkgs[n].isize);
+    }
+    fflush (stdout);
+    bench_stop (b, pkgdb->nb_pkgs);
+    b->rc = bench_unmute (fd);
+}
+
+/* a local db of nb packages, as a snapshot: package n depends on up to
+ * BENCH_MAX_DEPS of the next BENCH_SPAN ones (so the tree of p0 holds most of
+ * them), one in 8 provides vN, which half the deps on it use, one in 4 has
+ * optional deps, and one in 5 is explicitly installed */
+static char *
+bench_fixture (unsigned int nb, unsigned long long seed, size_t *len)
+{
+    unsigned long long  state = seed;
+    char               *buf = NULL;
+    unsigned int        n, k;
+    FILE               *fp;
+
+    fp = open_memstream (&buf, len);
+    if (!fp)
+    {
+        return NULL;
+    }
+    fputs (SNAPSHOT_HEADER "\n", fp);
+    for (n = 0; n < nb; ++n)
+    {
+        unsigned int nb_deps = fuzz_rand (&state, BENCH_MAX_DEPS + 1);
+        const char  *sep = "";
+
+        fprintf (fp, "p%u\t1-1\t%u\t%c\t", n,
+                1024 * (1 + fuzz_rand (&state, 100000)),
+                (fuzz_rand (&state, 5) == 0) ? 'e' : 'd');
+        for (k = 0; k < nb_deps; ++k)
+        {
+            unsigned int d = n + 1 + fuzz_rand (&state, BENCH_SPAN);
+
+            if (d >= nb)
+            {
+                break;
+            }
+            fprintf (fp, "%s%c%u", sep,
+                    (d % 8 == 0 && fuzz_rand (&state, 2)) ? 'v' : 'p', d);
+            sep = " ";
+        }
+        fputc ('\t', fp);
+        if (fuzz_rand (&state, 4) == 0 && n > 0)
+        {
+            fprintf (fp, "p%u", fuzz_rand (&state, n));
+        }
+        fputc ('\t', fp);
+        if (n % 8 == 0)
+        {
+            fprintf (fp, "v%u", n);
+        }
+        fputc ('\n', fp);
+    }
+    fclose (fp);
+    return buf;
+}
+
+static const struct {
+    const char      *name;
+    bench_fn         fn;
+    bool             analyse;       /* on data analysed for p0 */
+} benches[] = {
+    { "analyse",            bench_analyse,              false },
+    { "resolve",            bench_resolve,              false },
+    { "requiredby",         bench_requiredby,           false },
+    { "classify-reference", bench_classify_reference,   true },
+    { "classify-indexed",   bench_classify_indexed,     true },
+    { "groups",             bench_groups,               true },
+    { "optrequiredby",      bench_optrequiredby,        true },
+    { "list",               bench_list,                 true },
+    { "print-size",         bench_print_size,           false },
+};
+
+static void
+bench_run (bench_t *b, size_t n, const char *fixture, size_t len)
+{
+    unsigned int r;
+
+    memset (b, 0, sizeof (*b));
+    for (r = 0; r < BENCH_MAX_ROUNDS && b->rc == E_OK
+            && (r < BENCH_MIN_ROUNDS || b->ns < BENCH_MIN_NS); ++r)
+    {
+        pkgdb_t *pkgdb;
+        data_t   data;
+        char    *error;
+        FILE    *fp;
+
+        fp = fmemopen ((void *) fixture, len, "r");
+        if (!fp)
+        {
+            return;
+        }
+        if (load_snapshot_fp (fp, "bench", &pkgdb, &error) != E_OK)
+        {
+            fprintf (stderr, "Error: %s", error);
+            free (error);
+            fclose (fp);
+            return;
+        }
+        fclose (fp);
+
+        init_data (&data, pkgdb, NULL);
+        if (!benches[n].analyse || analyse (&data, &bench_names) == E_OK)
+        {
+            benches[n].fn (b, &data);
+        }
+        free_data (&data);
+    }
+}
+
+static int
+bench_main (int argc, char *argv[])
+{
+    unsigned int        sizes[] = { 500, 2000, 8000 };
+    unsigned long long  seed = 1;
+    const char         *only = NULL;
+    double              budget = 0.0;
+    bool                over = false;
+    int                 o;
+    int                 a;
+
+    while ((o = getopt (argc, argv, "s:p:a:h")) != -1)
+    {
+        char *e;
+
+        errno = 0;
+        if (o == 's')
+        {
+            seed = strtoull (optarg, &e, 10);
+            if (errno == 0 && *e == '\0' && seed > 0)
+            {
+                continue;
+            }
+            fprintf (stderr, "Invalid seed: %s\n", optarg);
+        }
+        else if (o == 'a')
+        {
+            budget = strtod (optarg, &e);
+            if (errno == 0 && *e == '\0' && budget > 0.0)
             {
-                debug ("ignoring explicitly installed %s\n",
-                        alpm_pkg_get_name (pkg));
                 continue;
             }
+            fprintf (stderr, "Invalid budget: %s\n", optarg);
+        }
+        else if (o == 'p')
+        {
+            only = optarg;
+            continue;
+        }
+        fprintf (stderr, "Usage: %s [-s SEED] [-p PRIMITIVE] [-a ALLOCS] [NB_PKGS...]\n"
+                "With -a, fails if analysing takes more than ALLOCS allocations per package\n",
+                argv[0]);
+        return 1;
+    }
+
+    /* same as pacdep's defaults; Single job so numbers are per op */
+    config.jobs = 1;
+    config.list_exclusive = true;
+    config.list_shared = true;
+    config.list_optional = true;
+    config.show_optional = 1;
+
+    fprintf (stdout, "%-20s %8s %10s %12s %10s %12s\n",
+            "primitive", "pkgs", "ops", "ns/op", "allocs/op", "bytes/op");
+    for (a = optind; a <= argc; ++a)
+    {
+        char        *fixture;
+        size_t       len;
+        size_t       s, n;
+        size_t       nb_sizes = 1;
+
+        if (a < argc)
+        {
+            char            *e;
+            unsigned long    nb;
+
+            errno = 0;
+            nb = strtoul (argv[a], &e, 10);
+            if (errno != 0 || *e != '\0' || nb < 1 || nb > UINT_MAX)
+            {
+                fprintf (stderr, "Invalid number of packages: %s\n", argv[a]);
+                return 1;
+            }
+            sizes[0] = (unsigned int) nb;
+        }
+        else if (optind == argc)
+        {
+            nb_sizes = sizeof (sizes) / sizeof (sizes[0]);
+        }
+        else
+        {
+            break;
+        }
 
-            if (config.show_optional < 2)
+        for (s = 0; s < nb_sizes; ++s)
+        {
+            fixture = bench_fixture (sizes[s], seed, &len);
+            if (!fixture)
             {
-                /* we now make sure it isn't required by smthg installed
-                 * but outside of our deptree */
-                alpm_list_t *reqs;
-                alpm_list_t *j;
-                bool         ignore = false;
+                fprintf (stderr, "Error: out of memory\n");
+                return E_NOMEM;
+            }
+            for (n = 0; n < sizeof (benches) / sizeof (benches[0]); ++n)
+            {
+                bench_t  b;
+                double   ops;
 
-                reqs = alpm_pkg_compute_requiredby (pkg);
-                FOR_LIST (j, reqs)
+                if (only && strcmp (only, benches[n].name) != 0)
                 {
-                    const char *name = j->data;
-                    pkg_t *_p;
-
-                    _p = alpm_list_find (data->deps,
-                            name,
-                            (alpm_list_fn_cmp) pkg_find_name_fn);
-                    if (!_p)
-                    {
-                        /* not in our tree, is it installed? */
-                        if (alpm_find_dbs_satisfier (config.alpm,
-                                    config.localdb,
-                                    name))
-                        {
-                            ignore = true;
-                            debug ("ignoring %s required by %s\n",
-                                    alpm_pkg_get_name (pkg),
-                                    name);
-                            break;
-                        }
-                    }
+                    continue;
                 }
-                FREELIST (reqs);
-                if (ignore)
+                bench_run (&b, n, fixture, len);
+                if (b.rc != E_OK)
                 {
-                    continue;
+                    free (fixture);
+                    return b.rc;
+                }
+                ops = (b.ops > 0) ? (double) b.ops : 1.0;
+                fprintf (stdout, "%-20s %8u %10zu %12.1f %10.2f %12.1f\n",
+                        benches[n].name, sizes[s], b.ops, (double) b.ns / ops,
+                        (double) b.allocs / ops, (double) b.bytes / ops);
+                fflush (stdout);
+                if (budget > 0.0 && benches[n].fn == bench_analyse
+                        && (double) b.allocs / ops > budget)
+                {
+                    fprintf (stderr, "Allocation budget exceeded on %u packages: %.2f allocations per package (budget: %.2f)\n",
+                            sizes[s], (double) b.allocs / ops, budget);
+                    over = true;
                 }
             }
-
-            debug ("add %s's optdep %s\n", p->name, alpm_pkg_get_name (pkg));
-            add_to_deps (data, pkg, p);
+            free (fixture);
         }
     }
+    return (over) ? E_MISMATCH : E_OK;
 }
+#endif /* PACDEP_BENCH */
 
 int
 main (int argc, char *argv[])
 {
     const char *conffile = PACMAN_CONFFILE;
     const char *dbpath   = NULL;
+    const char *export   = NULL;
+#ifdef PACDEP_ENGINES
+    unsigned long long seed = 0;
+#endif
 
     memset (&config, 0, sizeof (config_t));
+    config.start = now_us ();
+    config.out = stdout;
+#ifdef PACDEP_BENCH
+    return bench_main (argc, argv);
+#endif
 
     int o;
     int index = 0;
@@ -1443,14 +9704,38 @@ main (int argc, char *argv[])
         { "config",                     required_argument,  0,  'c' },
         { "dbpath",                     required_argument,  0,  'b' },
         { "from-sync",                  no_argument,        0,  'Y' },
+        { "regex",                      no_argument,        0,  OPT_REGEX },
+        { "root",                       required_argument,  0,  OPT_ROOT },
+        { "snapshot",                   required_argument,  0,  OPT_SNAPSHOT },
+        { "export-snapshot",            required_argument,  0,  OPT_EXPORT_SNAPSHOT },
+        { "jobs",                       required_argument,  0,  'j' },
         { "quiet",                      no_argument,        0,  'q' },
         { "show-path",                  no_argument,        0,  'P' },
+        { "explain",                    required_argument,  0,  OPT_EXPLAIN },
+        { "show-provider",              no_argument,        0,  OPT_SHOW_PROVIDER },
+        { "actual-size",                no_argument,        0,  OPT_ACTUAL_SIZE },
+        { "download-size",              no_argument,        0,  OPT_DOWNLOAD_SIZE },
+        { "attribute",                  required_argument,  0,  OPT_ATTRIBUTE },
         { "raw-sizes",                  no_argument,        0,  'w' },
         { "sort-size",                  no_argument,        0,  'z' },
         { "show-optional",              no_argument,        0,  'p' },
         { "explicit",                   no_argument,        0,  'x' },
         { "reverse",                    no_argument,        0,  'r' },
         { "list-requiredby",            no_argument,        0,  'R' },
+        { "max-nodes",                  required_argument,  0,  OPT_MAX_NODES },
+        { "deadline",                   required_argument,  0,  OPT_DEADLINE },
+#ifdef PACDEP_ENGINES
+        { "compare-engines",            no_argument,        0,  OPT_COMPARE_ENGINES },
+        { "fuzz-engines",               required_argument,  0,  OPT_FUZZ_ENGINES },
+#endif
+        { "trace",                      required_argument,  0,  OPT_TRACE },
+        { "output",                     required_argument,  0,  OPT_OUTPUT },
+        { "free",                       required_argument,  0,  OPT_FREE },
+        { "graph-stats",                no_argument,        0,  OPT_GRAPH_STATS },
+        { "check",                      no_argument,        0,  OPT_CHECK },
+        { "overlap",                    no_argument,        0,  OPT_OVERLAP },
+        { "upgrades",                   no_argument,        0,  OPT_UPGRADES },
+        { "hook",                       required_argument,  0,  OPT_HOOK },
         { "list-exclusive",             no_argument,        0,  'e' },
         { "list-exclusive-explicit",    no_argument,        0,  'E' },
         { "list-shared",                no_argument,        0,  's' },
@@ -1461,7 +9746,7 @@ main (int argc, char *argv[])
     };
     for (;;)
     {
-        o = getopt_long (argc, argv, "hVdc:b:qPwzpxrReEsSoO", options, &index);
+        o = getopt_long (argc, argv, "hVdc:b:j:qPwzpxrReEsSoO", options, &index);
         if (o == -1)
         {
             break;
@@ -1489,12 +9774,46 @@ main (int argc, char *argv[])
             case 'Y':
                 config.from_sync = true;
                 break;
+            case OPT_ROOT:
+                config.roots = alpm_list_add (config.roots, optarg);
+                break;
+            case OPT_SNAPSHOT:
+                config.snapshots = alpm_list_add (config.snapshots, optarg);
+                break;
+            case OPT_EXPORT_SNAPSHOT:
+                export = optarg;
+                break;
+            case 'j':
+                {
+                    unsigned long n;
+                    char *e;
+
+                    errno = 0;
+                    n = strtoul (optarg, &e, 10);
+                    if (errno != 0 || *e != '\0' || n == 0 || n > 1024)
+                    {
+                        fprintf (stderr, "Invalid value for option --jobs: %s\n",
+                                optarg);
+                        return 1;
+                    }
+                    config.jobs = (unsigned int) n;
+                }
+                break;
             case 'q':
                 config.quiet = true;
                 break;
             case 'P':
                 config.show_path = true;
                 break;
+            case OPT_SHOW_PROVIDER:
+                config.show_provider = true;
+                break;
+            case OPT_ACTUAL_SIZE:
+                config.actual_size = true;
+                break;
+            case OPT_DOWNLOAD_SIZE:
+                config.download_size = true;
+                break;
             case 'w':
                 config.raw_sizes = true;
                 break;
@@ -1525,6 +9844,179 @@ main (int argc, char *argv[])
             case 'R':
                 config.list_requiredby = true;
                 break;
+            case OPT_MAX_NODES:
+            case OPT_DEADLINE:
+                {
+                    unsigned long n;
+                    char *e;
+
+                    errno = 0;
+                    n = strtoul (optarg, &e, 10);
+                    if (errno != 0 || *e != '\0' || *optarg == '-'
+                            || (o == OPT_MAX_NODES && n > (unsigned int) -1))
+                    {
+                        fprintf (stderr, "Invalid value for option --%s: %s\n",
+                                (o == OPT_MAX_NODES) ? "max-nodes" : "deadline",
+                                optarg);
+                        return 1;
+                    }
+                    if (o == OPT_MAX_NODES)
+                    {
+                        config.max_nodes = (unsigned int) n;
+                    }
+                    else
+                    {
+                        config.deadline = n;
+                    }
+                }
+                break;
+#ifdef PACDEP_ENGINES
+            case OPT_COMPARE_ENGINES:
+                config.compare_engines = true;
+                break;
+#endif
+            case OPT_TRACE:
+                config.trace = optarg;
+                break;
+            case OPT_OUTPUT:
+                {
+                    const char *formats[] = { "human", "quiet", "raw", "json", NULL };
+                    const char *sep = strchr (optarg, ':');
+                    output_t   *output;
+                    int         f;
+
+                    for (f = 0; sep && formats[f]; ++f)
+                    {
+                        if (strlen (formats[f]) == (size_t) (sep - optarg)
+                                && strncmp (formats[f], optarg, (size_t) (sep - optarg)) == 0)
+                        {
+                            break;
+                        }
+                    }
+                    if (!sep || !formats[f] || sep[1] == '\0')
+                    {
+                        fprintf (stderr, "Invalid value for option --output: %s\n",
+                                optarg);
+                        return 1;
+                    }
+                    output = malloc (sizeof (*output));
+                    if (!output)
+                    {
+                        fprintf (stderr, "Error: out of memory\n");
+                        return 1;
+                    }
+                    output->format = (output_format_t) f;
+                    output->file = sep + 1;
+                    config.outputs = alpm_list_add (config.outputs, output);
+                }
+                break;
+            case OPT_GRAPH_STATS:
+                config.graph_stats = true;
+                break;
+            case OPT_CHECK:
+                config.check = true;
+                break;
+            case OPT_OVERLAP:
+                config.overlap = true;
+                break;
+            case OPT_UPGRADES:
+                config.upgrades = true;
+                break;
+            case OPT_EXPLAIN:
+                config.explain = optarg;
+                break;
+            case OPT_REGEX:
+                config.regex = true;
+                break;
+            case OPT_HOOK:
+                if (strcmp (optarg, "remove") == 0)
+                {
+                    config.hook = HOOK_REMOVE;
+                }
+                else if (strcmp (optarg, "install") == 0)
+                {
+                    config.hook = HOOK_INSTALL;
+                }
+                else
+                {
+                    fprintf (stderr, "Invalid value for option --hook: %s\n",
+                            optarg);
+                    return 1;
+                }
+                break;
+            case OPT_ATTRIBUTE:
+                if (strcmp (optarg, "even") == 0)
+                {
+                    config.attribute = ATTRIBUTE_EVEN;
+                }
+                else if (strcmp (optarg, "weighted") == 0)
+                {
+                    config.attribute = ATTRIBUTE_WEIGHTED;
+                }
+                else
+                {
+                    fprintf (stderr, "Invalid value for option --attribute: %s\n",
+                            optarg);
+                    return 1;
+                }
+                break;
+            case OPT_FREE:
+                {
+                    const char *units = "KMGT";
+                    const char *u;
+                    double size;
+                    char *e;
+
+                    errno = 0;
+                    size = strtod (optarg, &e);
+                    if (*e != '\0' && (u = strchr (units, *e)) && e[1] == '\0')
+                    {
+                        int n;
+
+                        for (n = (int) (u - units); n >= 0; --n)
+                        {
+                            size *= 1024.0;
+                        }
+                        ++e;
+                    }
+                    if (errno != 0 || *e != '\0' || e == optarg
+                            || !(size >= 1.0 && size < 9e18))
+                    {
+                        fprintf (stderr, "Invalid value for option --free: %s\n",
+                                optarg);
+                        return 1;
+                    }
+                    config.free_target = (off_t) size;
+                }
+                break;
+#ifdef PACDEP_ENGINES
+            case OPT_FUZZ_ENGINES:
+                {
+                    unsigned long n;
+                    char *e;
+
+                    errno = 0;
+                    n = strtoul (optarg, &e, 10);
+                    if (errno == 0 && *e == ':')
+                    {
+                        /* 0 isn't a valid seed (see fuzz_rand) */
+                        if (e[1] == '\0' || e[1] == '-'
+                                || (seed = strtoull (e + 1, &e, 10)) == 0)
+                        {
+                            errno = EINVAL;
+                        }
+                    }
+                    if (errno != 0 || *e != '\0' || *optarg == '-'
+                            || n == 0 || n > (unsigned int) -1)
+                    {
+                        fprintf (stderr, "Invalid value for option --fuzz-engines: %s\n",
+                                optarg);
+                        return 1;
+                    }
+                    config.fuzz_rounds = (unsigned int) n;
+                }
+                break;
+#endif
             case 'e':
                 config.list_exclusive = true;
                 break;
@@ -1551,7 +10043,114 @@ main (int argc, char *argv[])
                 return 1;
         }
     }
-    if (optind == argc)
+    {
+        alpm_list_t *i;
+        unsigned int nb_stdin = 0;
+        int n;
+
+        /* stdin can only be read once, be it for a snapshot or names */
+        FOR_LIST (i, config.snapshots)
+        {
+            if (strcmp (i->data, "-") == 0)
+            {
+                ++nb_stdin;
+            }
+        }
+        for (n = optind; nb_stdin > 0 && n < argc; ++n)
+        {
+            if (strcmp (argv[n], "-") == 0)
+            {
+                ++nb_stdin;
+                break;
+            }
+        }
+        if (nb_stdin > 1)
+        {
+            fprintf (stderr,
+                    "Option --snapshot=- cannot be used more than once, nor with - as package name\n");
+            return 1;
+        }
+    }
+    if ((config.free_target != 0) + config.graph_stats + config.check
+            + config.overlap + config.upgrades > 1)
+    {
+        fprintf (stderr,
+                "Options --free, --graph-stats, --check, --overlap and --upgrades cannot be used together\n");
+        return 1;
+    }
+    if (config.outputs && (config.fuzz_rounds || export || config.free_target
+                || config.graph_stats || config.check || config.overlap
+                || config.upgrades))
+    {
+        fprintf (stderr,
+                "Option --output cannot be used with --fuzz-engines, --export-snapshot, --free, --graph-stats, --check, --overlap or --upgrades\n");
+        return 1;
+    }
+    if (config.fuzz_rounds)
+    {
+        if (optind < argc || export || config.roots || config.snapshots || config.reverse)
+        {
+            fprintf (stderr,
+                    "Option --fuzz-engines cannot be used with package names, --export-snapshot, --root, --snapshot or --reverse\n");
+            return 1;
+        }
+    }
+    else if (export)
+    {
+        if (optind < argc || config.roots || config.snapshots)
+        {
+            fprintf (stderr,
+                    "Option --export-snapshot cannot be used with package names, --root or --snapshot\n");
+            return 1;
+        }
+    }
+    else if (config.hook)
+    {
+        if (optind < argc || config.roots || config.snapshots
+                || config.reverse || config.from_sync || config.free_target
+                || config.graph_stats || config.check || config.overlap
+                || config.upgrades || config.outputs || config.explain
+                || config.attribute)
+        {
+            fprintf (stderr,
+                    "Option --hook cannot be used with package names, --root, --snapshot, --reverse, --from-sync, --free, --graph-stats, --check, --overlap, --upgrades, --output, --explain or --attribute\n");
+            return 1;
+        }
+        /* what is installed comes from the sync dbs */
+        config.from_sync = (config.hook == HOOK_INSTALL);
+    }
+    else if (config.free_target)
+    {
+        if (config.roots || alpm_list_count (config.snapshots) > 1
+                || config.reverse || config.from_sync)
+        {
+            fprintf (stderr,
+                    "Option --free cannot be used with --root, --reverse, --from-sync or multiple --snapshot\n");
+            return 1;
+        }
+    }
+    else if (config.graph_stats || config.check || config.upgrades)
+    {
+        if (optind < argc || config.roots
+                || alpm_list_count (config.snapshots) > 1
+                || config.reverse || config.from_sync)
+        {
+            fprintf (stderr,
+                    "Option --%s cannot be used with package names, --root, --reverse, --from-sync or multiple --snapshot\n",
+                    (config.check) ? "check"
+                    : (config.upgrades) ? "upgrades" : "graph-stats");
+            return 1;
+        }
+    }
+    else if (config.overlap && (config.roots
+                || alpm_list_count (config.snapshots) > 1
+                || config.reverse || config.from_sync))
+    {
+        fprintf (stderr,
+                "Option --overlap cannot be used with --root, --reverse, --from-sync or multiple --snapshot\n");
+        return 1;
+    }
+    else if (optind == argc)
     {
         fprintf (stderr, "Missing package name(s)\n");
         show_help (argv[0]);
@@ -1566,11 +10165,27 @@ main (int argc, char *argv[])
     {
         config.show_optional = 1;
     }
+    if (config.jobs == 0)
+    {
+        long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+        config.jobs = (n > 0) ? (unsigned int) n : 1;
+    }
     /* option -R implies -r */
     if (config.list_requiredby && !config.reverse)
     {
         config.reverse = 1;
     }
+    if (config.attribute && config.reverse)
+    {
+        fprintf (stderr, "Option --attribute cannot be used with --reverse\n");
+        return 1;
+    }
+    if (config.explain && config.reverse)
+    {
+        fprintf (stderr, "Option --explain cannot be used with --reverse\n");
+        return 1;
+    }
     /* special handling of options for reverse mode */
     if (config.reverse)
     {
@@ -1578,402 +10193,238 @@ main (int argc, char *argv[])
         config.explicit = false;
     }
 
+#ifdef PACDEP_ENGINES
+    if (config.fuzz_rounds)
+    {
+        /* the seed is always printed, so a run can be reproduced */
+        return fuzz_engines (config.fuzz_rounds,
+                (seed) ? seed : (unsigned long long) now_us ());
+    }
+#endif
+
+    alpm_list_t *i;
+    alpm_list_t *names = NULL;
+    char *names_read = NULL;
+    pkgdb_t *localdb;
     char *error;
+    long long t;
     int rc;
 
+    t = trace_begin ();
     rc = alpm_load (&config.alpm, conffile, dbpath, &error);
+    trace_end ("alpm_load", NULL, t);
     if (rc != E_OK)
     {
         fprintf (stderr, "Error: %s", error);
         free (error);
+        if (config.trace)
+        {
+            write_trace ();
+        }
         return rc;
     }
 
-    config.localdb = alpm_list_add (NULL, alpm_get_localdb (config.alpm));
-    config.syncdbs = alpm_get_syncdbs (config.alpm);
-
-    data_t data;
-
-    memset (&data, 0, sizeof (data_t));
-    for ( ; optind < argc; ++optind)
+    if (export)
     {
-        /* "-" as package name can be used to read from stdin */
-        if (argv[optind][0] == '-' && argv[optind][1] == '\0')
-        {
-            char    *name;
-            char    *s;
-            char     c;
-            size_t   alloc  = BUF_LEN;
-            size_t   len    = 0;
-
-            name = malloc (sizeof (*name) * alloc);
-            if (!name)
-            {
-                fprintf (stderr, "Error: out of memory\n");
-                rc = E_NOMEM;
-                goto release;
-            }
-            s = name;
-            while ((c = (char) fgetc (stdin)))
-            {
-                if (c == EOF || isspace (c))
-                {
-                    if (s > name)
-                    {
-                        *s = '\0';
-                        preprocess_package (&data, name, true);
-                        s = name;
-                        len = 0;
-                    }
-                    if (c == EOF)
-                    {
-                        break;
-                    }
-                }
-                else
-                {
-                    if (++len >= alloc)
-                    {
-                        alloc += BUF_LEN;
-                        name = realloc (name, sizeof (*name) * alloc);
-                        s = name + len - 1;
-                    }
-                    *s++ = c;
-                }
-            }
-            free (name);
-        }
-        else
+        localdb = new_handle_pkgdb (config.alpm, NULL);
+        rc = (localdb) ? export_snapshot (localdb, export) : E_NOMEM;
+        if (rc == E_NOMEM)
         {
-            preprocess_package (&data, argv[optind], false);
+            fprintf (stderr, "Error: out of memory\n");
         }
-    }
-
-    if (!data.pkgs)
-    {
-        fprintf (stderr, "No package to process\n");
-        rc = E_NOTHING;
+        free_pkgdb (localdb);
         goto release;
     }
 
-    int len_max = 0;
-    int len;
-
-    if (!config.quiet)
+    FOR_LIST (i, alpm_get_syncdbs (config.alpm))
     {
-        data.group[DEP_UNKNOWN].title            = "Total dependencies:";
-        data.group[DEP_EXCLUSIVE].title          = "Exclusive dependencies:";
-        data.group[DEP_EXCLUSIVE_EXPLICIT].title = "Exclusive explicit dependencies:";
-        data.group[DEP_OPTIONAL].title           = "Optional dependencies:";
-        data.group[DEP_OPTIONAL_EXPLICIT].title  = "Optional explicit dependencies:";
-        data.group[DEP_SHARED].title             = "Shared dependencies:";
-        data.group[DEP_SHARED_EXPLICIT].title    = "Shared explicit dependencies:";
-        if (config.reverse)
-        {
-            data.group[DEP_EXCLUSIVE].title      = "Required by:";
-            data.group[DEP_OPTIONAL].title       = "Optionally required by:";
-        }
-
-        len = (int) strlen (data.group[DEP_UNKNOWN].title) + 1;
-        len_max = len;
+        pkgdb_t *pkgdb = new_handle_pkgdb (config.alpm, i->data);
 
-        const char **t, *titles[] = { data.group[DEP_EXCLUSIVE].title,
-            data.group[DEP_EXCLUSIVE_EXPLICIT].title,
-            data.group[DEP_OPTIONAL].title,
-            data.group[DEP_OPTIONAL_EXPLICIT].title,
-            data.group[DEP_SHARED].title,
-            data.group[DEP_SHARED_EXPLICIT].title,
-            NULL
-        };
-        for (t = titles; *t; ++t)
+        if (!pkgdb)
         {
-            if (config.reverse && t == titles + 3)
-            {
-                break;
-            }
-            if ((t - titles) % 2 && !config.explicit)
-            {
-                continue;
-            }
-            len = (int) strlen (*t) + 1;
-            if (len > len_max)
-            {
-                len_max = len;
-            }
+            fprintf (stderr, "Error: out of memory\n");
+            rc = E_NOMEM;
+            goto release;
         }
+        config.syncdbs = alpm_list_add (config.syncdbs, pkgdb);
     }
 
-    /* all packages and their deps are known. time to "sort" everything */
-    alpm_list_t *i;
-    FOR_LIST (i, data.pkgs)
+    t = trace_begin ();
+    if (config.download_size && index_cache () != E_OK)
     {
-        pkg_t *pkg = i->data;
-
-        pkg->is_provided = strcmp (pkg->name_asked, pkg->name);
-        if (!config.quiet)
-        {
-            /* calculate len_max to show package name (/w repo/provided if apply) */
-            if (!pkg->is_provided)
-            {
-                len = (int) strlen (pkg->name_asked) + 1;
-            }
-            else
-            {
-                len = (int) strlen (pkg->name) + 1;
-                /* 16 == strlen (" is provided by ") */
-                len += (int) strlen (pkg->name_asked) + 16;
-            }
-            if (pkg->repo)
-            {
-                /* +1 for the / */
-                len += 1 + (int) strlen (pkg->repo);
-            }
-            if (len > len_max)
-            {
-                len_max = len;
-            }
-        }
-
-        if (!config.reverse)
-        {
-            debug ("determine dependencies type (exclusive/shared)\n");
-            /* restore to DEP_UNKNOWN so it's fully processed */
-            pkg->dep = DEP_UNKNOWN;
-            set_pkg_dep (&data, NULL, pkg, DEP_EXCLUSIVE);
-            if (config.show_optional)
-            {
-                alpm_list_t *j;
-
-                FOR_LIST (j, alpm_pkg_get_optdepends (pkg->pkg))
-                {
-                    char *name = ((alpm_depend_t *) j->data)->name;
-                    char *s;
-                    pkg_t *p;
-
-                    /* optdepends are info strings: "package: some desc" */
-                    s = strchr (name, ':');
-                    if (s)
-                    {
-                        *s = '\0';
-                    }
-
-                    /* if it's in data.deps it is an optdep to list/count as such */
-                    p = alpm_list_find (data.deps,
-                            name,
-                            (alpm_list_fn_cmp) pkg_find_name_fn);
-                    if (s)
-                    {
-                        *s = ':';
-                    }
-                    if (!p)
-                    {
-                        continue;
-                    }
-
-                    dep_t dep;
-
-                    if (!config.explicit)
-                    {
-                        dep = DEP_OPTIONAL;
-                    }
-                    else
-                    {
-                        if (!p->repo
-                                && alpm_pkg_get_reason (p->pkg) == ALPM_PKG_REASON_EXPLICIT)
-                        {
-                            dep = DEP_OPTIONAL_EXPLICIT;
-                        }
-                        else
-                        {
-                            dep = DEP_OPTIONAL;
-                        }
-                    }
-                    set_pkg_dep (&data, NULL, p, dep);
-                }
-            }
-        }
-        else
-        {
-            get_pkg_requiredby (&data, pkg);
-            if (config.show_optional)
-            {
-                get_pkg_optrequiredby (&data, pkg);
-            }
-        }
-        /* put the package size under DEP_UNKNOWN (not used otherwise) */
-        data.group[DEP_UNKNOWN].size_local += alpm_pkg_get_isize (pkg->pkg);
+        fprintf (stderr, "Error: out of memory\n");
+        rc = E_NOMEM;
+        goto release;
     }
+    trace_end ("index_cache", NULL, t);
 
-    off_t size_exclusive = data.group[DEP_EXCLUSIVE].size
-        + data.group[DEP_EXCLUSIVE_EXPLICIT].size;
-    off_t size_shared = data.group[DEP_SHARED].size
-        + data.group[DEP_SHARED_EXPLICIT].size;
-    off_t size_optional = data.group[DEP_OPTIONAL].size
-        + data.group[DEP_OPTIONAL_EXPLICIT].size;
-
-    int nb_pkg = (int) alpm_list_count (data.pkgs);
-    FOR_LIST (i, data.pkgs)
+    for ( ; optind < argc; ++optind)
     {
-        pkg_t *pkg = i->data;
-
-        if (pkg->repo)
+        /* "-" as package name can be used to read from stdin (once) */
+        if (argv[optind][0] == '-' && argv[optind][1] == '\0')
         {
-            if (!pkg->is_provided)
+            if (names_read)
             {
-                fprintf (stdout, "%s/%*s",
-                        pkg->repo,
-                        -len_max + (int) strlen (pkg->repo) + 1,
-                        pkg->name_asked);
+                continue;
             }
-            else
+            rc = read_names (stdin, &names_read, &names);
+            if (rc != E_OK)
             {
-                if (config.quiet)
-                {
-                    fprintf (stdout, "%s %s/%s",
-                            pkg->name_asked,
-                            pkg->repo,
-                            pkg->name);
-                }
-                else
-                {
-                    fprintf (stdout, "%s is provided by %s/%*s",
-                            pkg->name_asked,
-                            pkg->repo,
-                            -len_max + (int) strlen (pkg->name_asked) + 16
-                                + (int) strlen (pkg->repo) + 1,
-                            pkg->name);
-                }
+                fputs ((rc == E_NOMEM)
+                        ? "Error: out of memory\n"
+                        : "Error: Package names could not be read from stdin\n",
+                        stderr);
+                goto release;
             }
         }
-        else if (!pkg->is_provided)
-        {
-            fprintf (stdout, "%*s", -len_max, pkg->name_asked);
-        }
         else
         {
-            if (config.quiet)
-            {
-                fprintf (stdout, "%s %s",
-                        pkg->name_asked,
-                        pkg->name);
-            }
-            else
-            {
-                fprintf (stdout, "%s is provided by %*s",
-                        pkg->name_asked,
-                        -len_max + (int) strlen (pkg->name_asked) + 16,
-                        pkg->name);
-            }
-        }
-        if (config.quiet)
-        {
-            fputc (' ', stdout);
-        }
-        print_size (alpm_pkg_get_isize (pkg->pkg));
-
-        /* more than one pkg, no package size -- it'll be on a new line, since
-         * it's a combined size for all packages.
-         * In quiet or reverse mode, no package size either. */
-        if (nb_pkg > 1 || config.quiet || config.reverse)
-        {
-            fputc ('\n', stdout);
+            names = alpm_list_add (names, argv[optind]);
         }
     }
-
-    /* package size doesn't apply in quiet, reverse, or with SCE_MIXED */
-    if (!config.quiet && !config.reverse && data.source != SCE_MIXED)
+    if (config.hook)
     {
-        if (nb_pkg > 1)
+        /* NeedsTargets: one target per line on stdin */
+        rc = read_names (stdin, &names_read, &names);
+        if (rc != E_OK)
         {
-            fprintf (stdout, "%*s", -len_max, "");
-            print_size (data.group[DEP_UNKNOWN].size_local);
+            fputs ((rc == E_NOMEM)
+                    ? "Error: out of memory\n"
+                    : "Error: Targets could not be read from stdin\n",
+                    stderr);
+            goto release;
         }
+    }
+    names = dedup_names (names);
 
-        /* pkg size + exclusive & optional deps of its kind (local/sync) */
-        data.group[DEP_UNKNOWN].size = data.group[DEP_EXCLUSIVE].size_local
-            + data.group[DEP_EXCLUSIVE_EXPLICIT].size_local
-            + data.group[DEP_OPTIONAL].size_local
-            + data.group[DEP_OPTIONAL_EXPLICIT].size_local;
-        if (data.source == SCE_SYNC)
-        {
-            data.group[DEP_UNKNOWN].size *= -1;
-            data.group[DEP_UNKNOWN].size += data.group[DEP_EXCLUSIVE].size
-                + data.group[DEP_EXCLUSIVE_EXPLICIT].size
-                + data.group[DEP_OPTIONAL].size
-                + data.group[DEP_OPTIONAL_EXPLICIT].size;
-        }
-        data.group[DEP_UNKNOWN].size += data.group[DEP_UNKNOWN].size_local;
-        if (data.group[DEP_UNKNOWN].size > data.group[DEP_UNKNOWN].size_local)
+    /* a single snapshot is analysed as if it was the local db */
+    if (config.roots || alpm_list_count (config.snapshots) > 1)
+    {
+        rc = analyse_roots (names);
+        goto release;
+    }
+    else if (config.snapshots)
+    {
+        t = trace_begin ();
+        rc = load_snapshot (config.snapshots->data, &localdb, &error);
+        trace_end ("load_snapshot", config.snapshots->data, t);
+        if (rc != E_OK)
         {
-            fputs (" (", stdout);
-            print_size (data.group[DEP_UNKNOWN].size);
-            fputs (")\n", stdout);
+            fprintf (stderr, "Error: %s", error);
+            free (error);
+            goto release;
         }
-        else
+    }
+    else
+    {
+        localdb = new_handle_pkgdb (config.alpm, NULL);
+        if (!localdb)
         {
-            fputc ('\n', stdout);
+            fprintf (stderr, "Error: out of memory\n");
+            rc = E_NOMEM;
+            goto release;
         }
     }
 
-    /* exclusive deps */
-    print_group (&data,
-            DEP_EXCLUSIVE,
-            len_max,
-            size_exclusive,
-            config.list_exclusive,
-            config.list_exclusive_explicit);
+    data_t data;
 
-    if (config.show_optional)
+    init_data (&data, localdb, NULL);
+    if (config.hook)
     {
-        /* optional deps */
-        print_group (&data,
-                DEP_OPTIONAL,
-                len_max,
-                size_optional,
-                config.list_optional,
-                config.list_optional_explicit);
+        rc = run_hook (&data, names, now_us () - config.start);
+        free_data (&data);
+        goto release;
     }
-
-    if (!config.reverse)
+    else if (config.free_target)
     {
-        /* shared deps */
-        print_group (&data,
-                DEP_SHARED,
-                len_max,
-                size_shared,
-                config.list_shared,
-                config.list_shared_explicit);
+        rc = plan_removal (&data, names);
+        free_data (&data);
+        goto release;
     }
-
-    if (!config.quiet)
+    else if (config.check)
     {
-        /* total deps */
-        fprintf (stdout, "%*s", -len_max, data.group[DEP_UNKNOWN].title);
-        print_size (size_exclusive + size_shared + size_optional);
-        fputs (" (", stdout);
-        print_size (data.group[DEP_UNKNOWN].size_local
-                + size_exclusive
-                + size_shared
-                + size_optional);
-        fputs (")\n", stdout);
+        rc = check_deps (&data);
+        free_data (&data);
+        goto release;
     }
-
-    /* free list of deps */
-    alpm_list_free_inner (data.deps, (alpm_list_fn_free) free_pkg);
-    alpm_list_free (data.deps);
-    data.deps = NULL;
-
-    /* free groups list of packages */
-    int d;
-    for (d = 0; d < NB_DEPS; ++d)
+    else if (config.graph_stats)
+    {
+        rc = graph_stats (&data);
+        free_data (&data);
+        goto release;
+    }
+    else if (config.overlap)
+    {
+        rc = print_overlap (&data, names);
+        free_data (&data);
+        goto release;
+    }
+    else if (config.upgrades)
+    {
+        rc = print_upgrades (&data);
+        free_data (&data);
+        goto release;
+    }
+    rc = analyse (&data, names);
+    if (rc == E_NOTHING)
+    {
+        fprintf (stderr, "No package to process\n");
+    }
+    else
     {
-        alpm_list_free (data.group[d].pkgs);
+        if (config.actual_size)
+        {
+            t = trace_begin ();
+            get_actual_sizes (&data,
+                    (config.snapshots) ? NULL : alpm_option_get_root (config.alpm));
+            trace_end ("get_actual_sizes", NULL, t);
+        }
+        if (config.download_size)
+        {
+            t = trace_begin ();
+            get_download_sizes (&data);
+            trace_end ("get_download_sizes", NULL, t);
+        }
+        t = trace_begin ();
+        print_data (&data);
+        trace_end ("output", NULL, t);
+        if (config.outputs)
+        {
+            rc = write_outputs (&data, NULL, 0, NULL);
+        }
+        if (data.engines_diff > 0)
+        {
+            rc = E_MISMATCH;
+        }
     }
+    free_data (&data);
 
 release:
-    alpm_list_free (data.pkgs);
+    alpm_list_free (names);
+    free (names_read);
     debug ("release libalpm\n");
     alpm_release (config.alpm);
-    alpm_list_free (config.localdb);
+    alpm_list_free (config.roots);
+    alpm_list_free (config.snapshots);
+    alpm_list_free_inner (config.outputs, free);
+    alpm_list_free (config.outputs);
+    free_cache_index ();
+    free_nameidx (&config.optreqs_sync);
+    free_nameidx (&config.provides_sync);
+    free_nameidx (&config.requiredby_sync);
+    alpm_list_free_inner (config.syncdbs, (alpm_list_fn_free) free_pkgdb);
+    alpm_list_free (config.syncdbs);
+    free_strpool ();
+    free_workers ();
+#ifdef ALLOC_STATS
+    fprintf (stderr, "Allocations: %zu (%zu bytes), peak %lld bytes live; %zu packages processed, %.1f allocations per package\n",
+            alloc_stats.calls, alloc_stats.bytes, alloc_stats.peak,
+            alloc_stats.nb_pkgs, (alloc_stats.nb_pkgs > 0)
+            ? (double) alloc_stats.calls / (double) alloc_stats.nb_pkgs : 0.0);
+#endif
+    if (config.trace && write_trace () != E_OK && rc == E_OK)
+    {
+        rc = E_FILEWRITE;
+    }
     return rc;
 }